@@ -3,25 +3,30 @@
 #include "CharMatcher.h"
 #include "util.h"
 
-CharMatcher::CharMatcher(RView source)
+template <typename CharT>
+BasicCharMatcher<CharT>::BasicCharMatcher(View source, size_t pos)
     : source_(source)
-    , pos_(0) {
+    , pos_(pos) {
 }
 
-RView CharMatcher::Origin() const {
+template <typename CharT>
+StringView<CharT> BasicCharMatcher<CharT>::Origin() const {
     return source_;
 }
 
-size_t CharMatcher::CurrentPos() const {
+template <typename CharT>
+size_t BasicCharMatcher<CharT>::CurrentPos() const {
     return pos_;
 }
 
-RChar CharMatcher::GetChar() {
+template <typename CharT>
+CharT BasicCharMatcher<CharT>::GetChar() {
     assert(pos_ < source_.size());
     return source_[pos_++];
 }
 
-bool CharMatcher::Match(RChar c) {
+template <typename CharT>
+bool BasicCharMatcher<CharT>::Match(CharT c) {
     if (pos_ < source_.size() && source_[pos_] == c)
     {
         ++pos_;
@@ -31,11 +36,13 @@ bool CharMatcher::Match(RChar c) {
         return false;
 }
 
-bool CharMatcher::TryMatch(RChar c) const {
+template <typename CharT>
+bool BasicCharMatcher<CharT>::TryMatch(CharT c) const {
     return pos_ < source_.size() && source_[pos_] == c;
 }
 
-bool CharMatcher::MatchTwo(RChar c1, RChar c2) {
+template <typename CharT>
+bool BasicCharMatcher<CharT>::MatchTwo(CharT c1, CharT c2) {
     if (pos_ + 1 < source_.size() && source_[pos_] == c1 &&
         source_[pos_ + 1] == c2)
     {
@@ -46,7 +53,8 @@ bool CharMatcher::MatchTwo(RChar c1, RChar c2) {
         return false;
 }
 
-bool CharMatcher::MatchRange(RView range) {
+template <typename CharT>
+bool BasicCharMatcher<CharT>::MatchRange(View range) {
     if (pos_ + range.size() > source_.size())
         return false;
     size_t p = pos_;
@@ -59,11 +67,12 @@ bool CharMatcher::MatchRange(RView range) {
     return true;
 }
 
-bool CharMatcher::TryMatchAny(RView candidates) const {
+template <typename CharT>
+bool BasicCharMatcher<CharT>::TryMatchAny(View candidates) const {
     if (pos_ < source_.size())
     {
-        RChar c = source_[pos_];
-        for (RChar ch : candidates)
+        CharT c = source_[pos_];
+        for (CharT ch : candidates)
         {
             if (ch == c)
                 return true;
@@ -72,7 +81,8 @@ bool CharMatcher::TryMatchAny(RView candidates) const {
     return false;
 }
 
-bool CharMatcher::MatchBackword(RChar c) {
+template <typename CharT>
+bool BasicCharMatcher<CharT>::MatchBackword(CharT c) {
     if (pos_ > 0 && source_[pos_ - 1] == c)
     {
         --pos_;
@@ -82,7 +92,8 @@ bool CharMatcher::MatchBackword(RChar c) {
         return false;
 }
 
-bool CharMatcher::MatchRangeBackword(RView range) {
+template <typename CharT>
+bool BasicCharMatcher<CharT>::MatchRangeBackword(View range) {
     if (pos_ < range.size())
         return false;
     size_t p = pos_;
@@ -95,8 +106,11 @@ bool CharMatcher::MatchRangeBackword(RView range) {
     return true;
 }
 
-LexMatcher::LexMatcher(RView source)
-    : CharMatcher(source) {
+template class BasicCharMatcher<RChar>;
+template class BasicCharMatcher<RByte>;
+
+LexMatcher::LexMatcher(RView source, size_t pos)
+    : CharMatcher(source, pos) {
 }
 
 bool LexMatcher::MatchUInt32(size_t * value) {
@@ -4,33 +4,38 @@
 
 #include <cassert>
 
-class CharMatcher {
+template <typename CharT>
+class BasicCharMatcher {
 public:
-    explicit CharMatcher(RView source);
+    typedef StringView<CharT> View;
 
-    RView Origin() const;
+    explicit BasicCharMatcher(View source, size_t pos = 0);
+
+    View Origin() const;
     size_t CurrentPos() const;
 
-    RChar GetChar();
+    CharT GetChar();
 
-    bool Match(RChar c);
-    bool TryMatch(RChar c) const;
-    bool MatchTwo(RChar c1, RChar c2);
-    bool MatchRange(RView range);
-    bool TryMatchAny(RView candidates) const;
+    bool Match(CharT c);
+    bool TryMatch(CharT c) const;
+    bool MatchTwo(CharT c1, CharT c2);
+    bool MatchRange(View range);
+    bool TryMatchAny(View candidates) const;
 
     // TODO: rename to BackwordXXX
-    bool MatchBackword(RChar c);
-    bool MatchRangeBackword(RView range);
+    bool MatchBackword(CharT c);
+    bool MatchRangeBackword(View range);
 
 protected:
-    RView source_;
+    View source_;
     size_t pos_;
 };
 
+typedef BasicCharMatcher<RChar> CharMatcher;
+
 class LexMatcher : public CharMatcher {
 public:
-    explicit LexMatcher(RView source);
+    explicit LexMatcher(RView source, size_t pos = 0);
     bool MatchUInt32(size_t * value);
     bool TryMatchUInt32() const;
 };
@@ -0,0 +1,380 @@
+#include "stdafx.h"
+
+#include "DenseDfa.h"
+#include "util.h"
+
+// Merge states no input can tell apart: states start out grouped by the
+// matches they reach, and a group is split while some class leads part of
+// it into a group and the rest elsewhere. 'table' is [state * classes +
+// class]. Returns the group of each state.
+static std::vector<int> Minimize(const std::vector<int> & table,
+                                 const std::vector<std::vector<UINT32>> & key,
+                                 size_t classes,
+                                 std::vector<std::vector<int>> * blocks) {
+    size_t n = key.size();
+    // States that 'class' leads to 'state' are inverse[begin[class * n +
+    // state] .. begin[class * n + state + 1]).
+    std::vector<size_t> begin(classes * n + 1);
+    for (size_t s = 0; s < n; ++s)
+    {
+        for (size_t a = 0; a < classes; ++a)
+            ++begin[a * n + table[s * classes + a] + 1];
+    }
+    for (size_t i = 1; i < begin.size(); ++i)
+        begin[i] += begin[i - 1];
+    std::vector<int> inverse(n * classes);
+    std::vector<size_t> fill(begin.begin(), begin.end() - 1);
+    for (size_t s = 0; s < n; ++s)
+    {
+        for (size_t a = 0; a < classes; ++a)
+            inverse[fill[a * n + table[s * classes + a]]++] = s;
+    }
+
+    std::vector<int> block_of(n);
+    std::map<std::vector<UINT32>, int> by_key;
+    for (size_t s = 0; s < n; ++s)
+    {
+        auto it = by_key.emplace(key[s], blocks->size()).first;
+        if (it->second == static_cast<int>(blocks->size()))
+            blocks->emplace_back();
+        (*blocks)[it->second].push_back(s);
+        block_of[s] = it->second;
+    }
+
+    // Splitters (block, class) still to apply.
+    std::vector<std::pair<int, size_t>> work;
+    std::vector<bool> in_work(blocks->size() * classes, true);
+    for (size_t b = 0; b < blocks->size(); ++b)
+    {
+        for (size_t a = 0; a < classes; ++a)
+            work.emplace_back(b, a);
+    }
+    std::vector<bool> marked(n);
+    std::vector<size_t> marked_count(blocks->size());
+    std::vector<int> preds, touched;
+    while (!work.empty())
+    {
+        int b = work.back().first;
+        size_t a = work.back().second;
+        work.pop_back();
+        in_work[b * classes + a] = false;
+
+        for (int t : (*blocks)[b])
+        {
+            for (size_t i = begin[a * n + t]; i < begin[a * n + t + 1]; ++i)
+            {
+                int s = inverse[i];
+                if (marked[s])
+                    continue;
+                marked[s] = true;
+                preds.push_back(s);
+                if (marked_count[block_of[s]]++ == 0)
+                    touched.push_back(block_of[s]);
+            }
+        }
+        for (int y : touched)
+        {
+            if (marked_count[y] < (*blocks)[y].size())
+            {
+                // The marked part becomes block z.
+                int z = static_cast<int>(blocks->size());
+                std::vector<int> in, out;
+                for (int s : (*blocks)[y])
+                    (marked[s] ? in : out).push_back(s);
+                for (int s : in)
+                    block_of[s] = z;
+                (*blocks)[y] = std::move(out);
+                blocks->push_back(std::move(in));
+                marked_count.push_back(0);
+                in_work.resize(blocks->size() * classes);
+                for (size_t c = 0; c < classes; ++c)
+                {
+                    int smaller = ((*blocks)[z].size() < (*blocks)[y].size()
+                                       ? z
+                                       : y);
+                    int add = (in_work[y * classes + c] ? z : smaller);
+                    if (!in_work[add * classes + c])
+                    {
+                        in_work[add * classes + c] = true;
+                        work.emplace_back(add, c);
+                    }
+                }
+            }
+            marked_count[y] = 0;
+        }
+        for (int s : preds)
+            marked[s] = false;
+        preds.clear();
+        touched.clear();
+    }
+    return block_of;
+}
+
+std::shared_ptr<const DenseDfa> DenseDfa::Build(const Program & program,
+                                                bool leftmost_first,
+                                                bool seeding,
+                                                bool jit,
+                                                size_t max_states) {
+    // Keep the lazy cache from flushing while it is explored.
+    RAssert(max_states < DfaMatcher::Cache::kMaxStates);
+
+    // The code units the program names, then one standing for the rest.
+    std::vector<UINT32> alphabet;
+    for (size_t pc = 0; pc < program.Size(); ++pc)
+    {
+        const Inst & inst = program[static_cast<int>(pc)];
+        if (inst.op == Inst::CHAR)
+            alphabet.push_back(inst.arg);
+    }
+    std::sort(alphabet.begin(), alphabet.end());
+    alphabet.erase(std::unique(alphabet.begin(), alphabet.end()),
+                   alphabet.end());
+    UINT32 rest = 0;
+    while (std::binary_search(alphabet.begin(), alphabet.end(), rest))
+        ++rest;
+    alphabet.push_back(rest);
+    size_t classes = alphabet.size();
+
+    // The cache numbers states as it finds them, from the dead state 0.
+    DfaMatcher::Cache cache(&program, leftmost_first, seeding);
+    int start = cache.Start();
+    std::vector<int> table;
+    for (size_t s = 0; s < cache.Size(); ++s)
+    {
+        for (UINT32 c : alphabet)
+        {
+            if (cache.Size() > max_states)
+                return nullptr;
+            table.push_back(cache.Next(static_cast<int>(s), c));
+        }
+    }
+    size_t n = cache.Size();
+    std::vector<std::vector<UINT32>> matches(n);
+    for (size_t s = 0; s < n; ++s)
+    {
+        matches[s] = cache.Matches(static_cast<int>(s));
+        std::sort(matches[s].begin(), matches[s].end());
+        matches[s].erase(std::unique(matches[s].begin(), matches[s].end()),
+                         matches[s].end());
+    }
+
+    std::vector<std::vector<int>> blocks;
+    std::vector<int> block_of = Minimize(table, matches, classes, &blocks);
+    // Renumber the blocks, keeping the dead one at 0.
+    std::vector<int> id(blocks.size(), -1);
+    id[block_of[0]] = 0;
+    int next_id = 1;
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        if (id[b] < 0)
+            id[b] = next_id++;
+    }
+    size_t m = blocks.size();
+    std::vector<std::vector<UINT16>> columns(classes,
+                                             std::vector<UINT16>(m));
+    std::shared_ptr<DenseDfa> dfa(new DenseDfa());
+    dfa->matches_.resize(m);
+    for (size_t b = 0; b < m; ++b)
+    {
+        int s = blocks[b][0];
+        for (size_t a = 0; a < classes; ++a)
+        {
+            columns[a][id[b]] =
+                static_cast<UINT16>(id[block_of[table[s * classes + a]]]);
+        }
+        dfa->matches_[id[b]] = matches[s];
+    }
+    dfa->start_ = id[block_of[start]];
+
+    // Code units whose columns are equal share a class.
+    std::map<std::vector<UINT16>, UINT16> class_of_column;
+    std::vector<UINT16> class_of(classes);
+    for (size_t a = 0; a < classes; ++a)
+    {
+        auto it = class_of_column.emplace(
+            columns[a], static_cast<UINT16>(class_of_column.size()));
+        class_of[a] = it.first->second;
+    }
+    dfa->class_count_ = class_of_column.size();
+    dfa->next_.resize(m * dfa->class_count_);
+    for (size_t a = 0; a < classes; ++a)
+    {
+        for (size_t s = 0; s < m; ++s)
+            dfa->next_[s * dfa->class_count_ + class_of[a]] = columns[a][s];
+    }
+
+    dfa->rest_class_ = class_of[classes - 1];
+    std::fill(std::begin(dfa->byte_class_),
+              std::end(dfa->byte_class_),
+              dfa->rest_class_);
+    for (size_t a = 0; a + 1 < classes; ++a)
+    {
+        if (alphabet[a] < 256)
+            dfa->byte_class_[alphabet[a]] = class_of[a];
+        else
+            dfa->other_class_.emplace_back(alphabet[a], class_of[a]);
+    }
+
+    if (jit)
+        dfa->jit_ = JitDfa::Compile(*dfa);
+    if (dfa->jit_)
+    {
+        dfa->final_.resize(m);
+        for (size_t s = 0; s < m; ++s)
+            dfa->final_[s] = !dfa->matches_[s].empty();
+    }
+    return dfa;
+}
+
+template <typename CharT>
+void DenseDfa::SearchAll(StringView<CharT> text,
+                         std::vector<bool> * matched) const {
+    if (jit_ && sizeof(CharT) == 1)
+        return JitSearchAll(text, matched);
+    size_t unmatched = std::count(matched->begin(), matched->end(), false);
+    int s = start_;
+    for (size_t i = 0;; ++i)
+    {
+        for (UINT32 m : matches_[s])
+        {
+            if (!(*matched)[m])
+            {
+                (*matched)[m] = true;
+                --unmatched;
+            }
+        }
+        if (unmatched == 0 || i == text.size())
+            break;
+        s = Next(s, CodeUnit(text[i]));
+    }
+}
+
+template <typename CharT>
+inline size_t DenseDfa::WalkLongest(const CharT * text,
+                                   size_t from,
+                                   size_t stop,
+                                   int * state,
+                                   size_t * end,
+                                   int * last) const {
+    *last = 0;
+    int s = start_;
+    for (size_t i = from;; ++i)
+    {
+        if (!matches_[s].empty())
+        {
+            *last = s;
+            *end = i;
+        }
+        if (i == stop)
+        {
+            *state = s;
+            return i;
+        }
+        s = Next(s, CodeUnit(text[i]));
+        if (s == 0)
+        {
+            *state = 0;
+            return i + 1;
+        }
+    }
+}
+
+// Bytes walked on the table before the code takes over: short runs stay
+// there, as the code costs more to enter.
+static const size_t kJitAfter = 16;
+
+size_t DenseDfa::JitRunLongest(const RByte * text,
+                               size_t size,
+                               size_t from,
+                               size_t * end,
+                               int * last) const {
+    int s;
+    size_t i = WalkLongest(
+        text, from, std::min(size, from + kJitAfter), &s, end, last);
+    if (s == 0 || i == size)
+        return i;
+    return jit_->RunLongest(RByteView(text, size), i, s, last, end);
+}
+
+template <typename CharT>
+bool DenseDfa::LongestMatch(StringView<CharT> text,
+                            size_t from,
+                            size_t * end,
+                            UINT32 * program) const {
+    if (jit_ && sizeof(CharT) == 1)
+        return JitLongestMatch(text.data(), text.size(), from, end, program);
+    int s, last;
+    WalkLongest(text.data(), from, text.size(), &s, end, &last);
+    if (last == 0)
+        return false;
+    *program = matches_[last].front();
+    return true;
+}
+
+template <typename CharT>
+bool DenseDfa::Search(StringView<CharT> text,
+                      size_t from,
+                      size_t * end,
+                      size_t * read) const {
+    int s, last;
+    size_t i = (jit_ && sizeof(CharT) == 1)
+        ? JitRunLongest(text.data(), text.size(), from, end, &last)
+        : WalkLongest(text.data(), from, text.size(), &s, end, &last);
+    if (read)
+        *read = i;
+    return last != 0;
+}
+
+bool DenseDfa::JitLongestMatch(const RByte * text,
+                               size_t size,
+                               size_t from,
+                               size_t * end,
+                               UINT32 * program) const {
+    int last;
+    JitRunLongest(text, size, from, end, &last);
+    if (last == 0)
+        return false;
+    *program = matches_[last].front();
+    return true;
+}
+
+// The code stops at a final state the first time it gets there, to record
+// its matches, then carries on from the next byte. The flags are copied
+// once a match is found, so states already recorded stop no more.
+void DenseDfa::JitSearchAll(RByteView text,
+                            std::vector<bool> * matched) const {
+    size_t unmatched = std::count(matched->begin(), matched->end(), false);
+    const UINT8 * stop = final_.data();
+    std::vector<UINT8> seen;
+    int s = start_;
+    for (size_t i = 0;; ++i)
+    {
+        i = jit_->Run(text, i, &s, stop);
+        for (UINT32 m : matches_[s])
+        {
+            if (!(*matched)[m])
+            {
+                (*matched)[m] = true;
+                --unmatched;
+            }
+        }
+        if (unmatched == 0 || i == text.size() || s == 0)
+            break;
+        if (seen.empty())
+        {
+            seen = final_;
+            stop = seen.data();
+        }
+        seen[s] = 0;
+        s = Next(s, CodeUnit(text[i]));
+    }
+}
+
+template void DenseDfa::SearchAll(RView, std::vector<bool> *) const;
+template void DenseDfa::SearchAll(RByteView, std::vector<bool> *) const;
+template bool DenseDfa::LongestMatch(RView, size_t, size_t *, UINT32 *)
+    const;
+template bool DenseDfa::LongestMatch(RByteView, size_t, size_t *, UINT32 *)
+    const;
+template bool DenseDfa::Search(RView, size_t, size_t *, size_t *) const;
+template bool DenseDfa::Search(RByteView, size_t, size_t *, size_t *) const;
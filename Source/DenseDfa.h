@@ -0,0 +1,134 @@
+#pragma once
+
+#include "DfaMatcher.h"
+#include "IntType.h"
+#include "JitDfa.h"
+#include "Program.h"
+#include "StringView.h"
+
+/*
+ * Minimized DFA in a dense transition table, next[state * classes + class].
+ *
+ * Built eagerly by exploring the lazy DFA's states, for programs small
+ * enough. States are merged by Hopcroft's algorithm, then code units that
+ * every state treats alike share a class, so the table stays small enough
+ * to sit in cache. State 0 is dead.
+ *
+ * With 'jit', UTF-8 text is run by the table compiled to machine code,
+ * where the system allows it; otherwise the table is walked here.
+ */
+
+class DenseDfa {
+public:
+    // The DFA a lazy cache with these flags explores, or null if it has
+    // more than 'max_states' states.
+    static std::shared_ptr<const DenseDfa> Build(
+        const Program & program,
+        bool leftmost_first,
+        bool seeding,
+        bool jit,
+        size_t max_states = 1024);
+
+    int Start() const {
+        return start_;
+    }
+    // 'c' is a code unit.
+    int Next(int state, UINT32 c) const {
+        return next_[state * class_count_ + ClassOf(c)];
+    }
+    bool IsFinal(int state) const {
+        return !matches_[state].empty();
+    }
+    // 'arg' of the MATCH instructions the state has reached, sorted.
+    const std::vector<UINT32> & Matches(int state) const {
+        return matches_[state];
+    }
+
+    size_t StateCount() const {
+        return matches_.size();
+    }
+    size_t ClassCount() const {
+        return class_count_;
+    }
+    bool IsJitted() const {
+        return jit_ != nullptr;
+    }
+
+    // Same as DfaMatcher::SearchAll() and DfaMatcher::LongestMatch().
+    template <typename CharT>
+    void SearchAll(StringView<CharT> text, std::vector<bool> * matched) const;
+    template <typename CharT>
+    bool LongestMatch(StringView<CharT> text,
+                      size_t from,
+                      size_t * end,
+                      UINT32 * program) const;
+    // Same as DfaMatcher::Search(), without a prefilter, for a DFA built
+    // with 'leftmost_first' and 'seeding'.
+    template <typename CharT>
+    bool Search(StringView<CharT> text,
+                size_t from,
+                size_t * end,
+                size_t * read = nullptr) const;
+
+private:
+    DenseDfa() = default;
+
+    // Walks the table from 'from' to the dead state or 'stop', and returns
+    // how far it read. '*state' receives the state at 'stop', or 0, and
+    // '*last' the last final state entered, or 0, with '*end' where.
+    template <typename CharT>
+    size_t WalkLongest(const CharT * text,
+                       size_t from,
+                       size_t stop,
+                       int * state,
+                       size_t * end,
+                       int * last) const;
+
+    // The compiled runs over UTF-8 text. Wide text is never jitted.
+    void JitSearchAll(RByteView text, std::vector<bool> * matched) const;
+    void JitSearchAll(RView, std::vector<bool> *) const {
+    }
+    bool JitLongestMatch(const RByte * text,
+                         size_t size,
+                         size_t from,
+                         size_t * end,
+                         UINT32 * program) const;
+    bool JitLongestMatch(
+        const RChar *, size_t, size_t, size_t *, UINT32 *) const {
+        return false;
+    }
+    // WalkLongest() to the dead state or the end, through the code.
+    size_t JitRunLongest(const RByte * text,
+                         size_t size,
+                         size_t from,
+                         size_t * end,
+                         int * last) const;
+    size_t JitRunLongest(const RChar *, size_t, size_t, size_t *, int *) const {
+        return 0;
+    }
+
+    size_t ClassOf(UINT32 c) const {
+        if (c < 256)
+            return byte_class_[c];
+        auto it = std::lower_bound(
+            other_class_.begin(),
+            other_class_.end(),
+            std::make_pair(c, static_cast<UINT16>(0)));
+        return (it != other_class_.end() && it->first == c ? it->second
+                                                            : rest_class_);
+    }
+
+    UINT16 byte_class_[256];
+    // Classes of the code units from 256 up that the program names, sorted.
+    std::vector<std::pair<UINT32, UINT16>> other_class_;
+    // Class of code units the program doesn't name.
+    UINT16 rest_class_;
+    size_t class_count_;
+    int start_;
+    std::vector<UINT16> next_;
+    std::vector<std::vector<UINT32>> matches_;
+    // Set by 'jit', with a flag per state that has matches, where the code
+    // stops for SearchAll().
+    std::shared_ptr<const JitDfa> jit_;
+    std::vector<UINT8> final_;
+};
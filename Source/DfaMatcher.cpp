@@ -0,0 +1,345 @@
+#include "stdafx.h"
+
+#include "DfaMatcher.h"
+#include "IntType.h"
+#include "util.h"
+
+// State 0 of every cache is the dead state.
+static const int kDeadState = 0;
+static const int kUnknownState = -1;
+
+DfaMatcher::Cache::Cache(const Program * program,
+                         bool leftmost_first,
+                         bool seeding)
+    : program_(program)
+    , leftmost_first_(leftmost_first)
+    , seeding_(seeding) {
+    Reset();
+}
+
+void DfaMatcher::Cache::Reset() {
+    states_.clear();
+    index_.clear();
+    start_state_ = kUnknownState;
+    Intern({}, false);
+}
+
+// Collect CHAR and MATCH instructions reachable from 'seeds' by epsilon
+// moves, in the order the backtracking matcher would visit them.
+void DfaMatcher::Cache::Closure(const std::vector<int> & seeds,
+                                std::vector<int> * nfa_states) const {
+    const Program & prog = *program_;
+    std::vector<bool> visited(prog.Size());
+    std::vector<int> stack;
+    for (int seed : seeds)
+    {
+        stack.push_back(seed);
+        while (!stack.empty())
+        {
+            int pc = stack.back();
+            stack.pop_back();
+            if (visited[pc])
+                continue;
+            visited[pc] = true;
+
+            const Inst & inst = prog[pc];
+            switch (inst.op)
+            {
+                case Inst::MATCH:
+                    nfa_states->push_back(pc);
+                    // Lower priority threads never run once a match is found.
+                    if (leftmost_first_)
+                        return;
+                    break;
+                case Inst::CHAR:
+                    nfa_states->push_back(pc);
+                    break;
+                case Inst::SAVE:
+                    stack.push_back(pc + 1);
+                    break;
+                case Inst::JMP:
+                    stack.push_back(inst.x);
+                    break;
+                case Inst::SPLIT:
+                    stack.push_back(inst.y);
+                    stack.push_back(inst.x);
+                    break;
+                default:
+                    RAssert(false);
+                    break;
+            }
+        }
+    }
+}
+
+int DfaMatcher::Cache::Intern(const std::vector<int> & nfa_states,
+                              bool seeding,
+                              bool fresh) {
+    State s;
+    s.is_final = false;
+    for (int pc : nfa_states)
+    {
+        const Inst & inst = (*program_)[pc];
+        if (inst.op == Inst::MATCH)
+        {
+            s.is_final = true;
+            s.matches.push_back(inst.arg);
+        }
+    }
+    // Once a match is found, later starts can't be leftmost.
+    s.seeding = seeding && !(leftmost_first_ && s.is_final);
+
+    s.fresh = fresh;
+
+    auto key = std::make_tuple(nfa_states, s.seeding, s.fresh);
+    auto it = index_.find(key);
+    if (it != index_.end())
+        return it->second;
+
+    s.nfa_states = nfa_states;
+    std::fill(std::begin(s.next_ascii), std::end(s.next_ascii), kUnknownState);
+
+    int id = static_cast<int>(states_.size());
+    states_.push_back(s);
+    index_.emplace(key, id);
+    return id;
+}
+
+int DfaMatcher::Cache::Start() {
+    if (start_state_ == kUnknownState)
+    {
+        std::vector<int> nfa_states;
+        Closure({0}, &nfa_states);
+        start_state_ = Intern(nfa_states, seeding_, true);
+    }
+    return start_state_;
+}
+
+int DfaMatcher::Cache::Next(int state, UINT32 c) {
+    bool is_ascii = c < 128;
+    if (is_ascii && states_[state].next_ascii[c] != kUnknownState)
+        return states_[state].next_ascii[c];
+    if (!is_ascii)
+    {
+        auto it = states_[state].next_other.find(c);
+        if (it != states_[state].next_other.end())
+            return it->second;
+    }
+
+    std::vector<int> seeds;
+    for (int pc : states_[state].nfa_states)
+    {
+        const Inst & inst = (*program_)[pc];
+        if (inst.op == Inst::CHAR && inst.arg == c)
+            seeds.push_back(inst.x);
+    }
+    // A thread started at the next position has the lowest priority.
+    bool seeding = states_[state].seeding;
+    bool fresh = seeding && seeds.empty();
+    if (seeding)
+        seeds.push_back(0);
+    std::vector<int> nfa_states;
+    Closure(seeds, &nfa_states);
+
+    if (states_.size() >= kMaxStates)
+    {
+        // Flush the cache, keeping only the state we move to.
+        Reset();
+        return Intern(nfa_states, seeding, fresh);
+    }
+
+    int next = Intern(nfa_states, seeding, fresh);
+    if (is_ascii)
+        states_[state].next_ascii[c] = next;
+    else
+        states_[state].next_other.emplace(c, next);
+    return next;
+}
+
+int DfaMatcher::Cache::Unseeded(int state) {
+    if (!states_[state].seeding)
+        return state;
+    std::vector<int> nfa_states = states_[state].nfa_states;
+    return Intern(nfa_states, false);
+}
+
+DfaMatcher::DfaMatcher(std::shared_ptr<const Program> program,
+                       Prefilter prefilter)
+    : program_(program)
+    , prefilter_(prefilter) {
+}
+
+DfaMatcher::Scratch::Scratch(const DfaMatcher & dfa)
+    : program_(dfa.program_.get())
+    , whole_(program_, false, false)
+    , search_(program_, true, true)
+    , all_(program_, false, true) {
+}
+
+template <typename CharT>
+bool DfaMatcher::Match(StringView<CharT> text, Scratch * scratch) const {
+    RAssert(scratch->program_ == program_.get());
+    Cache & cache = scratch->whole_;
+    int s = cache.Start();
+    for (CharT c : text)
+    {
+        s = cache.Next(s, CodeUnit(c));
+        if (s == kDeadState)
+            return false;
+    }
+    return cache.IsFinal(s);
+}
+
+template <typename CharT>
+bool DfaMatcher::Search(StringView<CharT> text,
+                        size_t from,
+                        size_t * end,
+                        Scratch * scratch,
+                        size_t * read,
+                        size_t before,
+                        size_t * pending) const {
+    RAssert(scratch->program_ == program_.get());
+    Cache & cache = scratch->search_;
+    int s = from < before ? cache.Start() : kDeadState;
+    bool matched = cache.IsFinal(s);
+    if (matched)
+        *end = from;
+    if (pending)
+        *pending = from;
+    // Matches may start in [i, last].
+    size_t last = from;
+    size_t i = from;
+    for (; s != kDeadState; ++i)
+    {
+        // Only the fresh thread is alive: skip to where it can match. A final
+        // start state may also be a match still growing.
+        if (s == cache.Start() && !cache.IsFinal(s) &&
+            (i == from || i > last))
+        {
+            if (!prefilter_.NextCandidates(text, i, &i, &last, before))
+            {
+                // The last positions may become candidates as text follows.
+                if (pending)
+                {
+                    *pending = std::max(
+                        i,
+                        text.size() -
+                            std::min(text.size(), prefilter_.Overhang()));
+                }
+                break;
+            }
+            if (pending)
+                *pending = i;
+        }
+        if (i >= text.size())
+            break;
+        if (i + 1 >= before)
+            s = cache.Unseeded(s);
+        s = cache.Next(s, CodeUnit(text[i]));
+        if (cache.IsFinal(s))
+        {
+            matched = true;
+            *end = i + 1;
+        }
+    }
+    if (read)
+        *read = std::min(i, text.size());
+    return matched;
+}
+
+template <typename CharT>
+void DfaMatcher::SearchAll(StringView<CharT> text,
+                           std::vector<bool> * matched,
+                           Scratch * scratch) const {
+    RAssert(scratch->program_ == program_.get());
+    Cache & cache = scratch->all_;
+    size_t unmatched = std::count(matched->begin(), matched->end(), false);
+    int s = cache.Start();
+    for (size_t i = 0;; ++i)
+    {
+        for (UINT32 m : cache.Matches(s))
+        {
+            if (!(*matched)[m])
+            {
+                (*matched)[m] = true;
+                --unmatched;
+            }
+        }
+        if (unmatched == 0 || i == text.size())
+            break;
+        s = cache.Next(s, CodeUnit(text[i]));
+    }
+}
+
+template <typename CharT>
+bool DfaMatcher::LongestMatch(StringView<CharT> text,
+                              size_t from,
+                              size_t * end,
+                              UINT32 * program,
+                              Scratch * scratch) const {
+    RAssert(scratch->program_ == program_.get());
+    Cache & cache = scratch->whole_;
+    bool matched = false;
+    int s = cache.Start();
+    for (size_t i = from;; ++i)
+    {
+        if (cache.IsFinal(s))
+        {
+            const std::vector<UINT32> & matches = cache.Matches(s);
+            matched = true;
+            *end = i;
+            *program = *std::min_element(matches.begin(), matches.end());
+        }
+        if (i == text.size())
+            break;
+        s = cache.Next(s, CodeUnit(text[i]));
+        if (s == kDeadState)
+            break;
+    }
+    return matched;
+}
+
+template <typename CharT>
+bool DfaMatcher::LongestMatchBackward(StringView<CharT> text,
+                                      size_t from,
+                                      size_t end,
+                                      size_t * begin,
+                                      Scratch * scratch) const {
+    RAssert(scratch->program_ == program_.get());
+    Cache & cache = scratch->whole_;
+    bool matched = false;
+    int s = cache.Start();
+    for (size_t i = end;; --i)
+    {
+        if (cache.IsFinal(s))
+        {
+            matched = true;
+            *begin = i;
+        }
+        if (i == from)
+            break;
+        s = cache.Next(s, CodeUnit(text[i - 1]));
+        if (s == kDeadState)
+            break;
+    }
+    return matched;
+}
+
+template bool DfaMatcher::Match(RView, Scratch *) const;
+template bool DfaMatcher::Match(RByteView, Scratch *) const;
+template bool DfaMatcher::Search(
+    RView, size_t, size_t *, Scratch *, size_t *, size_t, size_t *) const;
+template bool DfaMatcher::Search(
+    RByteView, size_t, size_t *, Scratch *, size_t *, size_t, size_t *) const;
+template void DfaMatcher::SearchAll(RView, std::vector<bool> *, Scratch *)
+    const;
+template void DfaMatcher::SearchAll(RByteView, std::vector<bool> *, Scratch *)
+    const;
+template bool DfaMatcher::LongestMatch(
+    RView, size_t, size_t *, UINT32 *, Scratch *) const;
+template bool DfaMatcher::LongestMatch(
+    RByteView, size_t, size_t *, UINT32 *, Scratch *) const;
+template bool DfaMatcher::LongestMatchBackward(
+    RView, size_t, size_t, size_t *, Scratch *) const;
+template bool DfaMatcher::LongestMatchBackward(
+    RByteView, size_t, size_t, size_t *, Scratch *) const;
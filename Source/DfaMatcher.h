@@ -0,0 +1,142 @@
+#pragma once
+
+#include "Prefilter.h"
+#include "Program.h"
+#include "StringView.h"
+
+/*
+ * Lazy DFA over a Program.
+ *
+ * DFA states are epsilon-closures of instructions, built on demand and
+ * cached in a bounded state table. Only programs without back references,
+ * look-around, atomic groups and counted repeats can be simulated this way.
+ *
+ * The state tables live in a Scratch, so a DfaMatcher is never modified
+ * and threads can share it, each with a scratch of its own.
+ */
+
+class DfaMatcher {
+public:
+    class Scratch;
+
+    // 'prefilter' lets Search() skip text where no match can start.
+    explicit DfaMatcher(std::shared_ptr<const Program> program,
+                        Prefilter prefilter = Prefilter());
+
+    // Does 'text' match as a whole?
+    template <typename CharT>
+    bool Match(StringView<CharT> text, Scratch * scratch) const;
+    // Does a match start at or after 'from', and before 'before'? '*end'
+    // receives the end of the leftmost one, as the backtracking matcher
+    // would pick it (leftmost-first), found in a single pass. '*read'
+    // receives where the pass stopped reading: no way to match that the
+    // backtracking matcher tries before that one reads further. Past
+    // 'before', the pass reads on only while a match started before it can.
+    // '*pending' receives a position no way to match still alive when the
+    // pass stopped started before: earlier starts fail whatever text would
+    // follow.
+    template <typename CharT>
+    bool Search(StringView<CharT> text,
+                size_t from,
+                size_t * end,
+                Scratch * scratch,
+                size_t * read = nullptr,
+                size_t before = static_cast<size_t>(-1),
+                size_t * pending = nullptr) const;
+    // For a union Program: set '(*matched)[i]' if program i matches
+    // somewhere in 'text'. Stops early once all are set.
+    template <typename CharT>
+    void SearchAll(StringView<CharT> text,
+                   std::vector<bool> * matched,
+                   Scratch * scratch) const;
+    // For a Program::Reverse(): the longest match read backward from 'end',
+    // not reading before 'from'. '*begin' receives where it starts.
+    template <typename CharT>
+    bool LongestMatchBackward(StringView<CharT> text,
+                              size_t from,
+                              size_t end,
+                              size_t * begin,
+                              Scratch * scratch) const;
+    // For a union Program: the longest match starting at 'from', which
+    // ends at '*end', and the lowest-numbered program that matches it.
+    template <typename CharT>
+    bool LongestMatch(StringView<CharT> text,
+                      size_t from,
+                      size_t * end,
+                      UINT32 * program,
+                      Scratch * scratch) const;
+
+private:
+    friend class DenseDfa;
+
+    struct State {
+        // CHAR and MATCH instructions, in priority order.
+        std::vector<int> nfa_states;
+        // Start a new thread at every position (implicit '.*?' prefix).
+        bool seeding;
+        // Only the thread started at this position is alive; other states
+        // may hold the same instructions for threads started earlier.
+        bool fresh;
+        bool is_final;
+        // 'arg' of each MATCH instruction.
+        std::vector<UINT32> matches;
+        int next_ascii[128];
+        std::map<UINT32, int> next_other;
+    };
+
+    class Cache {
+    public:
+        // The cache is flushed when it holds this many states.
+        static const size_t kMaxStates = 2048;
+
+        Cache(const Program * program, bool leftmost_first, bool seeding);
+
+        int Start();
+        // 'c' is a code unit.
+        int Next(int state, UINT32 c);
+        // The threads of 'state', starting no new ones.
+        int Unseeded(int state);
+        bool IsFinal(int state) const {
+            return states_[state].is_final;
+        }
+        const std::vector<UINT32> & Matches(int state) const {
+            return states_[state].matches;
+        }
+        size_t Size() const {
+            return states_.size();
+        }
+
+    private:
+        void Closure(const std::vector<int> & seeds,
+                     std::vector<int> * nfa_states) const;
+        int Intern(const std::vector<int> & nfa_states,
+                   bool seeding,
+                   bool fresh = false);
+        void Reset();
+
+        const Program * program_;
+        bool leftmost_first_;
+        bool seeding_;
+        int start_state_;
+        std::vector<State> states_;
+        std::map<std::tuple<std::vector<int>, bool, bool>, int> index_;
+    };
+
+    std::shared_ptr<const Program> program_;
+    Prefilter prefilter_;
+};
+
+// DFA states built while matching, for one thread at a time.
+class DfaMatcher::Scratch {
+public:
+    explicit Scratch(const DfaMatcher & dfa);
+
+private:
+    friend class DfaMatcher;
+
+    const Program * program_;
+    Cache whole_;
+    Cache search_;
+    // Every thread runs to the end, for SearchAll().
+    Cache all_;
+};
@@ -0,0 +1,261 @@
+#include "stdafx.h"
+
+#include "Enfa.h"
+
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+template <typename T>
+std::wstring ToHexString(T i) {
+    std::wstringstream stream;
+    stream << "0x" << std::setfill(L'0') << std::setw(sizeof(T) * 2) << std::hex
+           << i;
+    return stream.str();
+}
+
+RString EnfaState::DebugString(const EnfaState * start) {
+    std::map<const EnfaState *, int> m;
+    std::vector<const EnfaState *> v = {start};
+    int id = 0;
+    while (!v.empty())
+    {
+        const EnfaState * s = v.back();
+        v.pop_back();
+
+        if (s && m.find(s) == m.end())
+        {
+            m[s] = id++;
+            v.insert(v.end(),
+                     s->DebugMultipleOut().rbegin(),
+                     s->DebugMultipleOut().rend());
+        }
+    }
+
+    std::map<int, RString> out;
+    for (auto kv : m)
+    {
+        RString & o = out[kv.second];
+        if (kv.first->IsChar())
+            o += L"'", o += kv.first->Char(),
+                o += L"' [" + std::to_wstring(m[kv.first->Out()]) + L"]";
+        else if (kv.first->IsBackReference())
+            o += L"\\", o += std::to_wstring(kv.first->BackReference()),
+                o += L" [" + std::to_wstring(m[kv.first->Out()]) + L"]";
+        else if (kv.first->IsEpsilon())
+        {
+            o += L"<   ";
+            for (EnfaState * out : kv.first->MultipleOut())
+                o += L"[" + std::to_wstring(m[out]) + L"]";
+        }
+
+        if (kv.first->IsFinal())
+            o += L" FINAL";
+        if (kv.first->Tags().HasCaptureTag())
+            o += std::wstring(L"\t") +
+                (kv.first->Tags().GetCaptureTag().is_begin ? L"B" : L"E") +
+                std::to_wstring(kv.first->Tags().GetCaptureTag().capture_id);
+        if (kv.first->Tags().HasLookAroundTag())
+            o += std::wstring(L"\t") +
+                (kv.first->Tags().GetLookAroundTag().is_begin ? L"LB" : L"LE") +
+                std::to_wstring(kv.first->Tags().GetLookAroundTag().id);
+        if (kv.first->Tags().HasAtomicTag())
+            o += std::wstring(L"\t") +
+                (kv.first->Tags().GetAtomicTag().is_begin ? L"AB" : L"AE") +
+                std::to_wstring(kv.first->Tags().GetAtomicTag().atomic_id);
+        if (kv.first->Tags().HasRepeatTag())
+            o += std::wstring(L"\t") + L"{" +
+                std::to_wstring(kv.first->Tags().GetRepeatTag().min) + L"," +
+                (kv.first->Tags().GetRepeatTag().has_max
+                     ? std::to_wstring(kv.first->Tags().GetRepeatTag().max)
+                     : L"") +
+                L"}";
+    }
+
+    std::map<int, const EnfaState *> mm;
+    for (auto kv : m)
+        mm[kv.second] = kv.first;
+
+    RString s;
+    for (auto kv : mm)
+        s += ToHexString(kv.second) + L"\t[" + std::to_wstring(kv.first) +
+            L"] " + out[kv.first] + L"\n";
+    return s;
+}
+
+EnfaState * EnfaStateBuilder::NewState() {
+    states_.push_back(EnfaState());
+    states_.back().index_ = out_.size();
+    out_.emplace_back();
+    return &states_.back();
+}
+
+void EnfaStateBuilder::SetEdge(EnfaState * s,
+                               EnfaState::Type type,
+                               RChar c,
+                               size_t backref) {
+    s->edge.type_ = type;
+    s->edge.char_ = c;
+    s->edge.backref_ = backref;
+}
+
+void EnfaStateBuilder::AddOut(EnfaState * s, EnfaState * out) {
+    out_[s->index_].push_back(out);
+}
+
+EnfaStateBuilder::StatePort EnfaStateBuilder::Empty() {
+    EnfaState * in = NewState();
+    EnfaState * out = NewState();
+    SetEdge(in, EnfaState::EPSILON_OUT, 0, 0);
+    AddOut(in, out);
+    return {in, out};
+}
+
+EnfaStateBuilder::StatePort EnfaStateBuilder::Char(RChar c) {
+    EnfaState * in = NewState();
+    EnfaState * out = NewState();
+    SetEdge(in, EnfaState::CHAR_OUT, c, 0);
+    AddOut(in, out);
+    return {in, out};
+}
+
+EnfaStateBuilder::StatePort EnfaStateBuilder::BackReference(
+    size_t ref_capture_id) {
+    EnfaState * in = NewState();
+    EnfaState * out = NewState();
+    SetEdge(in, EnfaState::BACKREF_OUT, 0, ref_capture_id);
+    AddOut(in, out);
+    return {in, out};
+}
+
+EnfaStateBuilder::StatePort EnfaStateBuilder::Alter(StatePort sp1,
+                                                    StatePort sp2) {
+    EnfaState * in = NewState();
+    EnfaState * out = NewState();
+
+    SetEdge(in, EnfaState::EPSILON_OUT, 0, 0);
+    AddOut(in, sp1.in);
+    AddOut(in, sp2.in);
+
+    SetEdge(sp1.out, EnfaState::EPSILON_OUT, 0, 0);
+    SetEdge(sp2.out, EnfaState::EPSILON_OUT, 0, 0);
+    AddOut(sp1.out, out);
+    AddOut(sp2.out, out);
+
+    return {in, out};
+}
+
+EnfaStateBuilder::StatePort EnfaStateBuilder::Repeat(StatePort sp,
+                                                     struct Repeat rep) {
+    EnfaState * in = NewState();
+    EnfaState * out = NewState();
+
+    SetEdge(in, EnfaState::EPSILON_OUT, 0, 0);
+    SetEdge(sp.out, EnfaState::EPSILON_OUT, 0, 0);
+
+    if (rep.qualifier == Repeat::GREEDY)
+    {
+        AddOut(in, sp.in);
+        if (rep.min == 0)
+            AddOut(in, out);
+    }
+    else
+    {
+        assert(rep.qualifier == Repeat::RELUCTANT);
+        if (rep.min == 0)
+            AddOut(in, out);
+        AddOut(in, sp.in);
+    }
+
+    // Only repeats that need a counter are tagged; the rest are plain loops
+    // (or optionals) whose edges are in priority order.
+    if (rep.min > 1 || (rep.has_max && rep.max != 1))
+    {
+        // Match algorithm depends on push order here.
+        AddOut(sp.out, sp.in);
+        AddOut(sp.out, out);
+
+        sp.out->Tags().SetRepeatTag(
+            {rep.repeat_id,
+             rep.min,
+             rep.max,
+             rep.has_max,
+             (rep.qualifier == Repeat::GREEDY ? RepeatTag::GREEDY
+                                              : RepeatTag::RELUCTANT)});
+    }
+    else if (rep.has_max)
+        AddOut(sp.out, out);
+    else if (rep.qualifier == Repeat::GREEDY)
+    {
+        AddOut(sp.out, sp.in);
+        AddOut(sp.out, out);
+    }
+    else
+    {
+        AddOut(sp.out, out);
+        AddOut(sp.out, sp.in);
+    }
+
+    return {in, out};
+}
+
+EnfaStateBuilder::StatePort EnfaStateBuilder::Concat(StatePort sp1,
+                                                     StatePort sp2) {
+    SetEdge(sp1.out, EnfaState::EPSILON_OUT, 0, 0);
+    AddOut(sp1.out, sp2.in);
+
+    return {sp1.in, sp2.out};
+}
+
+EnfaStateBuilder::StatePort EnfaStateBuilder::Group(StatePort sp) {
+    EnfaState * in = NewState();
+    EnfaState * out = NewState();
+
+    SetEdge(in, EnfaState::EPSILON_OUT, 0, 0);
+    SetEdge(sp.out, EnfaState::EPSILON_OUT, 0, 0);
+    AddOut(in, sp.in);
+    AddOut(sp.out, out);
+
+    return {in, out};
+}
+
+std::shared_ptr<EnfaGraph> EnfaStateBuilder::Build(StatePort sp) {
+    sp.out->SetFinal();
+
+    // Number reachable states in depth-first order, start state first.
+    std::vector<EnfaState *> order;
+    std::vector<size_t> id(states_.size(), states_.size());
+    std::vector<EnfaState *> v = {sp.in};
+    while (!v.empty())
+    {
+        EnfaState * s = v.back();
+        v.pop_back();
+        if (id[s->index_] != states_.size())
+            continue;
+        id[s->index_] = order.size();
+        order.push_back(s);
+        const std::vector<EnfaState *> & outs = out_[s->index_];
+        v.insert(v.end(), outs.rbegin(), outs.rend());
+    }
+
+    std::shared_ptr<EnfaGraph> graph(new EnfaGraph());
+    for (EnfaState * s : order)
+    {
+        for (EnfaState * out : out_[s->index_])
+            graph->edges_.push_back(order[id[out->index_]]);
+        graph->states_.push_back(*s);
+    }
+    // Point edges and states into the graph's own arrays.
+    size_t offset = 0;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        EnfaState & s = graph->states_[i];
+        s.edge.out_ = graph->edges_.data() + offset;
+        s.edge.out_count_ = out_[s.index_].size();
+        s.index_ = i;
+        offset += s.edge.out_count_;
+    }
+    for (EnfaState *& out : graph->edges_)
+        out = &graph->states_[id[out->index_]];
+    return graph;
+}
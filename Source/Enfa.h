@@ -0,0 +1,200 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "EnfaTag.h"
+#include "RegexSyntax.h"
+#include "MatchResult.h"
+
+#include <iterator>
+
+class EnfaState;
+
+// Out-edges of a state in priority order, a slice of EnfaGraph's edge array.
+class EnfaEdges {
+public:
+    typedef EnfaState * const * const_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    EnfaEdges(const_iterator begin, size_t size)
+        : begin_(begin)
+        , size_(size) {
+    }
+
+    const_iterator begin() const {
+        return begin_;
+    }
+    const_iterator end() const {
+        return begin_ + size_;
+    }
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    EnfaState * front() const {
+        return begin_[0];
+    }
+    EnfaState * operator[](size_t i) const {
+        return begin_[i];
+    }
+
+private:
+    const_iterator begin_;
+    size_t size_;
+};
+
+class EnfaState {
+    friend class EnfaStateBuilder;
+
+public:
+    bool IsChar() const {
+        return edge.type_ == CHAR_OUT;
+    }
+    bool IsBackReference() const {
+        return edge.type_ == BACKREF_OUT;
+    }
+    bool IsEpsilon() const {
+        return edge.type_ == EPSILON_OUT;
+    }
+    bool IsFinal() const {
+        return is_final_;
+    }
+
+    RChar Char() const {
+        assert(IsChar());
+        return edge.char_;
+    }
+    size_t BackReference() const {
+        assert(IsBackReference());
+        return edge.backref_;
+    }
+
+    // char, back reference
+    const EnfaState * Out() const {
+        assert((IsChar() || IsBackReference() || IsEpsilon()) &&
+               edge.out_count_ == 1);
+        return edge.out_[0];
+    }
+    // epsilon
+    EnfaEdges MultipleOut() const {
+        assert(IsEpsilon() && edge.out_count_ != 0);
+        return EnfaEdges(edge.out_, edge.out_count_);
+    }
+    EnfaEdges DebugMultipleOut() const {
+        return EnfaEdges(edge.out_, edge.out_count_);
+    }
+    void SetFinal() {
+        is_final_ = true;
+    }
+    // Position in EnfaGraph, start state first, in depth-first order.
+    size_t Index() const {
+        return index_;
+    }
+
+    const TagSet & Tags() const {
+        return tag_set_;
+    }
+    TagSet & Tags() {
+        return tag_set_;
+    }
+
+    static RString DebugString(const EnfaState * start);
+
+private:
+    EnfaState() {
+        edge = {
+            INVALID,
+            0,
+            0,
+            nullptr,
+            0,
+        };
+        is_final_ = false;
+        index_ = 0;
+    }
+
+    enum Type {
+        INVALID,
+        CHAR_OUT,
+        BACKREF_OUT,
+        EPSILON_OUT,
+    };
+
+    struct Edge {
+        Type type_;
+        RChar char_;
+        size_t backref_;
+        EnfaState * const * out_;
+        size_t out_count_;
+    } edge;
+
+    bool is_final_;
+    size_t index_;
+
+    TagSet tag_set_;
+};
+
+// Owns the states of a compiled ENFA in one contiguous array, with all
+// out-edges in another.
+class EnfaGraph {
+    friend class EnfaStateBuilder;
+
+public:
+    EnfaGraph(const EnfaGraph &) = delete;
+    EnfaGraph & operator=(const EnfaGraph &) = delete;
+
+    const EnfaState * Start() const {
+        return &states_.front();
+    }
+    size_t Size() const {
+        return states_.size();
+    }
+    const EnfaState & State(size_t index) const {
+        return states_[index];
+    }
+
+private:
+    EnfaGraph() {
+    }
+
+    std::vector<EnfaState> states_;
+    std::vector<EnfaState *> edges_;
+};
+
+// Builds an ENFA from fragments. States live in the builder until Build()
+// moves the reachable ones into an EnfaGraph.
+class EnfaStateBuilder {
+public:
+    struct StatePort {
+        EnfaState * in;
+        EnfaState * out;
+    };
+    // Matches the empty string.
+    StatePort Empty();
+    StatePort Char(RChar c);
+    StatePort BackReference(size_t ref_capture_id);
+    StatePort Alter(StatePort sp1, StatePort sp2);
+    StatePort Repeat(StatePort sp, struct Repeat rep);
+    StatePort Concat(StatePort sp1, StatePort sp2);
+    StatePort Group(StatePort sp);
+
+    // Make 'sp.out' final and pack the states reachable from 'sp.in'.
+    std::shared_ptr<EnfaGraph> Build(StatePort sp);
+
+private:
+    EnfaState * NewState();
+    void SetEdge(EnfaState * s, EnfaState::Type type, RChar c, size_t backref);
+    void AddOut(EnfaState * s, EnfaState * out);
+
+    // Indexed by the build-time EnfaState::Index().
+    std::deque<EnfaState> states_;
+    std::vector<std::vector<EnfaState *>> out_;
+};
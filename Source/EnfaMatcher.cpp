@@ -1,297 +1,751 @@
 #include "stdafx.h"
 
-#include <functional>
-
 #include "CharMatcher.h"
+#include "DenseDfa.h"
 #include "EnfaMatcher.h"
+#include "Input.h"
 #include "RegexCompiler.h"
 #include "util.h"
 
-#ifdef DEBUG
-std::map<const EnfaState *, int> BuildIdMap(const EnfaState * start) {
-    std::map<const EnfaState *, int> m;
-    std::vector<const EnfaState *> v = {start};
-    int id = 0;
-    while (!v.empty())
-    {
-        const EnfaState * s = v.back();
-        v.pop_back();
+// Visited (pc, position) pairs of one search, one bit each, kept across
+// its start positions and sub-matches. Reaching a memoizable pair again
+// means it already failed. Bits are laid out by position from where the
+// search started, and only allocated as far as it reads.
+class BitState {
+public:
+    explicit BitState(const std::vector<bool> * memoizable)
+        : memoizable_(memoizable)
+        , from_(0)
+        , used_(0) {
+    }
+
+    // Forgets every pair, for a search of the text from 'from' on.
+    void Reset(size_t from) {
+        from_ = from;
+        std::fill(words_.begin(), words_.begin() + used_, 0);
+        used_ = 0;
+        sub_bits_.clear();
+    }
 
-        if (s && m.find(s) == m.end())
+    // Returns false if the pair was visited before. Positions before the
+    // search and past the first kMaxBitStateBits pairs aren't remembered.
+    bool Visit(int pc, size_t pos) {
+        if (pos < from_ || !(*memoizable_)[pc])
+            return true;
+        size_t bit = (pos - from_) * memoizable_->size() + pc;
+        size_t word = bit / 64;
+        if (word >= used_)
         {
-            m[s] = id++;
-            v.insert(v.end(),
-                     s->DebugMultipleOut().rbegin(),
-                     s->DebugMultipleOut().rend());
+            if (bit >= kMaxBitStateBits)
+                return true;
+            // Words past used_ are all clear.
+            used_ = word + 1;
+            if (used_ > words_.size())
+            {
+                words_.resize(std::min(std::max(used_, words_.size() * 2),
+                                       kMaxBitStateBits / 64));
+            }
         }
+        UINT64 mask = static_cast<UINT64>(1) << (bit % 64);
+        if (words_[word] & mask)
+            return false;
+        words_[word] |= mask;
+        if (!sub_marks_.empty())
+            sub_bits_.push_back(bit);
+        return true;
     }
-    return m;
-}
-#endif
 
+    // A sub-match that succeeded leaves pairs on its path visited that
+    // didn't fail, so they are forgotten. Those of one that failed did.
+    void BeginSub() {
+        sub_marks_.push_back(sub_bits_.size());
+    }
+    void EndSub(bool matched) {
+        size_t mark = sub_marks_.back();
+        sub_marks_.pop_back();
+        if (matched)
+        {
+            for (size_t i = mark; i < sub_bits_.size(); ++i)
+            {
+                words_[sub_bits_[i] / 64] &=
+                    ~(static_cast<UINT64>(1) << (sub_bits_[i] % 64));
+            }
+        }
+        sub_bits_.resize(mark);
+    }
+
+private:
+    // 4 MB of bits.
+    static const size_t kMaxBitStateBits = 32 * 1024 * 1024;
+
+    const std::vector<bool> * memoizable_;
+    size_t from_;
+    std::vector<UINT64> words_;
+    // Words set since the last Reset().
+    size_t used_;
+    // Bits set by the sub-matches running, from where each began.
+    std::vector<size_t> sub_bits_;
+    std::vector<size_t> sub_marks_;
+};
+
+template <typename CharT>
 struct Thread {
-    LexMatcher input;
-    const EnfaState * state;
-    Capture capture;
-    std::vector<std::pair<int, size_t>> id_to_repcnt;
+    BasicCharMatcher<CharT> input;
+    int pc;
+    // Length of the register undo log when the thread was forked.
+    size_t undo_mark;
 };
 
-MatchResult MatchWhen(const Thread & start,
-                      std::function<bool(const Thread &)> pred,
-                      bool forward_match) {
-#ifdef DEBUG
-    static std::map<const EnfaState *, int> debug;
-    static std::wstring debug_indent;
-    if (debug.empty())
-        debug = BuildIdMap(start.state);
-#endif
-
-    std::vector<Thread> T = {start};
-    while (!T.empty())
-    {
-        Thread t = T.back();
-        T.pop_back();
-#ifdef DEBUG
-        std::wcout << L"--------------------------------------" << std::endl;
-        std::wcout << debug_indent;
-        std::wcout << t.input.Origin() << std::endl;
-        std::wcout << debug_indent << std::wstring(t.input.CurrentPos(), ' ')
-                   << '^' << std::endl;
-#endif
-
-        if (t.state->Tags().HasCaptureTag())
+static const size_t kNoPos = static_cast<size_t>(-1);
+// Undo log entry of a capture history event.
+static const size_t kPopEvent = static_cast<size_t>(-1);
+
+// Repeat counters and capture slots of the running thread, shared by the
+// threads of one match. Changes are logged, and undone when a thread that
+// was forked before them resumes, so forking copies nothing.
+class Registers {
+public:
+    Registers(const Program & prog, bool history)
+        : repeat_count_(prog.RepeatCount())
+        , capture_base_(repeat_count_ + prog.LoopCount())
+        , values_(capture_base_ + prog.CaptureCount() * 3, kNoPos)
+        , history_(history) {
+        std::fill(values_.begin(), values_.begin() + repeat_count_, 0);
+    }
+
+    size_t Mark() const {
+        return undo_.size();
+    }
+    void Undo(size_t mark) {
+        for (; undo_.size() > mark; undo_.pop_back())
         {
-            t.capture.DoCapture(t.state->Tags().GetCaptureTag().capture_id,
-                                t.input.CurrentPos(),
-                                t.state->Tags().GetCaptureTag().is_begin);
+            if (undo_.back().first == kPopEvent)
+                events_.pop_back();
+            else
+                values_[undo_.back().first] = undo_.back().second;
         }
+    }
+
+    size_t Counter(UINT32 repeat) const {
+        return values_[repeat];
+    }
+    void SetCounter(UINT32 repeat, size_t count) {
+        Set(repeat, count);
+    }
 
-        if (pred(t))
+    // Where the thread last passed the head of loop 'loop'.
+    size_t LoopPos(int loop) const {
+        return values_[repeat_count_ + loop];
+    }
+    void SetLoopPos(int loop, size_t pos) {
+        Set(repeat_count_ + loop, pos);
+    }
+
+    // Each group has the begin of its open capture, then the range of its
+    // last closed one.
+    void DoCapture(UINT32 slot, size_t pos) {
+        size_t group = capture_base_ + slot / 2 * 3;
+        if (slot % 2 == 0)
+            Set(group, pos);
+        else
         {
-#ifdef DEBUG
-            if (debug_indent.size() >= 2)
-                debug_indent.pop_back(), debug_indent.pop_back();
-#endif
-            return MatchResult(t.capture, true);
+            Set(group + 1, values_[group]);
+            Set(group + 2, pos);
         }
+        if (history_)
+        {
+            events_.emplace_back(slot, pos);
+            undo_.emplace_back(kPopEvent, 0);
+        }
+    }
+    // Last range 'group' captured. Fails if it never captured.
+    bool GetLastRange(UINT32 group, size_t * begin, size_t * end) const {
+        *begin = values_[capture_base_ + group * 3 + 1];
+        *end = values_[capture_base_ + group * 3 + 2];
+        return *begin != kNoPos;
+    }
 
-        // look around assertion
-        if (t.state->Tags().HasLookAroundTag() &&
-            t.state->Tags().GetLookAroundTag().is_begin)
+    template <typename CharT>
+    BasicCapture<CharT> ToCapture(StringView<CharT> text) const {
+        BasicCapture<CharT> capture(text);
+        if (history_)
         {
-#ifdef DEBUG
-            std::wcout << L"Eval "
-                       << (t.state->Tags().GetLookAroundTag().is_forward
-                               ? L"lookahead "
-                               : L"lookbehind ")
-                       << t.state->Tags().GetLookAroundTag().id << L" at "
-                       << t.input.CurrentPos() << std::endl;
-            debug_indent += L"  ";
-#endif
-
-            int lookaround_id = t.state->Tags().GetLookAroundTag().id;
-            bool is_forward = t.state->Tags().GetLookAroundTag().is_forward;
-            Thread start = {t.input, t.state->Out(), t.capture};
-            if (!MatchWhen(
-                     start,
-                     [lookaround_id,
-                      &t](const Thread & current) mutable -> bool {
-                         bool good = current.state->Tags().HasLookAroundTag() &&
-                             !current.state->Tags()
-                                  .GetLookAroundTag()
-                                  .is_begin &&
-                             current.state->Tags().GetLookAroundTag().id ==
-                                 lookaround_id;
-                         if (good)
-                             t.state = current.state;
-                         return good;
-                     },
-                     is_forward)
-                     .Matched())
-            {
-                continue;
-            }
+            for (const auto & e : events_)
+                capture.DoCapture(e.first / 2, e.second, e.first % 2 == 0);
+            return capture;
         }
-        else if (t.state->Tags().HasAtomicTag() &&
-                 t.state->Tags().GetAtomicTag().is_begin)
+        size_t group_count = (values_.size() - capture_base_) / 3;
+        for (UINT32 group = 0; group < group_count; ++group)
         {
-#ifdef DEBUG
-            std::wcout << "Eval atomic "
-                       << t.state->Tags().GetAtomicTag().atomic_id << " at "
-                       << t.input.CurrentPos() << std::endl;
-            debug_indent += L"  ";
-#endif
-
-            int atomic_id = t.state->Tags().GetAtomicTag().atomic_id;
-            Thread start = {t.input, t.state->Out(), t.capture};
-            if (!MatchWhen(
-                     start,
-                     [atomic_id, &t](const Thread & current) mutable -> bool {
-                         bool good = current.state->Tags().HasAtomicTag() &&
-                             !current.state->Tags().GetAtomicTag().is_begin &&
-                             current.state->Tags().GetAtomicTag().atomic_id ==
-                                 atomic_id;
-                         if (good)
-                         {
-                             t.input = current.input;
-                             t.state = current.state;
-                             current.capture.CopyTo(t.capture);
-                         }
-                         return good;
-                     },
-                     true)
-                     .Matched())
+            size_t begin, end;
+            if (GetLastRange(group, &begin, &end))
             {
-                continue;
+                capture.DoCapture(group, begin, true);
+                capture.DoCapture(group, end, false);
             }
         }
+        return capture;
+    }
 
-#ifdef DEBUG
-        std::wcout << debug_indent << debug[t.state] << ' ';
-#endif
+private:
+    void Set(size_t index, size_t value) {
+        undo_.emplace_back(index, values_[index]);
+        values_[index] = value;
+    }
 
-        if (t.state->IsChar())
-        {
-            bool matched = forward_match
-                ? t.input.Match(t.state->Char())
-                : t.input.MatchBackword(t.state->Char());
-            if (matched)
-            {
-                T.push_back(
-                    {t.input, t.state->Out(), t.capture, t.id_to_repcnt});
-            }
-        }
-        else if (t.state->IsBackReference())
+    // Repeat counters, then loop positions, then captures.
+    size_t repeat_count_;
+    size_t capture_base_;
+    std::vector<size_t> values_;
+    std::vector<std::pair<size_t, size_t>> undo_;
+    // Every capture begin and end, when history is kept.
+    bool history_;
+    std::vector<std::pair<UINT32, size_t>> events_;
+};
+
+// Run threads from '*t' until one reaches instruction 'goal' (at the end of
+// text if 'whole'), which is left in '*t' and 'regs'. Pairs are memoized in
+// 'visited' when set. '*hit_end' is set if a thread ran out of text, so
+// more text could change the outcome.
+template <typename CharT>
+bool MatchWhen(const Program & prog,
+               Thread<CharT> * t,
+               Registers * regs,
+               int goal,
+               bool whole,
+               bool forward_match,
+               BitState * visited,
+               bool * hit_end = nullptr) {
+    t->undo_mark = regs->Mark();
+    bool loops = prog.LoopCount() > 0;
+    std::vector<Thread<CharT>> T = {*t};
+    while (!T.empty())
+    {
+        *t = std::move(T.back());
+        T.pop_back();
+        regs->Undo(t->undo_mark);
+
+        // Follow instructions until the thread dies. Forks keep running the
+        // preferred branch, as if it was pushed last and popped right away.
+        while (!visited || visited->Visit(t->pc, t->input.CurrentPos()))
         {
-            RView text = t.capture.Group(t.state->BackReference()).GetLast();
-            bool matched = forward_match ? t.input.MatchRange(text)
-                                         : t.input.MatchRangeBackword(text);
-            if (matched)
+            bool alive = true;
+            const Inst & inst = prog[t->pc];
+            // A loop that went around without consuming dies, as it does
+            // in the DFA.
+            int loop = loops ? prog.Loop(t->pc) : -1;
+            if (loop >= 0 && inst.op != Inst::REPEAT)
             {
-                T.push_back(
-                    {t.input, t.state->Out(), t.capture, t.id_to_repcnt});
+                if (regs->LoopPos(loop) == t->input.CurrentPos())
+                    break;
+                regs->SetLoopPos(loop, t->input.CurrentPos());
             }
-        }
-        else if (t.state->IsEpsilon())
-        {
-            if (t.state->Tags().HasRepeatTag())
+            switch (inst.op)
             {
-                auto repeat = t.state->Tags().GetRepeatTag();
-                if (t.id_to_repcnt.empty() ||
-                    t.id_to_repcnt.back().first != repeat.repeat_id)
+                case Inst::SAVE:
+                    regs->DoCapture(inst.arg, t->input.CurrentPos());
+                    ++t->pc;
+                    break;
+                case Inst::MATCH:
+                case Inst::END:
+                    if (t->pc == goal &&
+                        (!whole ||
+                         t->input.CurrentPos() == t->input.Origin().size()))
+                    {
+                        return true;
+                    }
+                    alive = (inst.op == Inst::END);
+                    ++t->pc;
+                    break;
+                case Inst::ASSERT:
                 {
-                    t.id_to_repcnt.emplace_back(repeat.repeat_id, 0);
+                    // Captures made inside look-around are dropped.
+                    Thread<CharT> sub = {t->input, t->pc + 1};
+                    size_t mark = regs->Mark();
+                    if (visited)
+                        visited->BeginSub();
+                    alive = MatchWhen(prog,
+                                      &sub,
+                                      regs,
+                                      inst.x,
+                                      false,
+                                      inst.flag,
+                                      visited,
+                                      hit_end);
+                    if (visited)
+                        visited->EndSub(alive);
+                    regs->Undo(mark);
+                    t->pc = inst.x + 1;
+                    break;
                 }
-                t.id_to_repcnt.back().second += 1;
-
-                auto outs = t.state->MultipleOut();
-                RAssert(outs.size() == 2);
-
-                size_t current = t.id_to_repcnt.back().second;
-#ifdef DEBUG
-                std::wcout << " repeat:" << current << "{" << repeat.min << ","
-                           << (repeat.has_max ? std::to_wstring(repeat.max)
-                                              : L"")
-                           << "} ";
-#endif
-                if (current < repeat.min)
+                case Inst::ATOMIC:
                 {
-                    T.push_back({t.input, outs[0], t.capture, t.id_to_repcnt});
+                    // Only the first way the body matches is kept.
+                    Thread<CharT> sub = {t->input, t->pc + 1};
+                    if (visited)
+                        visited->BeginSub();
+                    alive = MatchWhen(prog,
+                                      &sub,
+                                      regs,
+                                      inst.x,
+                                      false,
+                                      true,
+                                      visited,
+                                      hit_end);
+                    if (visited)
+                        visited->EndSub(alive);
+                    if (alive)
+                        t->input = sub.input;
+                    t->pc = inst.x + 1;
+                    break;
                 }
-                else if (!repeat.has_max || current < repeat.max)
+                case Inst::CHAR:
                 {
-                    if (repeat.qualifier == RepeatTag::GREEDY)
+                    CharT c = static_cast<CharT>(inst.arg);
+                    if (hit_end && forward_match &&
+                        t->input.CurrentPos() == t->input.Origin().size())
                     {
-                        T.push_back({t.input, outs[1], t.capture, t.id_to_repcnt});
-                        T.back().id_to_repcnt.pop_back();
-                        T.push_back({t.input, outs[0], t.capture, t.id_to_repcnt});
+                        *hit_end = true;
                     }
-                    else
+                    alive = forward_match ? t->input.Match(c)
+                                          : t->input.MatchBackword(c);
+                    t->pc = inst.x;
+                    break;
+                }
+                case Inst::BACKREF:
+                {
+                    size_t begin, end;
+                    alive = regs->GetLastRange(inst.arg, &begin, &end);
+                    if (alive)
                     {
-                        assert(repeat.qualifier == RepeatTag::RELUCTANT);
-                        T.push_back({ t.input, outs[0], t.capture, t.id_to_repcnt });
-                        T.push_back({ t.input, outs[1], t.capture, t.id_to_repcnt });
-                        T.back().id_to_repcnt.pop_back();
+                        StringView<CharT> text =
+                            t->input.Origin().subview(begin, end - begin);
+                        if (hit_end && forward_match &&
+                            t->input.CurrentPos() + text.size() >
+                                t->input.Origin().size())
+                        {
+                            *hit_end = true;
+                        }
+                        alive = forward_match
+                            ? t->input.MatchRange(text)
+                            : t->input.MatchRangeBackword(text);
                     }
+                    t->pc = inst.x;
+                    break;
                 }
-                else if (current == repeat.max)
+                case Inst::JMP:
+                    t->pc = inst.x;
+                    break;
+                case Inst::SPLIT:
+                    T.push_back(*t);
+                    T.back().pc = inst.y;
+                    T.back().undo_mark = regs->Mark();
+                    t->pc = inst.x;
+                    break;
+                case Inst::REPEAT:
                 {
-                    T.push_back({t.input, outs[1], t.capture, t.id_to_repcnt});
-                    T.back().id_to_repcnt.pop_back();
+                    // Leaving the repeat resets its counter for the next time
+                    // it is entered.
+                    const RepeatTag & repeat = prog.Repeat(inst.arg);
+                    size_t current = regs->Counter(inst.arg) + 1;
+                    // Iterations past the minimum must consume.
+                    if (loop >= 0)
+                    {
+                        if (current > repeat.min &&
+                            regs->LoopPos(loop) == t->input.CurrentPos())
+                        {
+                            alive = false;
+                            break;
+                        }
+                        regs->SetLoopPos(loop, t->input.CurrentPos());
+                    }
+                    bool loop = current < repeat.min || !repeat.has_max ||
+                        current < repeat.max;
+                    // Only {0} can overrun its bound.
+                    bool exit = current >= repeat.min &&
+                        (!repeat.has_max || current <= repeat.max);
+                    if (loop && exit)
+                    {
+                        // Fork: the other branch waits on the stack.
+                        regs->SetCounter(inst.arg, inst.flag ? 0 : current);
+                        T.push_back(*t);
+                        T.back().pc = inst.flag ? inst.y : inst.x;
+                        T.back().undo_mark = regs->Mark();
+                        regs->SetCounter(inst.arg, inst.flag ? current : 0);
+                        t->pc = inst.flag ? inst.x : inst.y;
+                    }
+                    else if (loop)
+                    {
+                        regs->SetCounter(inst.arg, current);
+                        t->pc = inst.x;
+                    }
+                    else if (exit)
+                    {
+                        regs->SetCounter(inst.arg, 0);
+                        t->pc = inst.y;
+                    }
+                    else
+                        alive = false;
+                    break;
                 }
             }
-            else
+            if (!alive)
+                break;
+        }
+    }
+    return false;
+}
+
+template <typename CharT>
+BasicMatchResult<CharT> MatchPrefix(StringView<CharT> text,
+                                    size_t pos,
+                                    const Program & prog,
+                                    bool history,
+                                    BitState * visited,
+                                    bool * hit_end = nullptr) {
+    Thread<CharT> t = {BasicCharMatcher<CharT>(text, pos), 0};
+    Registers regs(prog, history);
+    if (!MatchWhen(
+            prog, &t, &regs, prog.Final(), false, true, visited, hit_end))
+        return BasicMatchResult<CharT>(BasicCapture<CharT>(text), false);
+    return BasicMatchResult<CharT>(regs.ToCapture(text), true);
+}
+
+template <typename CharT>
+BasicMatchResult<CharT> MatchWhole(StringView<CharT> text,
+                                   const Program & prog,
+                                   bool history,
+                                   BitState * visited) {
+    Thread<CharT> t = {BasicCharMatcher<CharT>(text), 0};
+    Registers regs(prog, history);
+    if (!MatchWhen(prog, &t, &regs, prog.Final(), true, true, visited))
+        return BasicMatchResult<CharT>(BasicCapture<CharT>(text), false);
+    return BasicMatchResult<CharT>(regs.ToCapture(text), true);
+}
+
+// Matches the DFA found are backtracked for their groups while the memo of
+// what it read has at most this many bits, 32 KB.
+static const size_t kMaxBacktrackBits = 256 * 1024;
+
+// Build the capture of a match whose only group is the whole match.
+template <typename CharT>
+BasicMatchResult<CharT> WholeMatchResult(StringView<CharT> text,
+                                         size_t begin,
+                                         size_t end) {
+    BasicCapture<CharT> capture(text);
+    capture.DoCapture(0, begin, true);
+    capture.DoCapture(0, end, false);
+    return BasicMatchResult<CharT>(capture, true);
+}
+
+// Lends a scratch from 'pool' to a call that didn't bring one, for as long
+// as it runs.
+class ScopedScratch {
+public:
+    ScopedScratch(const EnfaMatcher & matcher,
+                  MatchScratchPool * pool,
+                  MatchScratch ** scratch)
+        : pool_(*scratch ? nullptr : pool) {
+        if (pool_)
+        {
+            borrowed_ = pool_->Take(matcher);
+            *scratch = borrowed_.get();
+        }
+    }
+    ~ScopedScratch() {
+        if (pool_)
+            pool_->Give(std::move(borrowed_));
+    }
+
+private:
+    MatchScratchPool * pool_;
+    std::unique_ptr<MatchScratch> borrowed_;
+};
+
+std::shared_ptr<const DenseDfa> EnfaMatcher::BuildJit(
+    const Program & program) {
+    std::shared_ptr<const DenseDfa> dense =
+        DenseDfa::Build(program, true, true, true);
+    return (dense && dense->IsJitted() ? dense : nullptr);
+}
+
+MatchScratch::MatchScratch(const EnfaMatcher & matcher)
+    : program_(matcher.program_.get()) {
+    if (matcher.dfa_)
+    {
+        dfa_.reset(new DfaMatcher::Scratch(*matcher.dfa_));
+        reverse_dfa_.reset(new DfaMatcher::Scratch(*matcher.reverse_dfa_));
+    }
+    if (matcher.pike_vm_)
+        pike_vm_.reset(new PikeVmMatcher::Scratch(*matcher.pike_vm_));
+    if (matcher.memoizable_)
+        visited_.reset(new BitState(matcher.memoizable_.get()));
+}
+
+MatchScratch::~MatchScratch() {
+}
+
+// The memo of a search from 'from', if backtracking is memoized.
+BitState * MatchScratch::Visited(size_t from) {
+    if (visited_)
+        visited_->Reset(from);
+    return visited_.get();
+}
+
+std::unique_ptr<MatchScratch> MatchScratchPool::Take(
+    const EnfaMatcher & matcher) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty())
+        {
+            std::unique_ptr<MatchScratch> scratch = std::move(free_.back());
+            free_.pop_back();
+            return scratch;
+        }
+    }
+    return std::unique_ptr<MatchScratch>(new MatchScratch(matcher));
+}
+
+void MatchScratchPool::Give(std::unique_ptr<MatchScratch> scratch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(scratch));
+}
+
+MatchResult EnfaMatcher::Match(RView text, MatchScratch * scratch) const {
+    ScopedScratch borrowed(*this, scratch_pool_.get(), &scratch);
+    return MatchText(text, scratch);
+}
+
+MatchResult EnfaMatcher::Search(RView text,
+                                size_t from,
+                                MatchScratch * scratch,
+                                size_t before) const {
+    ScopedScratch borrowed(*this, scratch_pool_.get(), &scratch);
+    return SearchText(text, from, scratch, before);
+}
+
+std::vector<MatchResult> EnfaMatcher::MatchAll(RView text,
+                                               MatchScratch * scratch) const {
+    ScopedScratch borrowed(*this, scratch_pool_.get(), &scratch);
+    return MatchAllText(text, scratch);
+}
+
+ByteMatchResult EnfaMatcher::Match(RByteView text,
+                                   MatchScratch * scratch) const {
+    ScopedScratch borrowed(*this, scratch_pool_.get(), &scratch);
+    return MatchText(text, scratch);
+}
+
+ByteMatchResult EnfaMatcher::Search(RByteView text,
+                                    size_t from,
+                                    MatchScratch * scratch,
+                                    size_t before) const {
+    ScopedScratch borrowed(*this, scratch_pool_.get(), &scratch);
+    return SearchText(text, from, scratch, before);
+}
+
+std::vector<ByteMatchResult> EnfaMatcher::MatchAll(
+    RByteView text, MatchScratch * scratch) const {
+    ScopedScratch borrowed(*this, scratch_pool_.get(), &scratch);
+    return MatchAllText(text, scratch);
+}
+
+bool EnfaMatcher::IsJitted() const {
+    return dense_ != nullptr;
+}
+
+// 'scratch' is only needed, and only set, when there is a DFA or a memo.
+template <typename CharT>
+BasicMatchResult<CharT> EnfaMatcher::MatchText(StringView<CharT> text,
+                                               MatchScratch * scratch) const {
+    // Bytes only make sense to a pattern lowered to UTF-8.
+    RAssert(utf8_ == (sizeof(CharT) == 1));
+    RAssert(!scratch || scratch->program_ == program_.get());
+    if (dfa_)
+    {
+        if (!dfa_->Match(text, scratch->dfa_.get()))
+            return BasicMatchResult<CharT>(BasicCapture<CharT>(text), false);
+        if (capture_count_ == 1)
+            return WholeMatchResult(text, 0, text.size());
+    }
+    if (pike_vm_ && !backtrack_captures_)
+        return pike_vm_->Match(text, scratch->pike_vm_.get());
+    return MatchWhole(text,
+                      *program_,
+                      capture_history_,
+                      scratch ? scratch->Visited(0) : nullptr);
+}
+
+template <typename CharT>
+BasicMatchResult<CharT> EnfaMatcher::SearchText(StringView<CharT> text,
+                                                size_t from,
+                                                MatchScratch * scratch,
+                                                size_t before) const {
+    RAssert(utf8_ == (sizeof(CharT) == 1));
+    RAssert(!scratch || scratch->program_ == program_.get());
+    if (!pike_vm_)
+    {
+        // One memo for every start position: what failed from one fails
+        // from all of them.
+        BitState * visited = scratch ? scratch->Visited(from) : nullptr;
+        size_t begin, last;
+        for (size_t pos = from;
+             prefilter_.NextCandidates(text, pos, &begin, &last, before);
+             pos = last + 1)
+        {
+            for (pos = begin; pos <= last; ++pos)
             {
-                for (auto out = t.state->MultipleOut().rbegin();
-                     out != t.state->MultipleOut().rend();
-                     ++out)
-                {
-                    T.push_back({t.input, *out, t.capture, t.id_to_repcnt});
-                }
+                BasicMatchResult<CharT> m = MatchPrefix(
+                    text, pos, *program_, capture_history_, visited);
+                if (m.Matched())
+                    return m;
             }
         }
-#ifdef DEBUG
-        std::wcout << L"[ ";
-        for (auto ti = T.rbegin(); ti != T.rend(); ++ti)
-            std::wcout << debug[ti->state] << L',';
-        std::wcout << L" ]" << std::endl;
-#endif
+        return BasicMatchResult<CharT>(BasicCapture<CharT>(text), false);
     }
-#ifdef DEBUG
-    if (debug_indent.size() >= 2)
-        debug_indent.pop_back(), debug_indent.pop_back();
-#endif
-    return MatchResult(Capture(start.capture.Origin()), false);
+
+    // The DFA finds where the leftmost match ends, the reverse DFA where it
+    // starts: no match starts earlier, so that is the first position the
+    // match can be read back to. Groups are then filled in from there.
+    size_t last, begin, end, read;
+    if (!prefilter_.NextCandidates(text, from, &from, &last, before))
+        return BasicMatchResult<CharT>(BasicCapture<CharT>(text), false);
+    // The machine code has no bound on where matches start.
+    bool found = (dense_ && sizeof(CharT) == 1 && before > text.size())
+        ? dense_->Search(text, from, &end, &read)
+        : dfa_->Search(
+              text, from, &end, scratch->dfa_.get(), &read, before);
+    if (!found)
+        return BasicMatchResult<CharT>(BasicCapture<CharT>(text), false);
+    found = reverse_dfa_->LongestMatchBackward(
+        text, from, end, &begin, scratch->reverse_dfa_.get());
+    RAssert(found);
+    if (capture_count_ == 1)
+        return WholeMatchResult(text, begin, end);
+    // Backtracking reads no further than the DFA did, and memoized it runs
+    // each (pc, position) once, so it wins over the Pike VM while the
+    // memo is small.
+    if (backtrack_captures_ ||
+        (scratch->visited_ &&
+         (read - begin + 1) * program_->Size() <= kMaxBacktrackBits))
+    {
+        return MatchPrefix(text,
+                           begin,
+                           *program_,
+                           capture_history_,
+                           scratch->Visited(begin));
+    }
+    return pike_vm_->Search(text, begin, end, scratch->pike_vm_.get());
 }
 
-MatchResult MatchPrefix(RView text, const EnfaState * start) {
-    Thread t = {LexMatcher(text), start, Capture(text)};
-    return MatchWhen(
-        t,
-        [](const Thread & current) -> bool { return current.state->IsFinal(); },
-        true);
+template <typename CharT>
+BasicMatchResult<CharT> EnfaMatcher::MatchAt(StringView<CharT> text,
+                                             size_t pos,
+                                             bool * hit_end,
+                                             MatchScratch * scratch) const {
+    RAssert(utf8_ == (sizeof(CharT) == 1));
+    RAssert(scratch->program_ == program_.get());
+    return MatchPrefix(text,
+                       pos,
+                       *program_,
+                       capture_history_,
+                       scratch->Visited(pos),
+                       hit_end);
 }
 
-MatchResult MatchWhole(RView text, const EnfaState * start) {
-    Thread t = {LexMatcher(text), start, Capture(text)};
-    return MatchWhen(t,
-                     [](const Thread & current) -> bool {
-                         if (current.state->IsFinal())
-                         {
-                             auto range =
-                                 current.capture.Group(0).GetLastRange();
-                             return (size_t)(range.second - range.first) ==
-                                 current.input.Origin().size();
-                         }
-                         return false;
-                     },
-                     true);
+// The DFA runs over the text as far as it has come. A match it finds ends
+// before the text does only if no later text can change it; otherwise the
+// start of the earliest way to match still alive is where to wait.
+template <typename CharT>
+size_t EnfaMatcher::NextAttempt(StringView<CharT> text,
+                                size_t from,
+                                bool at_end,
+                                MatchScratch * scratch) const {
+    RAssert(scratch->program_ == program_.get());
+    if (!dfa_ || from > text.size())
+        return from;
+    size_t end, read, pending, begin;
+    if (!dfa_->Search(text,
+                      from,
+                      &end,
+                      scratch->dfa_.get(),
+                      &read,
+                      static_cast<size_t>(-1),
+                      &pending))
+        return at_end ? text.size() + 1 : pending;
+    if (read == text.size() && !at_end)
+        return pending;
+    bool found = reverse_dfa_->LongestMatchBackward(
+        text, from, end, &begin, scratch->reverse_dfa_.get());
+    RAssert(found);
+    return begin;
 }
 
-MatchResult EnfaMatcher::Match(RView text) const {
-    return MatchWhole(text, start_);
+template <typename CharT>
+std::vector<BasicMatchResult<CharT>> EnfaMatcher::MatchAllText(
+    StringView<CharT> text, MatchScratch * scratch) const {
+    std::vector<BasicMatchResult<CharT>> matches;
+    for (BasicMatchIterator<CharT> it(*this, text, scratch); it.HasNext();)
+        matches.push_back(it.Next());
+    return matches;
 }
 
-std::vector<MatchResult> EnfaMatcher::MatchAll(RView text) const {
-    std::vector<MatchResult> matches;
+template <typename CharT>
+BasicMatchIterator<CharT>::BasicMatchIterator(const EnfaMatcher & matcher,
+                                              StringView<CharT> text,
+                                              MatchScratch * scratch)
+    : matcher_(&matcher)
+    , scratch_(scratch)
+    , text_(text)
+    , pos_(0)
+    , done_(false)
+    , next_(BasicCapture<CharT>(text), false) {
+}
 
-    RView match_text = text;
-    while (true)
+template <typename CharT>
+bool BasicMatchIterator<CharT>::HasNext() {
+    if (!next_.Matched() && !done_)
     {
-        MatchResult m = MatchPrefix(match_text, start_);
-        size_t scanned = 1;
-        if (m.Matched())
+        next_ = matcher_->Search(text_, pos_, scratch_);
+        if (next_.Matched())
         {
-            matches.push_back(m);
-            auto range = m.GetCapture().Group(0).GetLastRange();
-            scanned = std::max(scanned, range.second - range.first);
+            // Empty matches advance by one char, so every start position
+            // is tried once, including the end of text.
+            auto range = next_.GetCapture().Group(0).GetLastRange();
+            done_ = (range.first == text_.size());
+            pos_ = (range.first == range.second
+                        ? NextCharPos(text_, range.first)
+                        : range.second);
         }
-
-        if (match_text.empty())
-            break;
         else
-            match_text.PopFront(scanned);
+            done_ = true;
     }
+    return next_.Matched();
+}
 
-    return matches;
+template <typename CharT>
+BasicMatchResult<CharT> BasicMatchIterator<CharT>::Next() {
+    RAssert(HasNext());
+    BasicMatchResult<CharT> m = next_;
+    next_ = BasicMatchResult<CharT>(BasicCapture<CharT>(text_), false);
+    return m;
 }
+
+template class BasicMatchIterator<RChar>;
+template class BasicMatchIterator<RByte>;
+template MatchResult EnfaMatcher::MatchAt(RView,
+                                          size_t,
+                                          bool *,
+                                          MatchScratch *) const;
+template ByteMatchResult EnfaMatcher::MatchAt(RByteView,
+                                              size_t,
+                                              bool *,
+                                              MatchScratch *) const;
+template size_t EnfaMatcher::NextAttempt(RView,
+                                         size_t,
+                                         bool,
+                                         MatchScratch *) const;
+template size_t EnfaMatcher::NextAttempt(RByteView,
+                                         size_t,
+                                         bool,
+                                         MatchScratch *) const;
@@ -1,16 +1,206 @@
 #pragma once
 
+#include "DfaMatcher.h"
 #include "Enfa.h"
 #include "MatchResult.h"
+#include "PikeVmMatcher.h"
+#include "Prefilter.h"
+#include "Program.h"
 #include "StringView.h"
 
+#include <mutex>
+
+struct MatchOptions {
+    enum Engine {
+        // DFA and Pike VM when the pattern allows it, backtracking
+        // otherwise.
+        AUTO,
+        BACKTRACK,
+        // Linear time matching, last capture of each group only. Patterns
+        // with back references, look-around or atomic groups, and capture
+        // history, are backtracked instead. So are the groups of patterns
+        // capturing inside a loop whose body can match empty, once the
+        // match is found.
+        PIKE_VM,
+    };
+
+    MatchOptions()
+        : engine(AUTO)
+        , memoize(false)
+        , capture_history(false)
+        , utf8(false)
+        , jit(false) {
+    }
+
+    Engine engine;
+    // Remember failed (state, position) pairs when backtracking, so
+    // catastrophic patterns take polynomial time. A search remembers up to
+    // 32M pairs, 4 MB: past that it goes on without memoizing.
+    bool memoize;
+    // Keep every capture of each group, not just the last one. Matches are
+    // then found by backtracking.
+    bool capture_history;
+    // Match raw UTF-8 text (RByteView) instead of wide text. Chars above
+    // U+007F match their UTF-8 byte sequence, and positions are byte
+    // offsets.
+    bool utf8;
+    // Compile a dense DFA to machine code, to run over UTF-8 text: that of
+    // a Lexer or RegexSet, or the one finding where a pattern's matches end.
+    // Without a JIT for this system, or for a pattern whose DFA has too many
+    // states, matching goes on as before.
+    bool jit;
+};
+
+class BitState;
+class DenseDfa;
+class MatchScratch;
+class MatchScratchPool;
+
+/*
+ * A compiled pattern. Matching never modifies it, so any number of threads
+ * may share one. What matching builds up, such as lazy DFA states, lives
+ * in a MatchScratch: pass one per thread to match without locking. Calls
+ * without a scratch borrow one from a pool the copies of a matcher share.
+ */
 class EnfaMatcher {
     friend class RegexCompiler;
+    friend class MatchScratch;
+    friend class Lexer;
+    friend class ProgramFile;
+    friend class RegexSet;
+    template <typename CharT>
+    friend class BasicStreamMatcher;
 
 public:
-    MatchResult Match(RView text) const;
-    std::vector<MatchResult> MatchAll(RView text) const;
+    MatchResult Match(RView text, MatchScratch * scratch = nullptr) const;
+    // Leftmost match starting at or after 'from', and before 'before'. The
+    // match may end past 'before'.
+    MatchResult Search(RView text,
+                       size_t from = 0,
+                       MatchScratch * scratch = nullptr,
+                       size_t before = static_cast<size_t>(-1)) const;
+    std::vector<MatchResult> MatchAll(RView text,
+                                      MatchScratch * scratch = nullptr) const;
+
+    // The same over UTF-8 text, for patterns compiled with
+    // MatchOptions::utf8.
+    ByteMatchResult Match(RByteView text,
+                          MatchScratch * scratch = nullptr) const;
+    ByteMatchResult Search(RByteView text,
+                           size_t from = 0,
+                           MatchScratch * scratch = nullptr,
+                           size_t before = static_cast<size_t>(-1)) const;
+    std::vector<ByteMatchResult> MatchAll(
+        RByteView text, MatchScratch * scratch = nullptr) const;
+    // Searches run as machine code, see MatchOptions::jit.
+    bool IsJitted() const;
 
 private:
-    EnfaState * start_;
+    template <typename CharT>
+    BasicMatchResult<CharT> MatchText(StringView<CharT> text,
+                                      MatchScratch * scratch) const;
+    template <typename CharT>
+    BasicMatchResult<CharT> SearchText(StringView<CharT> text,
+                                       size_t from,
+                                       MatchScratch * scratch,
+                                       size_t before) const;
+    template <typename CharT>
+    std::vector<BasicMatchResult<CharT>> MatchAllText(
+        StringView<CharT> text, MatchScratch * scratch) const;
+    // Match starting exactly at 'pos', found by backtracking. '*hit_end' is
+    // set if the outcome depends on text past the end.
+    template <typename CharT>
+    BasicMatchResult<CharT> MatchAt(StringView<CharT> text,
+                                    size_t pos,
+                                    bool * hit_end,
+                                    MatchScratch * scratch) const;
+    // For text that more may follow: the first start at or after 'from'
+    // worth an attempt, every earlier one failing whatever follows. Past the
+    // end if 'at_end' and no match is left.
+    template <typename CharT>
+    size_t NextAttempt(StringView<CharT> text,
+                       size_t from,
+                       bool at_end,
+                       MatchScratch * scratch) const;
+    // The search DFA of 'program' compiled to machine code, or null.
+    static std::shared_ptr<const DenseDfa> BuildJit(const Program & program);
+
+    std::shared_ptr<const Program> program_;
+    // Code units are bytes of UTF-8 text.
+    bool utf8_;
+    size_t capture_count_;
+    // Positions where a match may start.
+    Prefilter prefilter_;
+    // Set when the pattern can be simulated by a DFA and a Pike VM. The
+    // reverse DFA runs back from where a match ends to where it starts.
+    std::shared_ptr<const DfaMatcher> dfa_;
+    std::shared_ptr<const DfaMatcher> reverse_dfa_;
+    std::shared_ptr<const PikeVmMatcher> pike_vm_;
+    // Set by MatchOptions::jit, in place of 'dfa_' to search UTF-8 text.
+    std::shared_ptr<const DenseDfa> dense_;
+    bool capture_history_;
+    // The Pike VM only locates matches, backtracking fills in the groups:
+    // for their history, or for captures in a loop that can match empty.
+    bool backtrack_captures_;
+    // Set when backtracking is memoized, indexed by pc: on request, and
+    // when there is a DFA.
+    std::shared_ptr<const std::vector<bool>> memoizable_;
+    // Scratch for calls that don't bring their own.
+    std::shared_ptr<MatchScratchPool> scratch_pool_;
 };
+
+// Mutable matching state for one EnfaMatcher, used by one thread at a time.
+// Reusing it keeps the lazy DFA states built so far, and the Pike VM's
+// thread lists and backtracking memo.
+class MatchScratch {
+public:
+    explicit MatchScratch(const EnfaMatcher & matcher);
+    ~MatchScratch();
+
+private:
+    friend class EnfaMatcher;
+
+    BitState * Visited(size_t from);
+
+    const Program * program_;
+    // Set when the matcher has a DFA and a Pike VM.
+    std::unique_ptr<DfaMatcher::Scratch> dfa_;
+    std::unique_ptr<DfaMatcher::Scratch> reverse_dfa_;
+    std::unique_ptr<PikeVmMatcher::Scratch> pike_vm_;
+    // Set when backtracking is memoized.
+    std::unique_ptr<BitState> visited_;
+};
+
+// Scratch kept for reuse by calls that don't bring their own.
+class MatchScratchPool {
+public:
+    std::unique_ptr<MatchScratch> Take(const EnfaMatcher & matcher);
+    void Give(std::unique_ptr<MatchScratch> scratch);
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<MatchScratch>> free_;
+};
+
+// Successive non-overlapping matches, found one at a time.
+template <typename CharT>
+class BasicMatchIterator {
+public:
+    BasicMatchIterator(const EnfaMatcher & matcher,
+                       StringView<CharT> text,
+                       MatchScratch * scratch = nullptr);
+
+    bool HasNext();
+    BasicMatchResult<CharT> Next();
+
+private:
+    const EnfaMatcher * matcher_;
+    MatchScratch * scratch_;
+    StringView<CharT> text_;
+    size_t pos_;
+    bool done_;
+    BasicMatchResult<CharT> next_;
+};
+
+typedef BasicMatchIterator<RChar> MatchIterator;
+typedef BasicMatchIterator<RByte> ByteMatchIterator;
@@ -0,0 +1,178 @@
+#include "stdafx.h"
+
+#include "FileSearch.h"
+#include "Input.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : data_(nullptr)
+    , size_(0)
+#ifdef _WIN32
+    , file_(INVALID_HANDLE_VALUE)
+    , mapping_(nullptr)
+#else
+    , fd_(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string & path) {
+    Close();
+    file_ = CreateFileA(path.c_str(),
+                        GENERIC_READ,
+                        FILE_SHARE_READ,
+                        nullptr,
+                        OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN,
+                        nullptr);
+    LARGE_INTEGER size;
+    if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size))
+    {
+        Close();
+        return false;
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    // Empty files can't be mapped.
+    if (size_ == 0)
+    {
+        data_ = "";
+        return true;
+    }
+    mapping_ =
+        CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_ != nullptr)
+    {
+        data_ = static_cast<const char *>(
+            MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (data_ == nullptr)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data_ != nullptr && size_ > 0)
+        UnmapViewOfFile(data_);
+    if (mapping_ != nullptr)
+        CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE)
+        CloseHandle(file_);
+    data_ = nullptr;
+    size_ = 0;
+    file_ = INVALID_HANDLE_VALUE;
+    mapping_ = nullptr;
+}
+#else
+bool MappedFile::Open(const std::string & path) {
+    Close();
+    fd_ = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0)
+    {
+        Close();
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    // Empty files can't be mapped.
+    if (size_ == 0)
+    {
+        data_ = "";
+        return true;
+    }
+    void * p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (p == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+    // The file is scanned front to back, once.
+    madvise(p, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char *>(p);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data_ != nullptr && size_ > 0)
+        munmap(const_cast<char *>(data_), size_);
+    if (fd_ >= 0)
+        close(fd_);
+    data_ = nullptr;
+    size_ = 0;
+    fd_ = -1;
+}
+#endif
+
+RByteView MappedFile::Bytes() const {
+    return RByteView(data_ == nullptr ? "" : data_, size_);
+}
+
+bool SearchFile(const std::string & path,
+                const EnfaMatcher & matcher,
+                const std::function<void(const FileMatch &)> & on_match) {
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+    RByteView bytes = file.Bytes();
+    Input input = Input::Detect(bytes);
+    if (!input.IsByteText())
+        return false;
+
+    RByteView text = input.Bytes();
+    const char * begin = text.data();
+    const char * end = begin + text.size();
+    size_t bom_size = bytes.size() - text.size();
+    // Lines are counted lazily up to each match, so the text is scanned
+    // for line breaks once overall.
+    size_t line = 1;
+    const char * line_begin = begin;
+    const char * scanned = begin;
+
+    for (ByteMatchIterator it(matcher, text); it.HasNext();)
+    {
+        ByteMatchResult m = it.Next();
+        auto range = m.GetCapture().Group(0).GetLastRange();
+        const char * match_begin = begin + range.first;
+        while (const char * nl = static_cast<const char *>(
+                   std::memchr(scanned, '\n', match_begin - scanned)))
+        {
+            ++line;
+            line_begin = scanned = nl + 1;
+        }
+        scanned = match_begin;
+
+        const char * line_end = static_cast<const char *>(
+            std::memchr(match_begin, '\n', end - match_begin));
+        if (line_end == nullptr)
+            line_end = end;
+        if (line_end > line_begin && line_end[-1] == '\r')
+            --line_end;
+
+        FileMatch match = {
+            bom_size + range.first,
+            RByteView(match_begin, range.second - range.first),
+            line,
+            RByteView(line_begin, line_end - line_begin),
+        };
+        on_match(match);
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "EnfaMatcher.h"
+#include "RegexSyntax.h"
+
+#include <functional>
+#include <string>
+
+// A read-only view of a whole file, mapped into memory.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    bool Open(const std::string & path);
+    void Close();
+    RByteView Bytes() const;
+
+private:
+    const char * data_;
+    size_t size_;
+#ifdef _WIN32
+    void * file_;
+    void * mapping_;
+#else
+    int fd_;
+#endif
+};
+
+struct FileMatch {
+    // Byte offset of the match in the file.
+    size_t offset;
+    RByteView text;
+    // 1-based number of the line the match starts on, and its text without
+    // the line break.
+    size_t line;
+    RByteView line_text;
+};
+
+// Matches 'matcher', compiled with MatchOptions::utf8, against the whole
+// file as one buffer and calls 'on_match' for each match in order. Returns
+// false when the file can't be mapped or isn't ASCII or UTF-8 text.
+bool SearchFile(const std::string & path,
+                const EnfaMatcher & matcher,
+                const std::function<void(const FileMatch &)> & on_match);
@@ -0,0 +1,214 @@
+#include "stdafx.h"
+
+#include "Input.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+static int PopCount(UINT32 x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return static_cast<int>((x * 0x01010101) >> 24);
+}
+
+size_t AsciiPrefixLength(const char * data, size_t size) {
+    size_t i = 0;
+#ifdef HAS_SSE2
+    // The sign bit of each byte is set for non-ASCII bytes.
+    for (; size - i >= sizeof(__m128i); i += sizeof(__m128i))
+    {
+        __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        int mask = _mm_movemask_epi8(block);
+        if (mask != 0)
+        {
+            while ((mask & 1) == 0)
+                mask >>= 1, ++i;
+            return i;
+        }
+    }
+#endif
+    while (i < size && (data[i] & 0x80) == 0)
+        ++i;
+    return i;
+}
+
+size_t CountUtf8Chars(const char * data, size_t size) {
+    size_t count = 0;
+    size_t i = 0;
+#ifdef HAS_SSE2
+    // Continuation bytes 10xxxxxx are -128..-65 as signed bytes.
+    const __m128i kMaxContinuation = _mm_set1_epi8(-65);
+    for (; size - i >= sizeof(__m128i); i += sizeof(__m128i))
+    {
+        __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i lead = _mm_cmpgt_epi8(block, kMaxContinuation);
+        count += PopCount(static_cast<UINT32>(_mm_movemask_epi8(lead)));
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        if ((data[i] & 0xC0) != 0x80)
+            ++count;
+    }
+    return count;
+}
+
+bool IsValidUtf8(const char * data, size_t size) {
+    const UINT8 * p = reinterpret_cast<const UINT8 *>(data);
+    const UINT8 * end = p + size;
+    while (p < end)
+    {
+        if (*p < 0x80)
+        {
+            p += AsciiPrefixLength(reinterpret_cast<const char *>(p),
+                                   static_cast<size_t>(end - p));
+            continue;
+        }
+
+        int n;
+        UINT32 min;
+        if (*p >= 0xC2 && *p <= 0xDF)
+            n = 1, min = 0x80;
+        else if ((*p & 0xF0) == 0xE0)
+            n = 2, min = 0x800;
+        else if (*p >= 0xF0 && *p <= 0xF4)
+            n = 3, min = 0x10000;
+        else
+            return false;
+        if (end - p <= n)
+            return false;
+
+        UINT32 c = *p & (0x3F >> n);
+        for (int i = 1; i <= n; ++i)
+        {
+            if ((p[i] & 0xC0) != 0x80)
+                return false;
+            c = (c << 6) | (p[i] & 0x3F);
+        }
+        if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+            return false;
+        p += n + 1;
+    }
+    return true;
+}
+
+bool IsValidUtf16(const char * data, size_t size, bool big_endian) {
+    if (size % 2 != 0)
+        return false;
+    RByteView text(data, size);
+    UTF16Encoding chars(text, big_endian);
+    while (chars.HasNext())
+    {
+        // Paired surrogates decode above U+FFFF.
+        UINT32 c = chars.Next();
+        if (c >= 0xD800 && c <= 0xDFFF)
+            return false;
+    }
+    return true;
+}
+
+Input::Input(RByteView bytes, Encoding encoding)
+    : bytes_(bytes)
+    , encoding_(encoding) {
+}
+
+Input Input::Detect(RByteView bytes) {
+    static const struct {
+        const char * bom;
+        size_t size;
+        Encoding encoding;
+    } kBoms[] = {
+        {"\xEF\xBB\xBF", 3, UTF8},
+        {"\xFF\xFE", 2, UTF16LE},
+        {"\xFE\xFF", 2, UTF16BE},
+    };
+    for (const auto & b : kBoms)
+    {
+        if (bytes.size() >= b.size &&
+            std::memcmp(bytes.data(), b.bom, b.size) == 0)
+        {
+            bytes.PopFront(b.size);
+            return Input(bytes, b.encoding);
+        }
+    }
+    return Input(bytes, UTF8);
+}
+
+Input::Encoding Input::GetEncoding() const {
+    return encoding_;
+}
+
+RByteView Input::Bytes() const {
+    return bytes_;
+}
+
+bool Input::IsValid() const {
+    switch (encoding_)
+    {
+        case ASCII:
+            return AsciiPrefixLength(bytes_.data(), bytes_.size()) ==
+                   bytes_.size();
+        case UTF8:
+            return IsValidUtf8(bytes_.data(), bytes_.size());
+        default:
+            return IsValidUtf16(
+                bytes_.data(), bytes_.size(), encoding_ == UTF16BE);
+    }
+}
+
+bool Input::IsByteText() const {
+    return encoding_ == ASCII || encoding_ == UTF8;
+}
+
+template <typename Decoder>
+static void Decode(Decoder chars, RString * buffer) {
+    buffer->clear();
+    while (chars.HasNext())
+    {
+        UINT32 c = chars.Next();
+        if (sizeof(RChar) == 2 && c > 0xFFFF)
+        {
+            c -= 0x10000;
+            buffer->push_back(static_cast<RChar>(0xD800 + (c >> 10)));
+            buffer->push_back(static_cast<RChar>(0xDC00 + (c & 0x3FF)));
+        }
+        else
+            buffer->push_back(static_cast<RChar>(c));
+    }
+}
+
+RView Input::WideText(RString * buffer) const {
+    const UINT16 kOne = 1;
+    bool host_big_endian = (*reinterpret_cast<const UINT8 *>(&kOne) == 0);
+    bool in_place =
+        sizeof(RChar) == 2 && !IsByteText() &&
+        (encoding_ == UTF16BE) == host_big_endian &&
+        reinterpret_cast<uintptr_t>(bytes_.data()) % alignof(RChar) == 0;
+    if (in_place)
+    {
+        return RView(reinterpret_cast<const RChar *>(bytes_.data()),
+                     bytes_.size() / sizeof(RChar));
+    }
+
+    switch (encoding_)
+    {
+        case ASCII:
+            Decode(ASCIIEncoding(bytes_), buffer);
+            break;
+        case UTF8:
+            Decode(UTF8Encoding(bytes_), buffer);
+            break;
+        default:
+            Decode(UTF16Encoding(bytes_, encoding_ == UTF16BE), buffer);
+            break;
+    }
+    return RView(*buffer);
+}
@@ -1,43 +1,72 @@
 #pragma once
 
 #include "IntType.h"
-#include "stdafx.h"
+#include "RegexSyntax.h"
 
-class ByteArray {};
+#include <cassert>
 
+// Length of the run of ASCII bytes at the start of [data, data + size).
+size_t AsciiPrefixLength(const char * data, size_t size);
+// Number of chars in UTF-8 text, i.e. bytes that aren't continuation bytes.
+size_t CountUtf8Chars(const char * data, size_t size);
+
+// Rejects overlong forms, surrogates and code points above U+10FFFF.
+bool IsValidUtf8(const char * data, size_t size);
+// Rejects unpaired surrogates and odd sizes.
+bool IsValidUtf16(const char * data, size_t size, bool big_endian);
+
+// Decoders walk valid text in place, a code point at a time. Positions are
+// byte offsets.
 class UTF8Encoding {
 public:
+    explicit UTF8Encoding(RByteView text, size_t pos = 0)
+        : begin_(text.data())
+        , end_(text.data() + text.size())
+        , pos_(text.data() + pos) {
+        assert(pos <= text.size());
+    }
+
     bool HasNext() const {
         return pos_ < end_;
     }
     UINT32 Next() {
+        assert(HasNext());
+        UINT32 c = static_cast<UINT8>(*pos_++);
+        if (c < 0x80)
+            return c;
+        // Lead byte 110xxxxx, 1110xxxx or 11110xxx.
+        int n = (c >= 0xF0 ? 3 : (c >= 0xE0 ? 2 : 1));
+        c &= 0x3F >> n;
+        for (; n > 0 && pos_ < end_; --n)
+            c = (c << 6) | (static_cast<UINT8>(*pos_++) & 0x3F);
+        return c;
     }
 
     bool HasPrev() const {
         return pos_ > begin_;
     }
     UINT32 Prev() {
-        // TODO: optimize
         assert(HasPrev());
-        if ((*--pos_ & 0x80) == 0)
-            return *pos_;
-        if ((*--pos_ & 0xE0) == 0xC0)
-            return (((UINT32)(*pos_ & 0x1F) << 8) |
-                    ((UINT32)(*(pos_ + 1) & 0x3F)));
-        if ((*--pos_ & 0xF0) == 0xE0)
-            return (((UINT32)(*pos_ & 0x0F) << 16) |
-                    ((UINT32)(*(pos_ + 1) & 0x3F) << 8) |
-                    ((UINT32)(*(pos_ + 2) & 0x3F)));
-        --pos_;
-        assert((*pos_ & 0xF8) == 0xF0);
-        return (((UINT32)(*pos_ & 0x06) << 24) |
-                ((UINT32)(*(pos_ + 1) & 0x3F) << 16) |
-                ((UINT32)(*(pos_ + 2) & 0x3F) << 8) |
-                ((UINT32)(*(pos_ + 3) & 0x3F)));
+        // Back up to the lead byte, then decode forward.
+        const char * p = pos_ - 1;
+        while (p > begin_ && pos_ - p < 4 && (*p & 0xC0) == 0x80)
+            --p;
+        pos_ = p;
+        UINT32 c = Next();
+        pos_ = p;
+        return c;
     }
 
+    // ASCII fast path: moves past a run of ASCII chars at once.
+    void SkipAscii() {
+        pos_ += AsciiPrefixLength(pos_, static_cast<size_t>(end_ - pos_));
+    }
+
+    size_t Pos() const {
+        return static_cast<size_t>(pos_ - begin_);
+    }
     size_t CharCount() const {
-        return char_count_;
+        return CountUtf8Chars(begin_, ByteCount());
     }
     size_t ByteCount() const {
         return static_cast<size_t>(end_ - begin_);
@@ -47,21 +76,151 @@ private:
     const char * begin_;
     const char * end_;
     const char * pos_;
-    size_t char_count_;
 };
 
-// TODO: UTF16Encoding
-// TODO: ASCIIEncoding
-// regex engine doesn't care actual character, it only needs "match one" and "match range",
-// so for ascii, ASCIIEncoding is best, for unicode, UTF16Encoding is best.
-
-// decoder
-// class InputStream {
-// public:
-//    enum Encoding { UNKNOWN, UTF8, UTF16LE, UTF16BE, UCS2, UTF32LE, UTF32BE };
-//
-//    Encoding GetEncoding() const;
-//
-//    bool HasNext();
-//    UINT32 Next();
-//};
+// Start of the char after the one at 'pos', or past the end.
+inline size_t NextCharPos(RView, size_t pos) {
+    return pos + 1;
+}
+
+// In UTF-8 text, a char is a whole byte sequence.
+inline size_t NextCharPos(RByteView text, size_t pos) {
+    if (pos >= text.size())
+        return pos + 1;
+    UTF8Encoding chars(text, pos);
+    chars.Next();
+    return chars.Pos();
+}
+
+// Chars outside the BMP are surrogate pairs. Unpaired surrogates decode to
+// themselves.
+class UTF16Encoding {
+public:
+    UTF16Encoding(RByteView text, bool big_endian, size_t pos = 0)
+        : begin_(text.data())
+        , end_(text.data() + text.size() / 2 * 2)
+        , pos_(text.data() + pos)
+        , big_endian_(big_endian) {
+        assert(pos % 2 == 0 && pos <= text.size());
+    }
+
+    bool HasNext() const {
+        return pos_ < end_;
+    }
+    UINT32 Next() {
+        assert(HasNext());
+        UINT32 c = Unit(pos_);
+        pos_ += 2;
+        if (IsHighSurrogate(c) && pos_ < end_ && IsLowSurrogate(Unit(pos_)))
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + (Unit(pos_) - 0xDC00);
+            pos_ += 2;
+        }
+        return c;
+    }
+
+    bool HasPrev() const {
+        return pos_ > begin_;
+    }
+    UINT32 Prev() {
+        assert(HasPrev());
+        pos_ -= 2;
+        UINT32 c = Unit(pos_);
+        if (IsLowSurrogate(c) && pos_ > begin_ &&
+            IsHighSurrogate(Unit(pos_ - 2)))
+        {
+            pos_ -= 2;
+            c = 0x10000 + ((Unit(pos_) - 0xD800) << 10) + (c - 0xDC00);
+        }
+        return c;
+    }
+
+    size_t Pos() const {
+        return static_cast<size_t>(pos_ - begin_);
+    }
+    size_t ByteCount() const {
+        return static_cast<size_t>(end_ - begin_);
+    }
+
+    static bool IsHighSurrogate(UINT32 u) {
+        return u >= 0xD800 && u <= 0xDBFF;
+    }
+    static bool IsLowSurrogate(UINT32 u) {
+        return u >= 0xDC00 && u <= 0xDFFF;
+    }
+
+private:
+    UINT32 Unit(const char * p) const {
+        UINT32 b0 = static_cast<UINT8>(p[0]);
+        UINT32 b1 = static_cast<UINT8>(p[1]);
+        return big_endian_ ? ((b0 << 8) | b1) : ((b1 << 8) | b0);
+    }
+
+    const char * begin_;
+    const char * end_;
+    const char * pos_;
+    bool big_endian_;
+};
+
+class ASCIIEncoding {
+public:
+    explicit ASCIIEncoding(RByteView text, size_t pos = 0)
+        : text_(text)
+        , pos_(pos) {
+    }
+
+    bool HasNext() const {
+        return pos_ < text_.size();
+    }
+    UINT32 Next() {
+        assert(HasNext());
+        return CodeUnit(text_[pos_++]);
+    }
+
+    bool HasPrev() const {
+        return pos_ > 0;
+    }
+    UINT32 Prev() {
+        assert(HasPrev());
+        return CodeUnit(text_[--pos_]);
+    }
+
+    size_t Pos() const {
+        return pos_;
+    }
+    size_t ByteCount() const {
+        return text_.size();
+    }
+
+private:
+    RByteView text_;
+    size_t pos_;
+};
+
+// Encoded text in memory, matched without copying where the engines allow:
+// ASCII and UTF-8 text is matched as bytes, UTF-16 text as wide chars.
+class Input {
+public:
+    enum Encoding { ASCII, UTF8, UTF16LE, UTF16BE };
+
+    Input(RByteView bytes, Encoding encoding);
+    // Take the encoding from a byte-order mark, which is skipped. Text
+    // without one is UTF-8.
+    static Input Detect(RByteView bytes);
+
+    Encoding GetEncoding() const;
+    // The text without its byte-order mark.
+    RByteView Bytes() const;
+    bool IsValid() const;
+
+    // Match Bytes() with a matcher compiled with MatchOptions::utf8.
+    bool IsByteText() const;
+    // The text as wide chars. Points into the input when wchar_t is a
+    // UTF-16 code unit in host byte order, otherwise the text is decoded
+    // into 'buffer'.
+    RView WideText(RString * buffer) const;
+
+private:
+    RByteView bytes_;
+    Encoding encoding_;
+};
@@ -0,0 +1,381 @@
+#include "stdafx.h"
+
+#include "DenseDfa.h"
+#include "JitDfa.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RE_JIT_X64
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Bytes of machine code, with jumps to labels resolved once every label is
+// bound.
+class Assembler {
+public:
+    int NewLabel() {
+        labels_.push_back(-1);
+        return static_cast<int>(labels_.size() - 1);
+    }
+    void Bind(int label) {
+        labels_[label] = static_cast<int>(code_.size());
+    }
+    size_t Size() const {
+        return code_.size();
+    }
+    // Where a bound label is.
+    int Offset(int label) const {
+        return labels_[label];
+    }
+
+    void Emit(std::initializer_list<UINT8> bytes) {
+        code_.insert(code_.end(), bytes);
+    }
+    void Emit32(UINT32 value) {
+        for (int i = 0; i < 4; ++i)
+            code_.push_back(static_cast<UINT8>(value >> (8 * i)));
+    }
+    // A 32-bit displacement to 'label', relative to the end of itself.
+    void EmitRel32(int label) {
+        fixups_.emplace_back(code_.size(), label);
+        Emit32(0);
+    }
+
+    // Jumps: jmp, je, jne and jbe, all with 32-bit displacements.
+    void Jmp(int label) {
+        Emit({0xE9});
+        EmitRel32(label);
+    }
+    void Je(int label) {
+        Emit({0x0F, 0x84});
+        EmitRel32(label);
+    }
+    void Jne(int label) {
+        Emit({0x0F, 0x85});
+        EmitRel32(label);
+    }
+    void Jbe(int label) {
+        Emit({0x0F, 0x86});
+        EmitRel32(label);
+    }
+
+    std::vector<UINT8> Finish() {
+        for (const auto & fixup : fixups_)
+        {
+            UINT32 rel = static_cast<UINT32>(
+                labels_[fixup.second] - static_cast<int>(fixup.first + 4));
+            for (int i = 0; i < 4; ++i)
+                code_[fixup.first + i] = static_cast<UINT8>(rel >> (8 * i));
+        }
+        return code_;
+    }
+
+private:
+    std::vector<UINT8> code_;
+    std::vector<int> labels_;
+    // (where the displacement is, the label it jumps to)
+    std::vector<std::pair<size_t, int>> fixups_;
+};
+
+// Bytes [lo, hi] lead to 'state'.
+struct ByteRange {
+    UINT32 lo;
+    UINT32 hi;
+    int state;
+};
+
+// States branching elsewhere on more ranges than this look the next state
+// up in a row of their own instead.
+static const size_t kMaxBranches = 8;
+
+// The code of JitDfa::Code, or of JitDfa::LongestCode if 'longest',
+// appended to 'a'. Registers are the same under both calling conventions,
+// as all of them are scratch: r9 is the next byte, r10 the end, eax the
+// byte read and rcx a temporary. Searching, r11 holds the stop flags and
+// r8 where the state goes. Finding the longest match, r8 holds the
+// JitDfa::Longest, and edx and r11 the last final state and where it was
+// entered, so a match costs two moves rather than a return.
+//
+// Text mostly keeps a state on one path, such as the loop back to itself
+// while nothing matches, so each state tests for the ranges leading
+// anywhere else and falls through to that path. Those branches are rarely
+// taken and predict well, where a search tree over the ranges wouldn't.
+static void Generate(Assembler & a, const DenseDfa & dfa, bool longest) {
+    size_t n = dfa.StateCount();
+    std::vector<int> state_label(n), exit_label(n), row_label(n, -1);
+    int done = a.NewLabel();
+    for (size_t s = 0; s < n; ++s)
+    {
+        state_label[s] = a.NewLabel();
+        exit_label[s] = longest ? done : a.NewLabel();
+    }
+    int dispatch = a.NewLabel();
+    int table = a.NewLabel();
+
+    if (longest)
+    {
+#ifdef _WIN32
+        // rcx, rdx, r8
+        a.Emit({0x49, 0x89, 0xC9}); // mov r9, rcx
+        a.Emit({0x49, 0x89, 0xD2}); // mov r10, rdx
+#else
+        // rdi, rsi, rdx
+        a.Emit({0x49, 0x89, 0xF9}); // mov r9, rdi
+        a.Emit({0x49, 0x89, 0xF2}); // mov r10, rsi
+        a.Emit({0x49, 0x89, 0xD0}); // mov r8, rdx
+#endif
+        a.Emit({0x41, 0x8B, 0x50, 0x04}); // mov edx, [r8 + 4]
+        a.Emit({0x4D, 0x8B, 0x58, 0x08}); // mov r11, [r8 + 8]
+    }
+    else
+    {
+#ifdef _WIN32
+        // rcx, rdx, r8, r9
+        a.Emit({0x49, 0x89, 0xD2}); // mov r10, rdx
+        a.Emit({0x4D, 0x89, 0xC3}); // mov r11, r8
+        a.Emit({0x4D, 0x89, 0xC8}); // mov r8, r9
+        a.Emit({0x49, 0x89, 0xC9}); // mov r9, rcx
+#else
+        // rdi, rsi, rdx, rcx
+        a.Emit({0x49, 0x89, 0xF9}); // mov r9, rdi
+        a.Emit({0x49, 0x89, 0xF2}); // mov r10, rsi
+        a.Emit({0x49, 0x89, 0xD3}); // mov r11, rdx
+        a.Emit({0x49, 0x89, 0xC8}); // mov r8, rcx
+#endif
+    }
+    a.Emit({0x41, 0x8B, 0x00}); // mov eax, [r8]
+    // Enter the block of state eax, through a table of offsets from it.
+    a.Bind(dispatch);
+    a.Emit({0x48, 0x8D, 0x0D}); // lea rcx, [rip + table]
+    a.EmitRel32(table);
+    a.Emit({0x48, 0x63, 0x04, 0x81}); // movsxd rax, dword [rcx + rax * 4]
+    a.Emit({0x48, 0x01, 0xC8}); // add rax, rcx
+    a.Emit({0xFF, 0xE0}); // jmp rax
+
+    std::vector<ByteRange> ranges;
+    std::vector<size_t> width(n);
+    for (size_t s = 0; s < n; ++s)
+    {
+        int state = static_cast<int>(s);
+        a.Bind(state_label[s]);
+        // The dead state falls through to its exit.
+        if (state != 0)
+        {
+            if (dfa.IsFinal(state) && longest)
+            {
+                a.Emit({0x4D, 0x89, 0xCB}); // mov r11, r9
+                a.Emit({0xBA}); // mov edx, s
+                a.Emit32(static_cast<UINT32>(s));
+            }
+            else if (dfa.IsFinal(state))
+            {
+                // cmp byte [r11 + s], 0
+                a.Emit({0x41, 0x80, 0xBB});
+                a.Emit32(static_cast<UINT32>(s));
+                a.Emit({0x00});
+                a.Jne(exit_label[s]);
+            }
+            a.Emit({0x4D, 0x39, 0xD1}); // cmp r9, r10
+            a.Je(exit_label[s]);
+            a.Emit({0x41, 0x0F, 0xB6, 0x01}); // movzx eax, byte [r9]
+            a.Emit({0x49, 0xFF, 0xC1}); // inc r9
+
+            // The state most bytes lead to is the one to fall through to.
+            ranges.clear();
+            std::fill(width.begin(), width.end(), 0);
+            for (UINT32 c = 0; c < 256; ++c)
+            {
+                int next = dfa.Next(state, c);
+                if (ranges.empty() || ranges.back().state != next)
+                    ranges.push_back({c, c, next});
+                ranges.back().hi = c;
+                ++width[next];
+            }
+            int common = static_cast<int>(
+                std::max_element(width.begin(), width.end()) - width.begin());
+            size_t branches = 0;
+            for (const ByteRange & r : ranges)
+                branches += (r.state != common);
+
+            if (branches <= kMaxBranches)
+            {
+                // Wider ranges first, as they are likelier to match.
+                std::stable_sort(ranges.begin(),
+                                 ranges.end(),
+                                 [](const ByteRange & x, const ByteRange & y) {
+                                     return x.hi - x.lo > y.hi - y.lo;
+                                 });
+                for (const ByteRange & r : ranges)
+                {
+                    if (r.state == common)
+                        continue;
+                    if (r.lo == r.hi)
+                    {
+                        a.Emit({0x3D}); // cmp eax, lo
+                        a.Emit32(r.lo);
+                        a.Je(state_label[r.state]);
+                    }
+                    else
+                    {
+                        // One unsigned compare tests lo <= eax <= hi.
+                        a.Emit({0x8D, 0x88}); // lea ecx, [rax - lo]
+                        a.Emit32(0 - r.lo);
+                        a.Emit({0x81, 0xF9}); // cmp ecx, hi - lo
+                        a.Emit32(r.hi - r.lo);
+                        a.Jbe(state_label[r.state]);
+                    }
+                }
+                a.Jmp(state_label[common]);
+            }
+            else
+            {
+                row_label[s] = a.NewLabel();
+                a.Emit({0x48, 0x8D, 0x0D}); // lea rcx, [rip + row]
+                a.EmitRel32(row_label[s]);
+                // movzx eax, word [rcx + rax * 2]
+                a.Emit({0x0F, 0xB7, 0x04, 0x41});
+                a.Jmp(dispatch);
+            }
+        }
+
+        if (longest && state == 0)
+        {
+            a.Bind(done);
+            a.Emit({0x41, 0x89, 0x50, 0x04}); // mov [r8 + 4], edx
+            a.Emit({0x4D, 0x89, 0x58, 0x08}); // mov [r8 + 8], r11
+            a.Emit({0x4C, 0x89, 0xC8}); // mov rax, r9
+            a.Emit({0xC3}); // ret
+        }
+        else if (!longest)
+        {
+            a.Bind(exit_label[s]);
+            a.Emit({0x41, 0xC7, 0x00}); // mov dword [r8], s
+            a.Emit32(static_cast<UINT32>(s));
+            a.Emit({0x4C, 0x89, 0xC8}); // mov rax, r9
+            a.Emit({0xC3}); // ret
+        }
+    }
+
+    // Data follows the code: the next state of each byte for the states
+    // with rows, then the offset of each state's block from the table.
+    while (a.Size() % 4 != 0)
+        a.Emit({0xCC}); // int3
+    for (size_t s = 0; s < n; ++s)
+    {
+        if (row_label[s] < 0)
+            continue;
+        a.Bind(row_label[s]);
+        for (UINT32 c = 0; c < 256; ++c)
+        {
+            int next = dfa.Next(static_cast<int>(s), c);
+            a.Emit({static_cast<UINT8>(next), static_cast<UINT8>(next >> 8)});
+        }
+    }
+    a.Bind(table);
+    for (size_t s = 0; s < n; ++s)
+    {
+        a.Emit32(static_cast<UINT32>(a.Offset(state_label[s]) -
+                                     a.Offset(table)));
+    }
+}
+
+std::shared_ptr<const JitDfa> JitDfa::Compile(const DenseDfa & dfa) {
+#ifdef RE_JIT_X64
+    // Both entry points share one mapping.
+    Assembler a;
+    Generate(a, dfa, false);
+    while (a.Size() % 16 != 0)
+        a.Emit({0xCC}); // int3
+    size_t longest = a.Size();
+    Generate(a, dfa, true);
+    std::vector<UINT8> code = a.Finish();
+    // Written, then made executable, never both at once.
+#ifdef _WIN32
+    void * memory = VirtualAlloc(
+        nullptr, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (memory == nullptr)
+        return nullptr;
+    std::memcpy(memory, code.data(), code.size());
+    DWORD old;
+    if (!VirtualProtect(memory, code.size(), PAGE_EXECUTE_READ, &old))
+    {
+        VirtualFree(memory, 0, MEM_RELEASE);
+        return nullptr;
+    }
+    FlushInstructionCache(GetCurrentProcess(), memory, code.size());
+#else
+    void * memory = mmap(nullptr,
+                         code.size(),
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1,
+                         0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, code.size());
+        return nullptr;
+    }
+#endif
+    std::shared_ptr<JitDfa> jit(new JitDfa());
+    jit->memory_ = memory;
+    jit->size_ = code.size();
+    jit->code_ = reinterpret_cast<Code>(memory);
+    jit->longest_ = reinterpret_cast<LongestCode>(
+        static_cast<UINT8 *>(memory) + longest);
+    return jit;
+#else
+    (void)dfa;
+    return nullptr;
+#endif
+}
+
+JitDfa::~JitDfa() {
+#ifdef _WIN32
+    VirtualFree(memory_, 0, MEM_RELEASE);
+#else
+    munmap(memory_, size_);
+#endif
+}
+
+size_t JitDfa::Run(RByteView text,
+                   size_t pos,
+                   int * state,
+                   const UINT8 * stop) const {
+    const UINT8 * begin = reinterpret_cast<const UINT8 *>(text.data());
+    UINT32 s = static_cast<UINT32>(*state);
+    const UINT8 * end = code_(begin + pos, begin + text.size(), stop, &s);
+    *state = static_cast<int>(s);
+    return static_cast<size_t>(end - begin);
+}
+
+size_t JitDfa::RunLongest(RByteView text,
+                          size_t pos,
+                          int state,
+                          int * last,
+                          size_t * end) const {
+    // The code loads and stores the match at [r8 + 4] and [r8 + 8].
+    static_assert(offsetof(Longest, last_state) == 4 &&
+                      offsetof(Longest, last) == 8,
+                  "Longest layout");
+    const UINT8 * begin = reinterpret_cast<const UINT8 *>(text.data());
+    Longest longest = {static_cast<UINT32>(state),
+                       static_cast<UINT32>(*last),
+                       begin + (*last != 0 ? *end : pos)};
+    const UINT8 * read = longest_(begin + pos, begin + text.size(), &longest);
+    *last = static_cast<int>(longest.last_state);
+    if (*last != 0)
+        *end = static_cast<size_t>(longest.last - begin);
+    return static_cast<size_t>(read - begin);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "IntType.h"
+#include "RegexSyntax.h"
+
+#include <memory>
+
+class DenseDfa;
+
+/*
+ * A DenseDfa compiled to x86-64 machine code, for UTF-8 text.
+ *
+ * Each state is a block of code that reads a byte and picks the next state
+ * by comparing it against the byte ranges leading elsewhere, so the inner
+ * loop has no table lookups and no dispatch. The code runs until a state
+ * the caller wants to stop at, or the end of the text; the caller handles
+ * matches there and carries on. A second entry point runs to the dead
+ * state, keeping the last match in registers on the way, for the longest
+ * match. Only built on x86-64, and only when the system lets us map
+ * executable memory: callers keep the DenseDfa to fall back on.
+ */
+
+class JitDfa {
+public:
+    // Null where there is no JIT, or if the code can't be mapped.
+    static std::shared_ptr<const JitDfa> Compile(const DenseDfa & dfa);
+
+    ~JitDfa();
+    JitDfa(const JitDfa &) = delete;
+    JitDfa & operator=(const JitDfa &) = delete;
+
+    // Runs the DFA from '*state' over 'text' from 'pos', until it enters a
+    // state 's' with 'stop[s]' set, checked before each byte, or reaches
+    // the end. Returns where it stopped, with the state there in '*state'.
+    // The dead state 0 always stops.
+    size_t Run(RByteView text,
+               size_t pos,
+               int * state,
+               const UINT8 * stop) const;
+    // Runs the DFA from 'state' over 'text' from 'pos' until the dead
+    // state or the end, and returns where it stopped. '*last' holds the
+    // last final state entered so far, or 0, and '*end' where; they
+    // receive the last one entered by the time it stopped.
+    size_t RunLongest(RByteView text,
+                      size_t pos,
+                      int state,
+                      int * last,
+                      size_t * end) const;
+
+private:
+    typedef const UINT8 * (*Code)(const UINT8 * begin,
+                                  const UINT8 * end,
+                                  const UINT8 * stop,
+                                  UINT32 * state);
+    // In and out of LongestCode: the state to start from, and the last
+    // final state and where it was entered.
+    struct Longest {
+        UINT32 state;
+        UINT32 last_state;
+        const UINT8 * last;
+    };
+    typedef const UINT8 * (*LongestCode)(const UINT8 * begin,
+                                         const UINT8 * end,
+                                         Longest * longest);
+
+    JitDfa() = default;
+
+    void * memory_;
+    size_t size_;
+    Code code_;
+    LongestCode longest_;
+};
@@ -0,0 +1,92 @@
+#include "stdafx.h"
+
+#include "Lexer.h"
+#include "RegexCompiler.h"
+#include "util.h"
+
+Lexer::Lexer(const std::vector<std::pair<RString, int>> & rules,
+             MatchOptions options)
+    : utf8_(options.utf8) {
+    RAssert(!rules.empty());
+    std::vector<std::shared_ptr<const Program>> programs;
+    for (const auto & rule : rules)
+    {
+        EnfaMatcher enfa = RegexCompiler::CompileToEnfa(rule.first, options);
+        RAssert(enfa.dfa_);
+        programs.push_back(enfa.program_);
+        ids_.push_back(rule.second);
+    }
+    std::vector<const Program *> union_of;
+    for (const auto & program : programs)
+        union_of.push_back(program.get());
+    auto program = std::make_shared<Program>(union_of);
+    dfa_ = std::make_shared<DfaMatcher>(program);
+    dense_ = DenseDfa::Build(*program, false, false, options.jit);
+}
+
+bool Lexer::Tokenize(RView text, std::vector<Token> * tokens) const {
+    TokenIterator it(*this, text);
+    while (it.HasNext())
+        tokens->push_back(it.Next());
+    return it.Pos() == text.size();
+}
+
+bool Lexer::Tokenize(RByteView text, std::vector<Token> * tokens) const {
+    ByteTokenIterator it(*this, text);
+    while (it.HasNext())
+        tokens->push_back(it.Next());
+    return it.Pos() == text.size();
+}
+
+bool Lexer::IsJitted() const {
+    return dense_ && dense_->IsJitted();
+}
+
+template <typename CharT>
+BasicTokenIterator<CharT>::BasicTokenIterator(const Lexer & lexer,
+                                              StringView<CharT> text)
+    : lexer_(&lexer)
+    , scratch_(*lexer.dfa_)
+    , text_(text)
+    , pos_(0)
+    , has_next_(false) {
+    // Bytes only make sense to rules lowered to UTF-8.
+    RAssert(lexer.utf8_ == (sizeof(CharT) == 1));
+}
+
+template <typename CharT>
+bool BasicTokenIterator<CharT>::HasNext() {
+    if (!has_next_ && pos_ < text_.size())
+    {
+        size_t end;
+        UINT32 rule;
+        bool matched = (lexer_->dense_
+                            ? lexer_->dense_->LongestMatch(
+                                  text_, pos_, &end, &rule)
+                            : lexer_->dfa_->LongestMatch(
+                                  text_, pos_, &end, &rule, &scratch_));
+        // Empty matches don't make tokens.
+        if (matched && end > pos_)
+        {
+            next_ = {lexer_->ids_[rule], pos_, end - pos_};
+            has_next_ = true;
+            pos_ = end;
+        }
+    }
+    return has_next_;
+}
+
+template <typename CharT>
+Token BasicTokenIterator<CharT>::Next() {
+    RAssert(HasNext());
+    has_next_ = false;
+    return next_;
+}
+
+template <typename CharT>
+size_t BasicTokenIterator<CharT>::Pos() const {
+    return pos_;
+}
+
+template class BasicTokenIterator<RChar>;
+template class BasicTokenIterator<RByte>;
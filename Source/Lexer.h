@@ -0,0 +1,71 @@
+#pragma once
+
+#include "DenseDfa.h"
+#include "DfaMatcher.h"
+#include "EnfaMatcher.h"
+#include "RegexSyntax.h"
+
+/*
+ * Tokenizer over an ordered list of rules, each a pattern and a token id.
+ *
+ * The rules are joined into one union Program run by the DFA, a dense
+ * minimized one when it is small enough. Each token is the longest text any
+ * rule matches from where the last one ended, taking the first rule when
+ * several match that much (maximal munch). Rules must be DFA compatible: no
+ * back references, look-around, atomic groups or counted repeats too large
+ * to unroll.
+ */
+
+struct Token {
+    int id;
+    size_t offset;
+    size_t length;
+};
+
+class Lexer {
+    template <typename CharT>
+    friend class BasicTokenIterator;
+
+public:
+    Lexer(const std::vector<std::pair<RString, int>> & rules,
+          MatchOptions options = MatchOptions());
+
+    // Every token of 'text'. Fails where no rule matches a non-empty
+    // prefix of the rest, with the tokens before that in '*tokens'.
+    bool Tokenize(RView text, std::vector<Token> * tokens) const;
+    bool Tokenize(RByteView text, std::vector<Token> * tokens) const;
+    // The DFA runs as machine code, see MatchOptions::jit.
+    bool IsJitted() const;
+
+private:
+    std::shared_ptr<const DfaMatcher> dfa_;
+    // Set when the rules' DFA is small enough to build in full.
+    std::shared_ptr<const DenseDfa> dense_;
+    std::vector<int> ids_;
+    bool utf8_;
+};
+
+// Tokens of one text, found one at a time.
+template <typename CharT>
+class BasicTokenIterator {
+public:
+    // 'lexer' must outlive this.
+    BasicTokenIterator(const Lexer & lexer, StringView<CharT> text);
+
+    bool HasNext();
+    Token Next();
+    // Where tokenizing stopped: the end of text, unless no rule matches
+    // there.
+    size_t Pos() const;
+
+private:
+    const Lexer * lexer_;
+    DfaMatcher::Scratch scratch_;
+    StringView<CharT> text_;
+    size_t pos_;
+    bool has_next_;
+    Token next_;
+};
+
+typedef BasicTokenIterator<RChar> TokenIterator;
+typedef BasicTokenIterator<RByte> ByteTokenIterator;
@@ -2,15 +2,18 @@
 
 #include "RegexSyntax.h"
 
-class CaptureGroup {
+template <typename CharT>
+class BasicCaptureGroup {
 public:
-    explicit CaptureGroup(RView origin)
+    typedef StringView<CharT> View;
+
+    explicit BasicCaptureGroup(View origin)
         : origin_(origin)
         , need_begin_(true) {
     }
 
     // access functions
-    RView GetLast() const {
+    View GetLast() const {
         auto range = GetLastRange();
         return origin_.subview(range.first, range.second - range.first);
     }
@@ -46,21 +49,25 @@ private:
         return need_begin_;
     }
 
-    RView origin_;
+    View origin_;
     bool need_begin_;
     std::vector<std::pair<size_t, size_t>> captured_;
     std::vector<std::pair<bool, size_t>> events_;
 };
 
-class Capture {
+template <typename CharT>
+class BasicCapture {
 public:
-    typedef std::map<size_t, CaptureGroup>::const_iterator group_iterator;
+    typedef StringView<CharT> View;
+    typedef BasicCaptureGroup<CharT> CaptureGroup;
+    typedef typename std::map<size_t, CaptureGroup>::const_iterator
+        group_iterator;
 
-    explicit Capture(RView origin)
+    explicit BasicCapture(View origin)
         : origin_(origin) {
     }
 
-    RView Origin() const {
+    View Origin() const {
         return origin_;
     }
     group_iterator GroupBegin() const {
@@ -73,11 +80,6 @@ public:
         assert(group_id < capture_groups_.size());
         return capture_groups_.at(group_id);
     }
-    void CopyTo(Capture & c) const {
-        c.~Capture();
-        ::new (&c) Capture(origin_);
-        c.capture_groups_ = capture_groups_;
-    }
 
     void DoCapture(size_t group_id, size_t pos, bool is_begin) {
         if (capture_groups_.find(group_id) == capture_groups_.end())
@@ -92,8 +94,10 @@ public:
             s += std::to_wstring(kv.first) + L":";
             for (const auto & range : kv.second.captured())
             {
+                View text =
+                    origin_.subview(range.first, range.second - range.first);
                 s += L" \"";
-                s += origin_.substr(range.first, range.second - range.first);
+                s.append(text.begin(), text.end());
                 s += L"\"";
             }
             s += L"\n";
@@ -116,25 +120,35 @@ public:
     }
 
 private:
-    RView origin_;
+    View origin_;
     std::map<size_t, CaptureGroup> capture_groups_;
 };
 
-class MatchResult {
+template <typename CharT>
+class BasicMatchResult {
 public:
-    MatchResult(const ::Capture & capture, bool matched)
-        : capture_(capture)
-        , matched_(matched) {
+    typedef BasicCapture<CharT> Capture;
+
+    BasicMatchResult(const Capture & capture, bool matched)
+        : matched_(matched)
+        , capture_(capture) {
     }
 
     bool Matched() const {
         return matched_;
     }
-    const ::Capture & GetCapture() const {
+    const Capture & GetCapture() const {
         return capture_;
     }
 
 private:
     bool matched_;
-    ::Capture capture_;
+    Capture capture_;
 };
+
+typedef BasicCaptureGroup<RChar> CaptureGroup;
+typedef BasicCapture<RChar> Capture;
+typedef BasicMatchResult<RChar> MatchResult;
+
+typedef BasicCapture<RByte> ByteCapture;
+typedef BasicMatchResult<RByte> ByteMatchResult;
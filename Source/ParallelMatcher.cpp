@@ -0,0 +1,158 @@
+#include "stdafx.h"
+
+#include "Input.h"
+#include "ParallelMatcher.h"
+
+#include <atomic>
+#include <thread>
+
+// More chunks than threads, so threads that finish early take over the
+// rest.
+static const size_t kChunksPerThread = 4;
+// Smaller chunks aren't worth the overhead.
+static const size_t kMinChunkSize = 64 * 1024;
+static const size_t kNoPos = static_cast<size_t>(-1);
+
+template <typename CharT>
+struct ChunkResult {
+    // matches[i] was found searching from from[i]: no match starts between
+    // the two.
+    std::vector<size_t> from;
+    std::vector<BasicMatchResult<CharT>> matches;
+    // No match starts from here to the end of the chunk, or kNoPos if the
+    // last match ran past the end.
+    size_t clear_from;
+};
+
+template <typename CharT>
+static size_t MatchBegin(const BasicMatchResult<CharT> & m) {
+    return m.GetCapture().Group(0).GetLastRange().first;
+}
+
+// Where the search after 'm' starts, as in BasicMatchIterator.
+template <typename CharT>
+static size_t NextSearchPos(StringView<CharT> text,
+                            const BasicMatchResult<CharT> & m) {
+    auto range = m.GetCapture().Group(0).GetLastRange();
+    return (range.first == range.second ? NextCharPos(text, range.first)
+                                        : range.second);
+}
+
+// Matches starting in [begin, end), found as if a sequential search
+// reached 'begin'. Past 'end', only what such a match can reach is read.
+template <typename CharT>
+static void SearchChunk(const EnfaMatcher & matcher,
+                        StringView<CharT> text,
+                        size_t begin,
+                        size_t end,
+                        MatchScratch * scratch,
+                        ChunkResult<CharT> * result) {
+    result->clear_from = kNoPos;
+    for (size_t pos = begin; pos < end;)
+    {
+        BasicMatchResult<CharT> m = matcher.Search(text, pos, scratch, end);
+        if (!m.Matched())
+        {
+            result->clear_from = pos;
+            break;
+        }
+        result->from.push_back(pos);
+        result->matches.push_back(m);
+        pos = NextSearchPos(text, m);
+    }
+}
+
+template <typename CharT>
+static std::vector<BasicMatchResult<CharT>> MatchAllParallel(
+    const EnfaMatcher & matcher, StringView<CharT> text, size_t threads) {
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t chunk_size = std::max(
+        kMinChunkSize, text.size() / (threads * kChunksPerThread) + 1);
+    size_t chunk_count = text.size() / chunk_size + 1;
+    threads = std::min(threads, chunk_count);
+    if (threads == 1)
+        return matcher.MatchAll(text);
+
+    // The last chunk also holds the end of text, where an empty match may
+    // start.
+    auto chunk_end = [&](size_t i) {
+        return (i + 1 < chunk_count ? (i + 1) * chunk_size : text.size() + 1);
+    };
+    std::vector<ChunkResult<CharT>> results(chunk_count);
+    std::atomic<size_t> next_chunk(0);
+    auto work = [&]() {
+        MatchScratch scratch(matcher);
+        for (size_t i; (i = next_chunk++) < chunk_count;)
+        {
+            SearchChunk(matcher,
+                        text,
+                        i * chunk_size,
+                        chunk_end(i),
+                        &scratch,
+                        &results[i]);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < threads; ++i)
+        pool.emplace_back(work);
+    for (std::thread & t : pool)
+        t.join();
+
+    std::vector<BasicMatchResult<CharT>> matches;
+    // The next search starts at 'pos'. No match starts in [pos, clear_to).
+    size_t pos = 0;
+    size_t clear_to = 0;
+    auto take = [&](const BasicMatchResult<CharT> & m) {
+        matches.push_back(m);
+        pos = clear_to = NextSearchPos(text, m);
+    };
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        const ChunkResult<CharT> & r = results[i];
+        for (size_t j = 0; j < r.matches.size();)
+        {
+            size_t begin = MatchBegin(r.matches[j]);
+            if (begin < pos)
+            {
+                ++j;
+                continue;
+            }
+            if (r.from[j] <= clear_to)
+                clear_to = std::max(clear_to, begin);
+            if (clear_to >= begin)
+            {
+                take(r.matches[j++]);
+                continue;
+            }
+            // A match straddling the chunk boundary left the chunk out of
+            // step: search sequentially until it's back in step.
+            BasicMatchResult<CharT> m = matcher.Search(text, pos);
+            if (!m.Matched())
+                return matches;
+            take(m);
+        }
+        if (r.clear_from <= clear_to)
+            clear_to = std::max(clear_to, chunk_end(i));
+    }
+    while (pos <= text.size() && clear_to <= text.size())
+    {
+        BasicMatchResult<CharT> m = matcher.Search(text, pos);
+        if (!m.Matched())
+            break;
+        take(m);
+    }
+    return matches;
+}
+
+std::vector<MatchResult> ParallelMatchAll(const EnfaMatcher & matcher,
+                                          RView text,
+                                          size_t threads) {
+    return MatchAllParallel(matcher, text, threads);
+}
+
+std::vector<ByteMatchResult> ParallelMatchAll(const EnfaMatcher & matcher,
+                                              RByteView text,
+                                              size_t threads) {
+    return MatchAllParallel(matcher, text, threads);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "EnfaMatcher.h"
+#include "RegexSyntax.h"
+
+/*
+ * MatchAll on several threads.
+ *
+ * The text is cut into more chunks than threads, which idle threads take
+ * in turn. Each chunk collects the matches starting in it, searching on
+ * past its end as needed, and notes the spans where it saw no match start.
+ * Merging the chunks in order keeps a match if those spans show that a
+ * sequential MatchAll would have found it as well. Otherwise the gap is
+ * searched again sequentially; that only happens where a match straddles
+ * a chunk boundary.
+ */
+
+// The matches matcher.MatchAll(text) finds, using up to 'threads' threads.
+std::vector<MatchResult> ParallelMatchAll(const EnfaMatcher & matcher,
+                                          RView text,
+                                          size_t threads);
+std::vector<ByteMatchResult> ParallelMatchAll(const EnfaMatcher & matcher,
+                                              RByteView text,
+                                              size_t threads);
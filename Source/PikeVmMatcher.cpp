@@ -0,0 +1,192 @@
+#include "stdafx.h"
+
+#include "PikeVmMatcher.h"
+#include "util.h"
+
+static const size_t kNoPos = static_cast<size_t>(-1);
+
+PikeVmMatcher::ThreadList::ThreadList(size_t pc_count, size_t slot_count)
+    : size_(0)
+    , slot_count_(slot_count)
+    , dense_(pc_count)
+    , sparse_(pc_count)
+    , slots_(pc_count * slot_count) {
+}
+
+bool PikeVmMatcher::ThreadList::Contains(int pc) const {
+    size_t i = sparse_[pc];
+    return i < size_ && dense_[i] == pc;
+}
+
+void PikeVmMatcher::ThreadList::Add(int pc) {
+    sparse_[pc] = size_;
+    dense_[size_++] = pc;
+}
+
+void PikeVmMatcher::ThreadList::SetSlots(int pc,
+                                         const std::vector<size_t> & slots) {
+    std::copy(slots.begin(), slots.end(), slots_.begin() + pc * slot_count_);
+}
+
+PikeVmMatcher::PikeVmMatcher(std::shared_ptr<const Program> program,
+                             size_t capture_count)
+    : program_(program)
+    , capture_count_(capture_count) {
+}
+
+PikeVmMatcher::Scratch::Scratch(const PikeVmMatcher & pike_vm)
+    : program_(pike_vm.program_.get())
+    , clist_(pike_vm.program_->Size(), pike_vm.capture_count_ * 2)
+    , nlist_(pike_vm.program_->Size(), pike_vm.capture_count_ * 2)
+    , slots_(pike_vm.capture_count_ * 2)
+    , matched_(pike_vm.capture_count_ * 2) {
+}
+
+// Follow epsilon moves from 'pc', adding threads in priority order.
+// 'slots' is restored before returning, 'stack' is left empty.
+void PikeVmMatcher::AddThread(ThreadList & list,
+                              int pc,
+                              size_t pos,
+                              std::vector<size_t> & slots,
+                              std::vector<AddEntry> & stack) const {
+    const Program & prog = *program_;
+    stack.push_back({pc, 0});
+    while (!stack.empty())
+    {
+        AddEntry e = stack.back();
+        stack.pop_back();
+        if (e.pc < 0)
+        {
+            slots[-e.pc - 1] = e.value;
+            continue;
+        }
+        if (list.Contains(e.pc))
+            continue;
+
+        list.Add(e.pc);
+        const Inst & inst = prog[e.pc];
+        switch (inst.op)
+        {
+            case Inst::SAVE:
+                stack.push_back({-static_cast<int>(inst.arg) - 1,
+                                 slots[inst.arg]});
+                slots[inst.arg] = pos;
+                stack.push_back({e.pc + 1, 0});
+                break;
+            case Inst::JMP:
+                stack.push_back({inst.x, 0});
+                break;
+            case Inst::SPLIT:
+                stack.push_back({inst.y, 0});
+                stack.push_back({inst.x, 0});
+                break;
+            case Inst::CHAR:
+            case Inst::MATCH:
+                list.SetSlots(e.pc, slots);
+                break;
+            default:
+                RAssert(false);
+                break;
+        }
+    }
+}
+
+template <typename CharT>
+BasicMatchResult<CharT> PikeVmMatcher::ToMatchResult(
+    StringView<CharT> text, const size_t * slots) const {
+    BasicCapture<CharT> capture(text);
+    for (size_t i = 0; i < capture_count_; ++i)
+    {
+        if (slots[i * 2] != kNoPos && slots[i * 2 + 1] != kNoPos)
+        {
+            capture.DoCapture(i, slots[i * 2], true);
+            capture.DoCapture(i, slots[i * 2 + 1], false);
+        }
+    }
+    return BasicMatchResult<CharT>(capture, true);
+}
+
+template <typename CharT>
+BasicMatchResult<CharT> PikeVmMatcher::Run(StringView<CharT> text,
+                                           size_t begin,
+                                           size_t end,
+                                           Mode mode,
+                                           Scratch * scratch) const {
+    RAssert(scratch->program_ == program_.get());
+    const Program & prog = *program_;
+    size_t slot_count = capture_count_ * 2;
+    ThreadList & clist = scratch->clist_;
+    ThreadList & nlist = scratch->nlist_;
+    std::vector<size_t> & slots = scratch->slots_;
+    std::vector<size_t> & matched = scratch->matched_;
+    std::vector<AddEntry> & stack = scratch->stack_;
+    clist.Clear();
+    nlist.Clear();
+    bool found = false;
+
+    for (size_t pos = begin;; ++pos)
+    {
+        // A thread started here has the lowest priority.
+        if (pos == begin || (mode == SEARCH && !found))
+        {
+            std::fill(slots.begin(), slots.end(), kNoPos);
+            AddThread(clist, 0, pos, slots, stack);
+        }
+
+        bool at_end = (pos == end);
+        for (size_t i = 0; i < clist.Size(); ++i)
+        {
+            int pc = clist.Pc(i);
+            const Inst & inst = prog[pc];
+            if (inst.op == Inst::MATCH)
+            {
+                if (mode == WHOLE && !at_end)
+                    continue;
+                std::copy(clist.Slots(pc),
+                          clist.Slots(pc) + slot_count,
+                          matched.begin());
+                found = true;
+                // Lower priority threads can't produce a better match.
+                break;
+            }
+            if (inst.op == Inst::CHAR && !at_end &&
+                inst.arg == CodeUnit(text[pos]))
+            {
+                std::copy(
+                    clist.Slots(pc), clist.Slots(pc) + slot_count, slots.begin());
+                AddThread(nlist, inst.x, pos + 1, slots, stack);
+            }
+        }
+        if (at_end || (nlist.Size() == 0 && (mode != SEARCH || found)))
+            break;
+        std::swap(clist, nlist);
+        nlist.Clear();
+    }
+
+    if (!found)
+        return BasicMatchResult<CharT>(BasicCapture<CharT>(text), false);
+    return ToMatchResult(text, matched.data());
+}
+
+template <typename CharT>
+BasicMatchResult<CharT> PikeVmMatcher::Match(StringView<CharT> text,
+                                             Scratch * scratch) const {
+    return Run(text, 0, text.size(), WHOLE, scratch);
+}
+
+template <typename CharT>
+BasicMatchResult<CharT> PikeVmMatcher::Search(StringView<CharT> text,
+                                              size_t from,
+                                              size_t end,
+                                              Scratch * scratch) const {
+    return Run(text, from, end, SEARCH, scratch);
+}
+
+template MatchResult PikeVmMatcher::Match(RView, Scratch *) const;
+template ByteMatchResult PikeVmMatcher::Match(RByteView, Scratch *) const;
+template MatchResult PikeVmMatcher::Search(RView, size_t, size_t, Scratch *)
+    const;
+template ByteMatchResult PikeVmMatcher::Search(RByteView,
+                                               size_t,
+                                               size_t,
+                                               Scratch *) const;
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "MatchResult.h"
+#include "Program.h"
+#include "StringView.h"
+
+/*
+ * Pike VM: breadth-first simulation of a Program.
+ *
+ * All threads advance in lockstep over the input, at most one thread per
+ * instruction, so matching takes O(text * program) time. Captures are kept
+ * in fixed-size slot arrays and only the last capture of each group is
+ * reported. The program must satisfy the same restrictions as DfaMatcher.
+ *
+ * The thread lists live in a Scratch, reused from one call to the next.
+ */
+
+class PikeVmMatcher {
+public:
+    class Scratch;
+
+    PikeVmMatcher(std::shared_ptr<const Program> program,
+                  size_t capture_count);
+
+    template <typename CharT>
+    BasicMatchResult<CharT> Match(StringView<CharT> text,
+                                  Scratch * scratch) const;
+    // Leftmost match starting in [from, end], not reading past 'end'.
+    template <typename CharT>
+    BasicMatchResult<CharT> Search(StringView<CharT> text,
+                                   size_t from,
+                                   size_t end,
+                                   Scratch * scratch) const;
+
+private:
+    // Threads of one step: a sparse set of pcs with a slot array for each
+    // of them.
+    class ThreadList {
+    public:
+        ThreadList(size_t pc_count, size_t slot_count);
+
+        bool Contains(int pc) const;
+        void Add(int pc);
+        void SetSlots(int pc, const std::vector<size_t> & slots);
+        void Clear() {
+            size_ = 0;
+        }
+        size_t Size() const {
+            return size_;
+        }
+        int Pc(size_t i) const {
+            return dense_[i];
+        }
+        const size_t * Slots(int pc) const {
+            return &slots_[pc * slot_count_];
+        }
+
+    private:
+        size_t size_;
+        size_t slot_count_;
+        std::vector<int> dense_;
+        std::vector<size_t> sparse_;
+        std::vector<size_t> slots_;
+    };
+
+    enum Mode {
+        WHOLE,
+        SEARCH,
+    };
+
+    // Entries of the AddThread() stack with pc < 0 restore slot (-pc - 1)
+    // to 'value'.
+    struct AddEntry {
+        int pc;
+        size_t value;
+    };
+
+    template <typename CharT>
+    BasicMatchResult<CharT> Run(StringView<CharT> text,
+                                size_t begin,
+                                size_t end,
+                                Mode mode,
+                                Scratch * scratch) const;
+    void AddThread(ThreadList & list,
+                   int pc,
+                   size_t pos,
+                   std::vector<size_t> & slots,
+                   std::vector<AddEntry> & stack) const;
+    template <typename CharT>
+    BasicMatchResult<CharT> ToMatchResult(StringView<CharT> text,
+                                          const size_t * slots) const;
+
+    std::shared_ptr<const Program> program_;
+    size_t capture_count_;
+};
+
+// Thread lists and slot arrays, for one thread at a time.
+class PikeVmMatcher::Scratch {
+public:
+    explicit Scratch(const PikeVmMatcher & pike_vm);
+
+private:
+    friend class PikeVmMatcher;
+
+    const Program * program_;
+    ThreadList clist_;
+    ThreadList nlist_;
+    std::vector<size_t> slots_;
+    std::vector<size_t> matched_;
+    std::vector<AddEntry> stack_;
+};
@@ -63,15 +63,40 @@ public:
         , lookaround_id_gen_(0)
         , atomic_id_gen_(0)
         , repeat_id_gen_(0)
+        , error_pos_(RString::npos)
+        , max_backref_id_(0)
+        , max_backref_pos_(0)
         , regex_(regex) {
     }
     std::vector<PostfixNode> Parse() {
         group();
+        // The whole pattern is one group.
+        Expect(AtEnd());
+        // A back reference may come before its group, but the group must
+        // exist.
+        if (!Failed() && max_backref_id_ >= (size_t)capture_id_gen_)
+            error_pos_ = max_backref_pos_;
         return nl_;
     }
+    // Where the syntax first broke, or RString::npos.
+    size_t ErrorPos() const {
+        return error_pos_;
+    }
 
 private:
-    // TODO: check regex_ boundary.
+    bool AtEnd() const {
+        return regex_.CurrentPos() >= regex_.Origin().size();
+    }
+    // Records the first syntax error; nothing is parsed after it.
+    bool Expect(bool ok) {
+        if (!ok && error_pos_ == RString::npos)
+            error_pos_ = regex_.CurrentPos();
+        return ok;
+    }
+    bool Failed() const {
+        return error_pos_ != RString::npos;
+    }
+
     void repeat() {
         if (regex_.Match('*'))
         {
@@ -93,15 +118,18 @@ private:
             }
             else
             {
-                RAssert(regex_.Match(','));
+                if (!Expect(regex_.Match(',')))
+                    return;
 
                 if (regex_.MatchUInt32(&r.max))
                 {
                     r.has_max = true;
-                    RAssert(r.max >= r.min);
+                    if (!Expect(r.max >= r.min))
+                        return;
                 }
 
-                RAssert(regex_.Match('}'));
+                if (!Expect(regex_.Match('}')))
+                    return;
             }
             if (regex_.Match('?'))
                 r.qualifier = Repeat::RELUCTANT;
@@ -109,64 +137,61 @@ private:
             nl_.emplace_back(r);
         }
         // prohibit nested repeat
-        RAssert(!regex_.TryMatchAny(L"{*"));
+        Expect(!regex_.TryMatchAny(L"{*"));
     }
     bool item() {
+        if (Failed())
+            return false;
         if (regex_.Match('\\'))
         {
             size_t backref_id = 10;
-            RAssert(regex_.MatchUInt32(&backref_id));
-            RAssert(backref_id <= 9);
+            size_t pos = regex_.CurrentPos();
+            if (!Expect(regex_.MatchUInt32(&backref_id) && backref_id <= 9))
+                return false;
+            if (backref_id > max_backref_id_)
+                max_backref_id_ = backref_id, max_backref_pos_ = pos;
             BackReference b = {(int)backref_id};
             nl_.emplace_back(b);
             repeat();
-            return true;
         }
         else if (regex_.TryMatch('('))
         {
             group();
             repeat();
-            return true;
         }
         else
         {
             // TODO: check not special char
-            if (!regex_.TryMatchAny(L"|)"))
-            {
-                nl_.emplace_back(regex_.GetChar());
-                repeat();
-                return true;
-            }
-            else
+            if (regex_.TryMatchAny(L"|)") || !Expect(!AtEnd()))
                 return false;
+            nl_.emplace_back(regex_.GetChar());
+            repeat();
         }
+        return !Failed();
     }
     void concat() {
-        RAssert(item());
+        if (!Expect(item()))
+            return;
         while (item())
             nl_.emplace_back(PostfixNode::CONCAT);
     }
-    void alter() {
+    void branch() {
         if (regex_.TryMatchAny(L"|)"))
-        {
             nl_.emplace_back(PostfixNode::NULL_INPUT);
-            return;
-        }
-
-        concat();
-        while (regex_.Match('|'))
-        {
-            if (regex_.TryMatchAny(L"|)"))
-            {
-                nl_.emplace_back(PostfixNode::NULL_INPUT);
-                continue;
-            }
+        else
             concat();
+    }
+    void alter() {
+        branch();
+        while (!Failed() && regex_.Match('|'))
+        {
+            branch();
             nl_.emplace_back(PostfixNode::ALTER);
         }
     }
     void group() {
-        RAssert(regex_.Match('('));
+        if (!Expect(regex_.Match('(')))
+            return;
 
         Group g;
 
@@ -183,22 +208,61 @@ private:
             g.capture_id = capture_id_gen_++;
 
         alter();
+        if (Failed())
+            return;
 
         nl_.emplace_back(g);
 
-        RAssert(regex_.Match(')'));
+        Expect(regex_.Match(')'));
     }
 
     int capture_id_gen_;
     int lookaround_id_gen_;
     int atomic_id_gen_;
     int repeat_id_gen_;
+    size_t error_pos_;
+    size_t max_backref_id_;
+    size_t max_backref_pos_;
     LexMatcher regex_;
     std::vector<PostfixNode> nl_;
 };
 
 std::vector<PostfixNode> ParseToPostfix(RString regex) {
-    return PostfixParser(regex.data()).Parse();
+    PostfixParser parser(regex.data());
+    std::vector<PostfixNode> nl = parser.Parse();
+    RAssert(parser.ErrorPos() == RString::npos);
+    return nl;
+}
+
+size_t FindSyntaxError(RString regex) {
+    PostfixParser parser(regex.data());
+    parser.Parse();
+    return parser.ErrorPos();
+}
+
+std::vector<PostfixNode> EncodeUtf8(const std::vector<PostfixNode> & nl) {
+    std::vector<PostfixNode> encoded;
+    for (const PostfixNode & n : nl)
+    {
+        UINT32 c = (n.type == PostfixNode::CHAR_INPUT ? CodeUnit(n.chr) : 0);
+        if (c < 0x80)
+        {
+            encoded.push_back(n);
+            continue;
+        }
+        // The lead byte holds the top bits, each continuation byte 6 more.
+        size_t count = (c < 0x800 ? 2 : (c < 0x10000 ? 3 : 4));
+        static const UINT32 kLeadMarks[] = {0, 0, 0xC0, 0xE0, 0xF0};
+        encoded.emplace_back(
+            static_cast<RChar>(kLeadMarks[count] | (c >> (6 * (count - 1)))));
+        for (size_t i = count - 1; i-- > 0;)
+        {
+            encoded.emplace_back(
+                static_cast<RChar>(0x80 | ((c >> (6 * i)) & 0x3F)));
+            encoded.emplace_back(PostfixNode::CONCAT);
+        }
+    }
+    return encoded;
 }
 
 struct PostfixTreeNode {
@@ -240,57 +304,120 @@ struct PostfixTreeNode {
     }
 };
 
+// A postfix list as a tree. Nodes point into the list, or at copies the
+// tree keeps for nodes a pass makes.
+class PostfixTree {
+public:
+    explicit PostfixTree(const std::vector<PostfixNode> & nl) {
+        std::vector<PostfixTreeNode *> st;
+        for (const PostfixNode & node : nl)
+        {
+            switch (node.type)
+            {
+                case PostfixNode::NULL_INPUT:
+                case PostfixNode::CHAR_INPUT:
+                case PostfixNode::BACKREF_INPUT:
+                    st.push_back(New(&node, nullptr, nullptr));
+                    break;
+                case PostfixNode::REPEAT:
+                case PostfixNode::GROUP:
+                    st.back() = New(&node, st.back(), nullptr);
+                    break;
+                case PostfixNode::CONCAT:
+                case PostfixNode::ALTER:
+                {
+                    PostfixTreeNode * right = st.back();
+                    st.pop_back();
+                    st.back() = New(&node, st.back(), right);
+                    break;
+                }
+                default:
+                    RAssert(false);
+                    break;
+            }
+        }
+        RAssert(st.size() == 1);
+        root_ = st.back();
+    }
+
+    PostfixTreeNode * Root() const {
+        return root_;
+    }
+    void SetRoot(PostfixTreeNode * root) {
+        root_ = root;
+    }
+
+    PostfixTreeNode * New(const PostfixNode * node,
+                          PostfixTreeNode * left,
+                          PostfixTreeNode * right) {
+        alloc_.emplace_back(new PostfixTreeNode{node, left, right});
+        return alloc_.back().get();
+    }
+    PostfixTreeNode * Make(const PostfixNode & node,
+                           PostfixTreeNode * left = nullptr,
+                           PostfixTreeNode * right = nullptr) {
+        made_.push_back(node);
+        return New(&made_.back(), left, right);
+    }
+
+    std::vector<PostfixNode> ToPostfix() const {
+        std::vector<PostfixNode> nl;
+        // Nodes are emitted once both children are.
+        std::vector<std::pair<PostfixTreeNode *, bool>> stack = {
+            {root_, false}};
+        while (!stack.empty())
+        {
+            PostfixTreeNode * n = stack.back().first;
+            if (stack.back().second)
+            {
+                stack.pop_back();
+                nl.push_back(*n->node);
+                continue;
+            }
+            stack.back().second = true;
+            if (n->right)
+                stack.emplace_back(n->right, false);
+            if (n->left)
+                stack.emplace_back(n->left, false);
+        }
+        return nl;
+    }
+
+private:
+    std::vector<std::unique_ptr<PostfixTreeNode>> alloc_;
+    std::deque<PostfixNode> made_;
+    PostfixTreeNode * root_;
+};
+
 std::vector<PostfixNode> FlipPostfix(const std::vector<PostfixNode> & nl) {
-    std::vector<std::unique_ptr<PostfixTreeNode>> tree_alloc;
+    PostfixTree tree(nl);
 
-    // build tree and mark flip nodes.
-    std::vector<PostfixTreeNode *> tree;
+    // find flip nodes.
     std::vector<PostfixTreeNode *> flip;
-    for (const PostfixNode & node : nl)
+    std::vector<PostfixTreeNode *> stack = {tree.Root()};
+    while (!stack.empty())
     {
-        switch (node.type)
+        PostfixTreeNode * n = stack.back();
+        stack.pop_back();
+        if (n->node->type == PostfixNode::GROUP &&
+            n->node->group.type == Group::LOOK_BEHIND)
         {
-            case PostfixNode::CHAR_INPUT:
-            case PostfixNode::BACKREF_INPUT:
-                tree_alloc.emplace_back(
-                    new PostfixTreeNode{&node, nullptr, nullptr});
-                tree.push_back(tree_alloc.back().get());
-                break;
-            case PostfixNode::REPEAT:
-            case PostfixNode::GROUP:
-                tree_alloc.emplace_back(
-                    new PostfixTreeNode{&node, tree.back(), nullptr});
-                tree.pop_back();
-                tree.push_back(tree_alloc.back().get());
-                if (node.type == PostfixNode::GROUP &&
-                    node.group.type == Group::LOOK_BEHIND)
-                {
-                    flip.push_back(tree.back());
-                }
-                break;
-            case PostfixNode::CONCAT:
-            case PostfixNode::ALTER:
-                tree_alloc.emplace_back(new PostfixTreeNode{
-                    &node, tree[tree.size() - 2], tree[tree.size() - 1]});
-                tree.pop_back();
-                tree.pop_back();
-                tree.push_back(tree_alloc.back().get());
-                break;
-            default:
-                RAssert(false);
-                break;
+            flip.push_back(n);
         }
+        if (n->right)
+            stack.push_back(n->right);
+        if (n->left)
+            stack.push_back(n->left);
     }
 
-    RAssert(tree.size() == 1);
-    // std::wcout << L"Before:" << tree.front()->PrettyDebugString() <<
+    // std::wcout << L"Before:" << tree.Root()->PrettyDebugString() <<
     // std::endl;
 
     // do flips.
     for (PostfixTreeNode * root : flip)
     {
         RAssert(root->right == nullptr);
-        std::vector<PostfixTreeNode *> stack = {root->left};
+        stack = {root->left};
         while (!stack.empty())
         {
             PostfixTreeNode * n = stack.back();
@@ -298,6 +425,7 @@ std::vector<PostfixNode> FlipPostfix(const std::vector<PostfixNode> & nl) {
             RAssert(n);
             switch (n->node->type)
             {
+                case PostfixNode::NULL_INPUT:
                 case PostfixNode::CHAR_INPUT:
                 case PostfixNode::BACKREF_INPUT:
                     RAssert(n->left == nullptr);
@@ -329,30 +457,495 @@ std::vector<PostfixNode> FlipPostfix(const std::vector<PostfixNode> & nl) {
         }
     }
 
-    // std::wcout << L"After:" << tree.front()->PrettyDebugString() <<
+    // std::wcout << L"After:" << tree.Root()->PrettyDebugString() <<
     // std::endl;
 
-    std::vector<PostfixNode> flip_nl;
+    return tree.ToPostfix();
+}
 
-    std::vector<PostfixTreeNode *> stack = {tree.front()};
-    std::set<PostfixTreeNode *> visited;
-    while (!stack.empty())
-    {
-        PostfixTreeNode * n = stack.back();
-        if (visited.find(n) == visited.end())
+// Rewrites that keep what a pattern matches, and which match is found
+// first. Alternatives are tried in order, so only these are safe:
+//   (?:X)       -> X
+//   X{1}        -> X
+//   X{0}        -> (empty), X without groups
+//   (?:X*)*     -> X*, greedy, X not nullable
+//   (?:X?)*     -> X*, greedy, as empty iterations die
+//   X|...|X     -> X|...     later copies never match first
+//   cX|cY       -> c(?:X|Y)  adjacent branches, one way to match c
+//   XP|YP       -> (?:X|Y)P  adjacent branches
+//   X|(empty)|Y -> X|Y??     and X|(empty) -> X?
+// Concatenation and alternation chains are flattened, so recursion only
+// goes as deep as the pattern nests.
+class PostfixSimplifier {
+public:
+    explicit PostfixSimplifier(const std::vector<PostfixNode> & nl)
+        : tree_(nl)
+        , repeat_id_gen_(0)
+        , null_(PostfixNode::NULL_INPUT)
+        , concat_(PostfixNode::CONCAT)
+        , alter_(PostfixNode::ALTER) {
+        for (const PostfixNode & n : nl)
         {
-            if (n->right)
+            if (n.type == PostfixNode::REPEAT)
+            {
+                repeat_id_gen_ =
+                    std::max(repeat_id_gen_, n.repeat.repeat_id + 1);
+            }
+        }
+    }
+
+    std::vector<PostfixNode> Simplify() {
+        tree_.SetRoot(Simplify(tree_.Root()));
+        return tree_.ToPostfix();
+    }
+
+private:
+    static bool Is(const PostfixTreeNode * n, PostfixNode::Type type) {
+        return n->node->type == type;
+    }
+
+    // Operands of a chain of 'type' nodes, in order.
+    static std::vector<PostfixTreeNode *> Chain(PostfixTreeNode * n,
+                                                PostfixNode::Type type) {
+        std::vector<PostfixTreeNode *> items;
+        std::vector<PostfixTreeNode *> stack = {n};
+        while (!stack.empty())
+        {
+            n = stack.back();
+            stack.pop_back();
+            if (Is(n, type))
+            {
                 stack.push_back(n->right);
-            if (n->left)
                 stack.push_back(n->left);
-            visited.insert(n);
+            }
+            else
+                items.push_back(n);
         }
-        else
+        return items;
+    }
+
+    static bool Nullable(PostfixTreeNode * n) {
+        switch (n->node->type)
         {
+            case PostfixNode::CHAR_INPUT:
+                return false;
+            case PostfixNode::REPEAT:
+                return n->node->repeat.min == 0 || Nullable(n->left);
+            case PostfixNode::CONCAT:
+                for (PostfixTreeNode * item : Chain(n, PostfixNode::CONCAT))
+                {
+                    if (!Nullable(item))
+                        return false;
+                }
+                return true;
+            case PostfixNode::ALTER:
+                for (PostfixTreeNode * item : Chain(n, PostfixNode::ALTER))
+                {
+                    if (Nullable(item))
+                        return true;
+                }
+                return false;
+            case PostfixNode::GROUP:
+                return n->node->group.type == Group::LOOK_AHEAD ||
+                    n->node->group.type == Group::LOOK_BEHIND ||
+                    Nullable(n->left);
+            default:
+                return true;
+        }
+    }
+
+    // Same pattern, up to look-around, atomic and repeat ids.
+    static bool Equal(PostfixTreeNode * a, PostfixTreeNode * b) {
+        const PostfixNode & x = *a->node;
+        const PostfixNode & y = *b->node;
+        if (x.type != y.type)
+            return false;
+        switch (x.type)
+        {
+            case PostfixNode::CHAR_INPUT:
+                return x.chr == y.chr;
+            case PostfixNode::BACKREF_INPUT:
+                return x.backref.capture_id == y.backref.capture_id;
+            case PostfixNode::REPEAT:
+                return x.repeat.min == y.repeat.min &&
+                    x.repeat.has_max == y.repeat.has_max &&
+                    (!x.repeat.has_max || x.repeat.max == y.repeat.max) &&
+                    x.repeat.qualifier == y.repeat.qualifier &&
+                    Equal(a->left, b->left);
+            case PostfixNode::GROUP:
+                return x.group.type == y.group.type &&
+                    (x.group.type != Group::CAPTURE ||
+                     x.group.capture_id == y.group.capture_id) &&
+                    Equal(a->left, b->left);
+            case PostfixNode::CONCAT:
+            case PostfixNode::ALTER:
+            {
+                std::vector<PostfixTreeNode *> u = Chain(a, x.type);
+                std::vector<PostfixTreeNode *> v = Chain(b, x.type);
+                if (u.size() != v.size())
+                    return false;
+                for (size_t i = 0; i < u.size(); ++i)
+                {
+                    if (!Equal(u[i], v[i]))
+                        return false;
+                }
+                return true;
+            }
+            default:
+                return true;
+        }
+    }
+
+    PostfixTreeNode * Simplify(PostfixTreeNode * n) {
+        switch (n->node->type)
+        {
+            case PostfixNode::GROUP:
+            {
+                PostfixTreeNode * body = Simplify(n->left);
+                if (n->node->group.type == Group::NON_CAPTURE)
+                    return body;
+                return tree_.New(n->node, body, nullptr);
+            }
+            case PostfixNode::REPEAT:
+            {
+                const Repeat & r = n->node->repeat;
+                PostfixTreeNode * body = Simplify(n->left);
+                if (Is(body, PostfixNode::NULL_INPUT) ||
+                    (r.min == 1 && r.has_max && r.max == 1))
+                    return body;
+                if (r.has_max && r.max == 0 && !HasCapture(body))
+                    return tree_.New(&null_, nullptr, nullptr);
+                if (IsStar(r) && Is(body, PostfixNode::REPEAT) &&
+                    IsStar(body->node->repeat) && !Nullable(body->left))
+                    return body;
+                if (IsStar(r) && Is(body, PostfixNode::REPEAT) &&
+                    IsOptional(body->node->repeat))
+                    return tree_.New(n->node, body->left, nullptr);
+                return tree_.New(n->node, body, nullptr);
+            }
+            case PostfixNode::CONCAT:
+            {
+                std::vector<PostfixTreeNode *> items;
+                for (PostfixTreeNode * item : Chain(n, PostfixNode::CONCAT))
+                    Append(&items, Simplify(item));
+                return Concat(items);
+            }
+            case PostfixNode::ALTER:
+            {
+                std::vector<PostfixTreeNode *> branches;
+                for (PostfixTreeNode * item : Chain(n, PostfixNode::ALTER))
+                {
+                    for (PostfixTreeNode * branch :
+                         Chain(Simplify(item), PostfixNode::ALTER))
+                        branches.push_back(branch);
+                }
+                return Alter(branches);
+            }
+            default:
+                return n;
+        }
+    }
+
+    static bool IsStar(const Repeat & r) {
+        return r.min == 0 && !r.has_max && r.qualifier == Repeat::GREEDY;
+    }
+    static bool IsOptional(const Repeat & r) {
+        return r.min == 0 && r.has_max && r.max == 1 &&
+            r.qualifier == Repeat::GREEDY;
+    }
+
+    // Back references may still name its groups.
+    static bool HasCapture(PostfixTreeNode * n) {
+        std::vector<PostfixTreeNode *> stack = {n};
+        while (!stack.empty())
+        {
+            n = stack.back();
             stack.pop_back();
-            flip_nl.push_back(*n->node);
+            if (Is(n, PostfixNode::GROUP) &&
+                n->node->group.type == Group::CAPTURE)
+                return true;
+            if (n->left)
+                stack.push_back(n->left);
+            if (n->right)
+                stack.push_back(n->right);
+        }
+        return false;
+    }
+
+    // Append the items of 'n', if it is a concatenation, or 'n'.
+    static void Append(std::vector<PostfixTreeNode *> * items,
+                       PostfixTreeNode * n) {
+        for (PostfixTreeNode * item : Chain(n, PostfixNode::CONCAT))
+        {
+            if (!Is(item, PostfixNode::NULL_INPUT))
+                items->push_back(item);
+        }
+    }
+
+    PostfixTreeNode * Concat(const std::vector<PostfixTreeNode *> & items) {
+        if (items.empty())
+            return tree_.New(&null_, nullptr, nullptr);
+        PostfixTreeNode * n = items[0];
+        for (size_t i = 1; i < items.size(); ++i)
+            n = tree_.New(&concat_, n, items[i]);
+        return n;
+    }
+
+    PostfixTreeNode * Optional(PostfixTreeNode * n, Repeat::Qualifier q) {
+        return tree_.Make(
+            PostfixNode(Repeat{repeat_id_gen_++, 0, 1, true, q}), n);
+    }
+
+    // Branches are simplified, and not alternations themselves.
+    PostfixTreeNode * Alter(std::vector<PostfixTreeNode *> branches) {
+        std::vector<PostfixTreeNode *> unique;
+        for (PostfixTreeNode * b : branches)
+        {
+            bool seen = false;
+            for (PostfixTreeNode * u : unique)
+                seen = seen || Equal(u, b);
+            if (!seen)
+                unique.push_back(b);
+        }
+        branches = FactorPrefixes(unique);
+        branches = FactorSuffixes(branches);
+
+        // Only one branch is empty now.
+        auto empty = std::find_if(
+            branches.begin(), branches.end(), [](PostfixTreeNode * b) {
+                return Is(b, PostfixNode::NULL_INPUT);
+            });
+        if (empty == branches.end())
+            return Build(branches);
+        if (empty + 1 == branches.end())
+        {
+            if (empty == branches.begin())
+                return *empty;
+            branches.pop_back();
+            return Optional(Build(branches), Repeat::GREEDY);
+        }
+        PostfixTreeNode * after =
+            Optional(Build(std::vector<PostfixTreeNode *>(empty + 1,
+                                                          branches.end())),
+                     Repeat::RELUCTANT);
+        branches.erase(empty, branches.end());
+        branches.push_back(after);
+        return Build(branches);
+    }
+
+    PostfixTreeNode * Build(const std::vector<PostfixTreeNode *> & branches) {
+        PostfixTreeNode * n = branches[0];
+        for (size_t i = 1; i < branches.size(); ++i)
+            n = tree_.New(&alter_, n, branches[i]);
+        return n;
+    }
+
+    // Adjacent branches starting with the same char share it.
+    std::vector<PostfixTreeNode *> FactorPrefixes(
+        const std::vector<PostfixTreeNode *> & branches) {
+        std::vector<PostfixTreeNode *> factored;
+        for (size_t i = 0; i < branches.size();)
+        {
+            std::vector<PostfixTreeNode *> items =
+                Chain(branches[i], PostfixNode::CONCAT);
+            size_t j = i + 1;
+            if (Is(items[0], PostfixNode::CHAR_INPUT))
+            {
+                while (j < branches.size() &&
+                       Equal(Chain(branches[j], PostfixNode::CONCAT)[0],
+                             items[0]))
+                    ++j;
+            }
+            if (j == i + 1)
+            {
+                factored.push_back(branches[i++]);
+                continue;
+            }
+            std::vector<PostfixTreeNode *> rests;
+            for (; i < j; ++i)
+            {
+                std::vector<PostfixTreeNode *> rest =
+                    Chain(branches[i], PostfixNode::CONCAT);
+                rest.erase(rest.begin());
+                rests.push_back(Concat(rest));
+            }
+            std::vector<PostfixTreeNode *> shared = {items[0]};
+            Append(&shared, Alter(rests));
+            factored.push_back(Concat(shared));
+        }
+        return factored;
+    }
+
+    // Adjacent branches ending with the same item share it.
+    std::vector<PostfixTreeNode *> FactorSuffixes(
+        const std::vector<PostfixTreeNode *> & branches) {
+        std::vector<PostfixTreeNode *> factored;
+        for (size_t i = 0; i < branches.size();)
+        {
+            std::vector<PostfixTreeNode *> items =
+                Chain(branches[i], PostfixNode::CONCAT);
+            size_t j = i + 1;
+            if (items.size() > 1)
+            {
+                while (j < branches.size())
+                {
+                    std::vector<PostfixTreeNode *> next =
+                        Chain(branches[j], PostfixNode::CONCAT);
+                    if (next.size() < 2 || !Equal(next.back(), items.back()))
+                        break;
+                    ++j;
+                }
+            }
+            if (j == i + 1)
+            {
+                factored.push_back(branches[i++]);
+                continue;
+            }
+            std::vector<PostfixTreeNode *> rests;
+            for (; i < j; ++i)
+            {
+                std::vector<PostfixTreeNode *> rest =
+                    Chain(branches[i], PostfixNode::CONCAT);
+                rest.pop_back();
+                rests.push_back(Concat(rest));
+            }
+            std::vector<PostfixTreeNode *> shared;
+            Append(&shared, Alter(rests));
+            shared.push_back(items.back());
+            factored.push_back(Concat(shared));
+        }
+        return factored;
+    }
+
+    PostfixTree tree_;
+    int repeat_id_gen_;
+    PostfixNode null_;
+    PostfixNode concat_;
+    PostfixNode alter_;
+};
+
+std::vector<PostfixNode> SimplifyPostfix(const std::vector<PostfixNode> & nl) {
+    return PostfixSimplifier(nl).Simplify();
+}
+
+// Largest counted repeat worth unrolling, in copies of its operand and in
+// postfix nodes of the result.
+static const size_t kMaxUnrollCopies = 16;
+static const size_t kMaxUnrollNodes = 256;
+
+std::vector<PostfixNode> UnrollRepeats(const std::vector<PostfixNode> & nl) {
+    // Copies of an operand get their own look-around, atomic and repeat ids.
+    int lookaround_id_gen = 0, atomic_id_gen = 0, repeat_id_gen = 0;
+    for (const PostfixNode & n : nl)
+    {
+        if (n.type == PostfixNode::REPEAT)
+            repeat_id_gen = std::max(repeat_id_gen, n.repeat.repeat_id + 1);
+        else if (n.type == PostfixNode::GROUP &&
+                 (n.group.type == Group::LOOK_AHEAD ||
+                  n.group.type == Group::LOOK_BEHIND))
+            lookaround_id_gen =
+                std::max(lookaround_id_gen, n.group.lookaround_id + 1);
+        else if (n.type == PostfixNode::GROUP &&
+                 n.group.type == Group::ATOMIC)
+            atomic_id_gen = std::max(atomic_id_gen, n.group.atomic_id + 1);
+    }
+    auto copy = [&](std::vector<PostfixNode> frag) {
+        for (PostfixNode & n : frag)
+        {
+            if (n.type == PostfixNode::REPEAT)
+                n.repeat.repeat_id = repeat_id_gen++;
+            else if (n.type == PostfixNode::GROUP &&
+                     (n.group.type == Group::LOOK_AHEAD ||
+                      n.group.type == Group::LOOK_BEHIND))
+                n.group.lookaround_id = lookaround_id_gen++;
+            else if (n.type == PostfixNode::GROUP &&
+                     n.group.type == Group::ATOMIC)
+                n.group.atomic_id = atomic_id_gen++;
+        }
+        return frag;
+    };
+    auto concat = [](std::vector<PostfixNode> * frag,
+                     const std::vector<PostfixNode> & next) {
+        bool first = frag->empty();
+        frag->insert(frag->end(), next.begin(), next.end());
+        if (!first && !next.empty())
+            frag->emplace_back(PostfixNode::CONCAT);
+    };
+
+    // Operands, in postfix.
+    std::vector<std::vector<PostfixNode>> st;
+    for (const PostfixNode & n : nl)
+    {
+        switch (n.type)
+        {
+            case PostfixNode::NULL_INPUT:
+            case PostfixNode::CHAR_INPUT:
+            case PostfixNode::BACKREF_INPUT:
+                st.push_back({n});
+                break;
+            case PostfixNode::GROUP:
+                st.back().push_back(n);
+                break;
+            case PostfixNode::CONCAT:
+            case PostfixNode::ALTER:
+            {
+                std::vector<PostfixNode> right = std::move(st.back());
+                st.pop_back();
+                st.back().insert(st.back().end(), right.begin(), right.end());
+                st.back().push_back(n);
+                break;
+            }
+            case PostfixNode::REPEAT:
+            {
+                const Repeat & r = n.repeat;
+                // {0} is left alone, as are repeats that need no counter.
+                bool counted = r.min > 1 || (r.has_max && r.max != 1);
+                size_t copies = r.has_max ? r.max : r.min;
+                if (!counted || copies == 0 || copies > kMaxUnrollCopies ||
+                    st.back().size() * copies > kMaxUnrollNodes)
+                {
+                    st.back().push_back(n);
+                    break;
+                }
+
+                std::vector<PostfixNode> x = std::move(st.back());
+                size_t made = 0;
+                auto next = [&]() { return made++ == 0 ? x : copy(x); };
+                std::vector<PostfixNode> unrolled;
+                // x{m,n} is m copies of x, then n - m nested optional ones:
+                // (x(x)?)?. x{m,} is m - 1 copies, then x{1,}.
+                size_t fixed = r.has_max ? r.min : r.min - 1;
+                for (size_t i = 0; i < fixed; ++i)
+                    concat(&unrolled, next());
+                if (!r.has_max)
+                {
+                    std::vector<PostfixNode> loop = next();
+                    loop.emplace_back(
+                        Repeat{repeat_id_gen++, 1, 0, false, r.qualifier});
+                    concat(&unrolled, loop);
+                }
+                else if (r.max > r.min)
+                {
+                    std::vector<PostfixNode> tail;
+                    for (size_t i = r.min; i < r.max; ++i)
+                    {
+                        std::vector<PostfixNode> opt = next();
+                        concat(&opt, tail);
+                        opt.emplace_back(
+                            Repeat{repeat_id_gen++, 0, 1, true, r.qualifier});
+                        tail = std::move(opt);
+                    }
+                    concat(&unrolled, tail);
+                }
+                st.back() = std::move(unrolled);
+                break;
+            }
+            default:
+                RAssert(false);
+                break;
         }
     }
 
-    return flip_nl;
+    RAssert(st.size() == 1);
+    return st.back();
 }
@@ -52,5 +52,18 @@ struct PostfixNode {
     };
 };
 
+// 'regex' must parse: see FindSyntaxError.
 std::vector<PostfixNode> ParseToPostfix(RString regex);
+// Where 'regex' first breaks the syntax of RegexSyntax.h, or RString::npos
+// if it parses.
+size_t FindSyntaxError(RString regex);
+// Replace chars above U+007F with their UTF-8 byte sequences, so the
+// pattern matches UTF-8 text a byte at a time.
+std::vector<PostfixNode> EncodeUtf8(const std::vector<PostfixNode> & nl);
 std::vector<PostfixNode> FlipPostfix(const std::vector<PostfixNode> & nl);
+// Rewrite the pattern into a smaller one that finds the same matches, by
+// algebraic laws. Runs after FlipPostfix, on nodes in matching order.
+std::vector<PostfixNode> SimplifyPostfix(const std::vector<PostfixNode> & nl);
+// Expand counted repeats with small bounds into copies of their operand, so
+// only plain loops and optionals remain.
+std::vector<PostfixNode> UnrollRepeats(const std::vector<PostfixNode> & nl);
@@ -0,0 +1,323 @@
+#include "stdafx.h"
+
+#include "IntType.h"
+#include "Prefilter.h"
+#include "util.h"
+
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef HAS_SSE2
+template <typename CharT>
+static __m128i Broadcast(RChar c) {
+    switch (sizeof(CharT))
+    {
+        case 1:
+            return _mm_set1_epi8(static_cast<char>(c));
+        case 2:
+            return _mm_set1_epi16(static_cast<short>(c));
+        default:
+            return _mm_set1_epi32(static_cast<int>(c));
+    }
+}
+
+template <typename CharT>
+static __m128i Equal(__m128i a, __m128i b) {
+    switch (sizeof(CharT))
+    {
+        case 1:
+            return _mm_cmpeq_epi8(a, b);
+        case 2:
+            return _mm_cmpeq_epi16(a, b);
+        default:
+            return _mm_cmpeq_epi32(a, b);
+    }
+}
+#endif
+
+// Find the first char in [begin, end) that is one of 'chars'.
+template <typename CharT>
+static const CharT * FindAnyOf(const CharT * begin,
+                               const CharT * end,
+                               const std::vector<RChar> & chars) {
+    const CharT * p = begin;
+#ifdef HAS_SSE2
+    const size_t kLanes = sizeof(__m128i) / sizeof(CharT);
+    __m128i needles[Prefilter::kMaxFirstChars];
+    for (size_t i = 0; i < chars.size(); ++i)
+        needles[i] = Broadcast<CharT>(chars[i]);
+    for (; static_cast<size_t>(end - p) >= kLanes; p += kLanes)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i eq = Equal<CharT>(block, needles[0]);
+        for (size_t i = 1; i < chars.size(); ++i)
+            eq = _mm_or_si128(eq, Equal<CharT>(block, needles[i]));
+        int mask = _mm_movemask_epi8(eq);
+        if (mask != 0)
+        {
+            int byte = 0;
+            while ((mask & 1) == 0)
+                mask >>= 1, ++byte;
+            return p + byte / sizeof(CharT);
+        }
+    }
+#endif
+    for (; p != end; ++p)
+    {
+        for (RChar c : chars)
+        {
+            if (CodeUnit(c) == CodeUnit(*p))
+                return p;
+        }
+    }
+    return end;
+}
+
+// Find the first occurrence of 'literal' in [begin, end).
+template <typename CharT>
+static const CharT * FindLiteral(const CharT * begin,
+                                 const CharT * end,
+                                 const RString & literal) {
+    typedef std::char_traits<CharT> Traits;
+    size_t n = literal.size();
+    CharT first = static_cast<CharT>(literal[0]);
+    while (static_cast<size_t>(end - begin) >= n)
+    {
+        // memchr or wmemchr.
+        begin = Traits::find(begin, (end - begin) - (n - 1), first);
+        if (!begin)
+            return end;
+        size_t i = 1;
+        while (i < n && CodeUnit(begin[i]) == CodeUnit(literal[i]))
+            ++i;
+        if (i == n)
+            return begin;
+        ++begin;
+    }
+    return end;
+}
+
+// Multi-literal searcher: a trie of the literals with failure links,
+// resolved into a full transition table for ASCII chars.
+class Prefilter::AhoCorasick {
+public:
+    explicit AhoCorasick(const std::vector<RString> & literals);
+
+    // Find the literal occurrence in [begin, end) that ends first. '*len'
+    // receives the length of the shortest literal ending there.
+    template <typename CharT>
+    bool Find(const CharT * begin,
+              const CharT * end,
+              const CharT ** hit_end,
+              size_t * len) const;
+
+private:
+    struct Node {
+        int next_ascii[128];
+        std::map<RChar, int> children;
+        int fail;
+        // Shortest literal ending here, 0 if there is none.
+        size_t out_len;
+    };
+
+    int Next(int node, UINT32 c) const;
+
+    std::vector<Node> nodes_;
+};
+
+Prefilter::AhoCorasick::AhoCorasick(const std::vector<RString> & literals) {
+    nodes_.emplace_back();
+    nodes_[0].out_len = 0;
+    for (const RString & literal : literals)
+    {
+        RAssert(!literal.empty());
+        int node = 0;
+        for (RChar c : literal)
+        {
+            auto it = nodes_[node].children.find(c);
+            if (it != nodes_[node].children.end())
+            {
+                node = it->second;
+                continue;
+            }
+            int child = static_cast<int>(nodes_.size());
+            nodes_[node].children.emplace(c, child);
+            nodes_.emplace_back();
+            nodes_[child].out_len = 0;
+            node = child;
+        }
+        if (nodes_[node].out_len == 0 || literal.size() < nodes_[node].out_len)
+            nodes_[node].out_len = literal.size();
+    }
+
+    // Breadth-first, so failure targets are complete before they are used.
+    std::deque<int> queue = {0};
+    nodes_[0].fail = 0;
+    while (!queue.empty())
+    {
+        int node = queue.front();
+        queue.pop_front();
+        Node & n = nodes_[node];
+        const Node & fail = nodes_[n.fail];
+        if (node != 0 && fail.out_len != 0 &&
+            (n.out_len == 0 || fail.out_len < n.out_len))
+        {
+            n.out_len = fail.out_len;
+        }
+        for (RChar c = 0; c < 128; ++c)
+        {
+            auto it = n.children.find(c);
+            if (it != n.children.end())
+                n.next_ascii[c] = it->second;
+            else
+                n.next_ascii[c] = (node == 0 ? 0 : fail.next_ascii[c]);
+        }
+        for (const auto & child : n.children)
+        {
+            nodes_[child.second].fail =
+                (node == 0 ? 0 : Next(n.fail, child.first));
+            queue.push_back(child.second);
+        }
+    }
+}
+
+int Prefilter::AhoCorasick::Next(int node, UINT32 c) const {
+    if (c < 128)
+        return nodes_[node].next_ascii[c];
+    while (true)
+    {
+        auto it = nodes_[node].children.find(static_cast<RChar>(c));
+        if (it != nodes_[node].children.end())
+            return it->second;
+        if (node == 0)
+            return 0;
+        node = nodes_[node].fail;
+    }
+}
+
+template <typename CharT>
+bool Prefilter::AhoCorasick::Find(const CharT * begin,
+                                  const CharT * end,
+                                  const CharT ** hit_end,
+                                  size_t * len) const {
+    int node = 0;
+    for (const CharT * p = begin; p != end; ++p)
+    {
+        node = Next(node, CodeUnit(*p));
+        if (nodes_[node].out_len != 0)
+        {
+            *hit_end = p + 1;
+            *len = nodes_[node].out_len;
+            return true;
+        }
+    }
+    return false;
+}
+
+Prefilter::Prefilter()
+    : max_length_(kUnbounded) {
+}
+
+Prefilter Prefilter::Prefix(RString prefix) {
+    Prefilter p;
+    p.prefix_ = prefix;
+    return p;
+}
+
+Prefilter Prefilter::FirstChar(std::vector<RChar> chars) {
+    RAssert(chars.size() <= kMaxFirstChars);
+    Prefilter p;
+    p.first_chars_ = chars;
+    return p;
+}
+
+Prefilter Prefilter::Required(std::vector<RString> literals,
+                              size_t max_length) {
+    RAssert(!literals.empty() && literals.size() <= kMaxLiterals);
+    Prefilter p;
+    p.literals_ = literals;
+    p.max_length_ = max_length;
+    if (literals.size() > 1)
+        p.searcher_ = std::make_shared<AhoCorasick>(literals);
+    return p;
+}
+
+size_t Prefilter::Overhang() const {
+    if (!prefix_.empty())
+        return prefix_.size() - 1;
+    if (!literals_.empty())
+        return max_length_;
+    return 0;
+}
+
+template <typename CharT>
+bool Prefilter::NextCandidates(StringView<CharT> text,
+                               size_t from,
+                               size_t * begin,
+                               size_t * last,
+                               size_t before) const {
+    if (from > text.size() || from >= before)
+        return false;
+    if (IsEmpty())
+    {
+        *begin = from;
+        *last = std::min(text.size(), before - 1);
+        return true;
+    }
+
+    // Where a hit ends at the latest, for a match starting before 'before'.
+    size_t reach = text.size();
+    size_t hit_length = prefix_.empty() ? max_length_ : prefix_.size();
+    if (!first_chars_.empty())
+        hit_length = 1;
+    if (hit_length != kUnbounded && before <= text.size() &&
+        hit_length <= text.size() - before)
+        reach = before - 1 + hit_length;
+
+    const CharT * first = text.data() + from;
+    const CharT * end = text.data() + reach;
+    if (!prefix_.empty() || !first_chars_.empty())
+    {
+        const CharT * hit = prefix_.empty()
+            ? FindAnyOf(first, end, first_chars_)
+            : FindLiteral(first, end, prefix_);
+        if (hit == end)
+            return false;
+        *begin = *last = static_cast<size_t>(hit - text.data());
+        return true;
+    }
+
+    // A match containing the hit starts at most 'max_length_' chars before
+    // the hit ends, and no later than the hit starts.
+    const CharT * hit_end;
+    size_t len;
+    if (searcher_)
+    {
+        if (!searcher_->Find(first, end, &hit_end, &len))
+            return false;
+    }
+    else
+    {
+        len = literals_.front().size();
+        hit_end = FindLiteral(first, end, literals_.front());
+        if (hit_end == end)
+            return false;
+        hit_end += len;
+    }
+    size_t e = static_cast<size_t>(hit_end - text.data());
+    *last = std::min(e - len, before - 1);
+    *begin = (max_length_ == kUnbounded || e - from <= max_length_)
+        ? from
+        : e - max_length_;
+    return *begin < before;
+}
+
+template bool Prefilter::NextCandidates(
+    RView, size_t, size_t *, size_t *, size_t) const;
+template bool Prefilter::NextCandidates(
+    RByteView, size_t, size_t *, size_t *, size_t) const;
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "RegexSyntax.h"
+
+#include <memory>
+#include <vector>
+
+/*
+ * Skip to positions where a match may start, before running an engine.
+ *
+ * A pattern whose matches all begin with a literal is searched with
+ * wmemchr; otherwise, when the possible first chars are few, they are
+ * scanned for with SSE2. Failing both, a set of literals one of which every
+ * match contains is searched with Aho-Corasick, and only starts close
+ * enough before a hit are tried.
+ */
+
+class Prefilter {
+    friend class ProgramFile;
+
+public:
+    // Accept every position.
+    Prefilter();
+    // Every match starts with 'prefix'. Chars are code units of the text
+    // searched.
+    static Prefilter Prefix(RString prefix);
+    // Every match starts with one of 'chars'.
+    static Prefilter FirstChar(std::vector<RChar> chars);
+    // Every match contains one of 'literals' and is at most 'max_length'
+    // chars long (kUnbounded if there is no limit).
+    static Prefilter Required(std::vector<RString> literals,
+                              size_t max_length);
+
+    bool IsEmpty() const {
+        return prefix_.empty() && first_chars_.empty() && literals_.empty();
+    }
+
+    // Find the first window [*begin, *last] of positions at or after 'from',
+    // and before 'before', where a match may start. No match starts between
+    // 'from' and the window. The text is read no further than a match
+    // starting before 'before' can reach, when that is known.
+    template <typename CharT>
+    bool NextCandidates(StringView<CharT> text,
+                        size_t from,
+                        size_t * begin,
+                        size_t * last,
+                        size_t before = kUnbounded) const;
+
+    // How many positions before the end of the text more text may still
+    // make candidates of.
+    size_t Overhang() const;
+
+    // Longest first char set worth scanning for.
+    static const size_t kMaxFirstChars = 4;
+    // Largest literal set worth searching for.
+    static const size_t kMaxLiterals = 64;
+    static const size_t kUnbounded = static_cast<size_t>(-1);
+
+private:
+    class AhoCorasick;
+
+    RString prefix_;
+    std::vector<RChar> first_chars_;
+    std::vector<RString> literals_;
+    size_t max_length_;
+    std::shared_ptr<const AhoCorasick> searcher_;
+};
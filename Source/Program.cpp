@@ -0,0 +1,384 @@
+#include "stdafx.h"
+
+#include "Program.h"
+#include "util.h"
+
+Program::Program(const EnfaGraph & graph)
+    : capture_count_(0) {
+    // Where each look-around and atomic body ends.
+    std::map<int, size_t> lookaround_end, atomic_end;
+    for (size_t i = 0; i < graph.Size(); ++i)
+    {
+        const TagSet & tags = graph.State(i).Tags();
+        if (tags.HasLookAroundTag() && !tags.GetLookAroundTag().is_begin)
+            lookaround_end[tags.GetLookAroundTag().id] = i;
+        if (tags.HasAtomicTag() && !tags.GetAtomicTag().is_begin)
+            atomic_end[tags.GetAtomicTag().atomic_id] = i;
+    }
+
+    // Targets hold state indices until every state is laid out.
+    std::vector<int> first_pc(graph.Size());
+    for (size_t i = 0; i < graph.Size(); ++i)
+    {
+        const EnfaState & s = graph.State(i);
+        const TagSet & tags = s.Tags();
+        first_pc[i] = static_cast<int>(insts_.size());
+
+        if (tags.HasCaptureTag())
+        {
+            const CaptureTag & tag = tags.GetCaptureTag();
+            size_t slot = tag.capture_id * 2 + (tag.is_begin ? 0 : 1);
+            Emit(Inst::SAVE, false, static_cast<UINT32>(slot));
+            capture_count_ = std::max(capture_count_, tag.capture_id + 1);
+        }
+        if (s.IsFinal())
+        {
+            final_ = Emit(Inst::MATCH, false, 0);
+            continue;
+        }
+        if (tags.HasLookAroundTag())
+        {
+            const LookAroundTag & tag = tags.GetLookAroundTag();
+            if (tag.is_begin)
+            {
+                int pc = Emit(Inst::ASSERT, tag.is_forward, tag.id);
+                insts_[pc].x = static_cast<int>(lookaround_end.at(tag.id));
+            }
+            else
+                Emit(Inst::END, false, tag.id);
+        }
+        if (tags.HasAtomicTag())
+        {
+            const AtomicTag & tag = tags.GetAtomicTag();
+            if (tag.is_begin)
+            {
+                int pc = Emit(Inst::ATOMIC, false, tag.atomic_id);
+                insts_[pc].x = static_cast<int>(atomic_end.at(tag.atomic_id));
+            }
+            else
+                Emit(Inst::END, false, tag.atomic_id);
+        }
+
+        int pc;
+        if (s.IsChar())
+        {
+            pc = Emit(Inst::CHAR, false, static_cast<UINT32>(s.Char()));
+            insts_[pc].x = static_cast<int>(s.Out()->Index());
+        }
+        else if (s.IsBackReference())
+        {
+            pc = Emit(
+                Inst::BACKREF, false, static_cast<UINT32>(s.BackReference()));
+            insts_[pc].x = static_cast<int>(s.Out()->Index());
+        }
+        else
+        {
+            RAssert(s.IsEpsilon());
+            EnfaEdges outs = s.MultipleOut();
+            RAssert(outs.size() <= 2);
+            if (tags.HasRepeatTag())
+            {
+                const RepeatTag & tag = tags.GetRepeatTag();
+                pc = Emit(Inst::REPEAT,
+                          tag.qualifier == RepeatTag::GREEDY,
+                          static_cast<UINT32>(repeats_.size()));
+                repeats_.push_back(tag);
+                RAssert(outs.size() == 2);
+            }
+            else
+                pc = Emit(outs.size() == 1 ? Inst::JMP : Inst::SPLIT, false, 0);
+            insts_[pc].x = static_cast<int>(outs[0]->Index());
+            if (outs.size() == 2)
+                insts_[pc].y = static_cast<int>(outs[1]->Index());
+        }
+    }
+
+    for (Inst & inst : insts_)
+    {
+        if (inst.x >= 0)
+            inst.x = first_pc[inst.x];
+        if (inst.y >= 0)
+            inst.y = first_pc[inst.y];
+    }
+    Own();
+}
+
+Program::Program(const std::vector<const Program *> & programs)
+    : capture_count_(0) {
+    RAssert(!programs.empty());
+    std::vector<int> starts;
+    int pc = static_cast<int>(programs.size()) - 1;
+    for (const Program * program : programs)
+    {
+        starts.push_back(pc);
+        pc += static_cast<int>(program->Size());
+    }
+    for (size_t i = 0; i + 1 < programs.size(); ++i)
+    {
+        int split = Emit(Inst::SPLIT, false, 0);
+        insts_[split].x = starts[i];
+        insts_[split].y = (i + 2 < programs.size() ? split + 1 : starts[i + 1]);
+    }
+
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+        const Program & program = *programs[i];
+        UINT32 repeat_base = static_cast<UINT32>(repeats_.size());
+        for (size_t j = 0; j < program.Size(); ++j)
+        {
+            Inst inst = program[static_cast<int>(j)];
+            if (inst.x >= 0)
+                inst.x += starts[i];
+            if (inst.y >= 0)
+                inst.y += starts[i];
+            if (inst.op == Inst::REPEAT)
+                inst.arg += repeat_base;
+            else if (inst.op == Inst::MATCH)
+                inst.arg = static_cast<UINT32>(i);
+            insts_.push_back(inst);
+        }
+        repeats_.insert(
+            repeats_.end(), program.repeats_.begin(), program.repeats_.end());
+        capture_count_ = std::max(capture_count_, program.capture_count_);
+    }
+    final_ = starts[0] + programs[0]->final_;
+    Own();
+}
+
+Program::Program(const Inst * insts,
+                 size_t size,
+                 std::vector<RepeatTag> repeats,
+                 size_t capture_count,
+                 int final,
+                 std::shared_ptr<const void> storage)
+    : storage_(storage)
+    , code_(insts)
+    , size_(size)
+    , repeats_(repeats)
+    , capture_count_(capture_count)
+    , final_(final) {
+    FindLoops();
+}
+
+std::shared_ptr<const Program> Program::Reverse(const Program & program) {
+    // Every edge u -> v of a reachable u becomes v -> u.
+    std::vector<std::vector<int>> in(program.Size());
+    std::vector<bool> reachable(program.Size());
+    std::vector<int> stack = {0};
+    while (!stack.empty())
+    {
+        int pc = stack.back();
+        stack.pop_back();
+        if (reachable[pc])
+            continue;
+        reachable[pc] = true;
+        RAssert(program[pc].op == Inst::CHAR || program[pc].op == Inst::JMP ||
+                program[pc].op == Inst::SPLIT ||
+                program[pc].op == Inst::SAVE || program[pc].op == Inst::MATCH);
+        for (int next : program.Next(pc))
+        {
+            in[next].push_back(pc);
+            stack.push_back(next);
+        }
+    }
+
+    // Each instruction v becomes a SPLIT chain over its incoming edges,
+    // plus a MATCH for the start. Edges that consumed a char get a CHAR of
+    // their own; targets hold old pcs until every one is laid out.
+    std::shared_ptr<Program> reverse(new Program());
+    // -1 until queued for layout.
+    std::vector<int> first_pc(program.Size(), -1);
+    std::vector<int> fixups;
+    std::vector<int> order = {program.Final()};
+    first_pc[program.Final()] = 0;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        int v = order[i];
+        first_pc[v] = static_cast<int>(reverse->insts_.size());
+        size_t edges = in[v].size() + (v == 0);
+        for (size_t k = 0; k < edges; ++k)
+        {
+            int split = -1;
+            if (k + 1 < edges)
+                split = reverse->Emit(Inst::SPLIT, false, 0);
+            int pc;
+            if (k == in[v].size())
+            {
+                pc = reverse->Emit(Inst::MATCH, false, 0);
+                reverse->final_ = pc;
+            }
+            else
+            {
+                int u = in[v][k];
+                if (first_pc[u] < 0)
+                {
+                    first_pc[u] = 0;
+                    order.push_back(u);
+                }
+                if (program[u].op == Inst::CHAR)
+                    pc = reverse->Emit(Inst::CHAR, false, program[u].arg);
+                else if (split < 0)
+                    pc = reverse->Emit(Inst::JMP, false, 0);
+                else
+                    pc = split;
+                reverse->insts_[pc].x = u;
+                fixups.push_back(pc);
+            }
+            if (split >= 0)
+            {
+                if (pc != split)
+                    reverse->insts_[split].x = pc;
+                reverse->insts_[split].y =
+                    static_cast<int>(reverse->insts_.size());
+            }
+        }
+    }
+    for (int pc : fixups)
+        reverse->insts_[pc].x = first_pc[reverse->insts_[pc].x];
+    reverse->Own();
+    return reverse;
+}
+
+int Program::Emit(Inst::Opcode op, bool flag, UINT32 arg) {
+    insts_.push_back({op, flag, arg, -1, -1});
+    return static_cast<int>(insts_.size() - 1);
+}
+
+void Program::Own() {
+    code_ = insts_.data();
+    size_ = insts_.size();
+    FindLoops();
+}
+
+void Program::FindLoops() {
+    // Edges that consume nothing. A REPEAT's loop edge is left out, as its
+    // count decides whether an empty iteration may go on.
+    auto empty_next = [this](int pc) {
+        const Inst & inst = code_[pc];
+        if (inst.op == Inst::CHAR)
+            return std::vector<int>();
+        if (inst.op == Inst::REPEAT)
+            return std::vector<int>{inst.y};
+        std::vector<int> next = Next(pc);
+        if (inst.op == Inst::ASSERT || inst.op == Inst::ATOMIC)
+            next.push_back(inst.x + 1);
+        return next;
+    };
+
+    // Every empty cycle has a back edge of the search, whose target heads
+    // the loop. 0: not seen, 1: on the path, 2: done.
+    loops_.assign(size_, -1);
+    loop_count_ = 0;
+    std::vector<UINT8> color(size_, 0);
+    std::vector<std::pair<int, std::vector<int>>> path;
+    for (int root = 0; root < static_cast<int>(size_); ++root)
+    {
+        if (color[root] != 0)
+            continue;
+        color[root] = 1;
+        path.emplace_back(root, empty_next(root));
+        while (!path.empty())
+        {
+            std::vector<int> & next = path.back().second;
+            if (next.empty())
+            {
+                color[path.back().first] = 2;
+                path.pop_back();
+                continue;
+            }
+            int pc = next.back();
+            next.pop_back();
+            if (color[pc] == 1 && loops_[pc] < 0)
+                loops_[pc] = static_cast<int>(loop_count_++);
+            else if (color[pc] == 0)
+            {
+                color[pc] = 1;
+                path.emplace_back(pc, empty_next(pc));
+            }
+        }
+    }
+
+    // A REPEAT whose body can get back to it without consuming.
+    for (int repeat = 0; repeat < static_cast<int>(size_); ++repeat)
+    {
+        if (code_[repeat].op != Inst::REPEAT || loops_[repeat] >= 0)
+            continue;
+        std::vector<bool> seen(size_);
+        std::vector<int> stack = {code_[repeat].x};
+        while (!stack.empty())
+        {
+            int pc = stack.back();
+            stack.pop_back();
+            if (pc == repeat)
+            {
+                loops_[repeat] = static_cast<int>(loop_count_++);
+                break;
+            }
+            if (seen[pc])
+                continue;
+            seen[pc] = true;
+            for (int next : empty_next(pc))
+                stack.push_back(next);
+        }
+    }
+}
+
+std::vector<int> Program::Next(int pc) const {
+    const Inst & inst = code_[pc];
+    switch (inst.op)
+    {
+        case Inst::CHAR:
+        case Inst::BACKREF:
+        case Inst::JMP:
+            return {inst.x};
+        case Inst::SPLIT:
+        case Inst::REPEAT:
+            return {inst.x, inst.y};
+        case Inst::MATCH:
+            return {};
+        default:
+            return {pc + 1};
+    }
+}
+
+RString Program::DebugString() const {
+    static const wchar_t * kNames[] = {
+        L"char",
+        L"backref",
+        L"jmp",
+        L"split",
+        L"save",
+        L"assert",
+        L"atomic",
+        L"end",
+        L"repeat",
+        L"match",
+    };
+
+    RString s;
+    for (size_t pc = 0; pc < size_; ++pc)
+    {
+        const Inst & inst = code_[pc];
+        s += std::to_wstring(pc) + L"\t" + kNames[inst.op];
+        if (inst.op == Inst::CHAR)
+            s += L" '", s += static_cast<RChar>(inst.arg), s += L"'";
+        else if (inst.op != Inst::JMP && inst.op != Inst::SPLIT &&
+                 inst.op != Inst::MATCH)
+            s += L" " + std::to_wstring(inst.arg);
+        if (inst.op == Inst::ASSERT)
+            s += inst.flag ? L" ahead" : L" behind";
+        if (inst.op == Inst::REPEAT)
+        {
+            const RepeatTag & tag = repeats_[inst.arg];
+            s += L" {" + std::to_wstring(tag.min) + L"," +
+                (tag.has_max ? std::to_wstring(tag.max) : L"") + L"}" +
+                (inst.flag ? L"" : L"?");
+        }
+        if (inst.x >= 0)
+            s += L" -> " + std::to_wstring(inst.x);
+        if (inst.y >= 0)
+            s += L", " + std::to_wstring(inst.y);
+        s += L"\n";
+    }
+    return s;
+}
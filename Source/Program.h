@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Enfa.h"
+#include "EnfaTag.h"
+#include "IntType.h"
+
+#include <memory>
+
+/*
+ * Flat instruction array lowered from an ENFA, run by every matching engine.
+ *
+ * Each ENFA state becomes a short run of instructions: its tags (SAVE,
+ * ASSERT, ATOMIC, END, MATCH) followed by its edge (CHAR, BACKREF, JMP,
+ * SPLIT, REPEAT). Targets are instruction indices; execution starts at 0.
+ */
+
+struct Inst {
+    enum Opcode : UINT8 {
+        // Consume 'arg' as a char, then go to x.
+        CHAR,
+        // Consume the last capture of group 'arg', then go to x.
+        BACKREF,
+        JMP,
+        // Try x, then y.
+        SPLIT,
+        // Record the current position in capture slot 'arg' (2 * group id,
+        // plus 1 for the end), then go to the next instruction.
+        SAVE,
+        // Look-around 'arg' (forward if 'flag') whose body starts at the next
+        // instruction and ends at END x. Continues after END x if it holds.
+        ASSERT,
+        // Atomic group 'arg', laid out like ASSERT.
+        ATOMIC,
+        // End of the ASSERT or ATOMIC body 'arg'.
+        END,
+        // One more iteration of counted repeat Program::Repeat(arg) was
+        // matched; x starts the next one, y exits. Plain loops and optionals
+        // are SPLITs; only bounds too large to unroll get here.
+        REPEAT,
+        // 'arg' is 0, or the index of the program a union Program joined.
+        MATCH,
+    };
+
+    Opcode op;
+    bool flag;
+    UINT32 arg;
+    int x;
+    int y;
+};
+// Saved as is by ProgramFile.
+static_assert(sizeof(Inst) == 16, "Inst layout");
+
+class Program {
+public:
+    explicit Program(const EnfaGraph & graph);
+    // The union of 'programs', for the DFA to run them all in one pass: a
+    // SPLIT chain starts each of them. The MATCH of program i has 'arg' i,
+    // and Final() is that of the first program.
+    explicit Program(const std::vector<const Program *> & programs);
+    // Instructions used in place, in memory 'storage' keeps alive, such as
+    // a mapped ProgramFile.
+    Program(const Inst * insts,
+            size_t size,
+            std::vector<RepeatTag> repeats,
+            size_t capture_count,
+            int final,
+            std::shared_ptr<const void> storage);
+    Program(const Program &) = delete;
+    Program & operator=(const Program &) = delete;
+
+    // The program that matches what 'program' matches, read backward: it
+    // starts at the MATCH and matches when it gets back to the start. For
+    // programs a DfaMatcher can run; captures are dropped.
+    static std::shared_ptr<const Program> Reverse(const Program & program);
+
+    size_t Size() const {
+        return size_;
+    }
+    const Inst & operator[](int pc) const {
+        return code_[pc];
+    }
+    // The MATCH instruction.
+    int Final() const {
+        return final_;
+    }
+    // Groups whose captures are saved.
+    size_t CaptureCount() const {
+        return capture_count_;
+    }
+    // Counted repeats, each with its own counter.
+    size_t RepeatCount() const {
+        return repeats_.size();
+    }
+    const RepeatTag & Repeat(UINT32 index) const {
+        return repeats_[index];
+    }
+    // Heads of loops that can go around without consuming, each with a
+    // register of its own: the index of the loop 'pc' heads, or -1. A
+    // REPEAT heads its loop when its body can match empty.
+    int Loop(int pc) const {
+        return loops_[pc];
+    }
+    size_t LoopCount() const {
+        return loop_count_;
+    }
+    // Successors of 'pc' in the ENFA's edge order. ASSERT and ATOMIC lead
+    // into their body.
+    std::vector<int> Next(int pc) const;
+
+    RString DebugString() const;
+
+private:
+    Program()
+        : capture_count_(0)
+        , final_(-1)
+        , loop_count_(0) {
+    }
+
+    int Emit(Inst::Opcode op, bool flag, UINT32 arg);
+    // Point code_ at insts_, once it is laid out.
+    void Own();
+    // Fill loops_ in.
+    void FindLoops();
+
+    // Empty when the instructions live in 'storage_'.
+    std::vector<Inst> insts_;
+    std::shared_ptr<const void> storage_;
+    const Inst * code_;
+    size_t size_;
+    std::vector<RepeatTag> repeats_;
+    size_t capture_count_;
+    int final_;
+    std::vector<int> loops_;
+    size_t loop_count_;
+};
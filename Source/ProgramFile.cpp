@@ -0,0 +1,428 @@
+#include "stdafx.h"
+
+#include "FileSearch.h"
+#include "ProgramFile.h"
+#include "util.h"
+
+#include <cstring>
+#include <fstream>
+
+static const char kMagic[8] = {'R', 'E', 'P', 'R', 'O', 'G', 0, 0};
+// Reads back in another order on machines of the other endianness.
+static const UINT32 kByteOrder = 0x01020304;
+
+struct FileHeader {
+    char magic[8];
+    UINT32 version;
+    UINT32 byte_order;
+    UINT32 char_size;
+    // Followed by the UINT64 offset of each pattern.
+    UINT32 count;
+};
+
+// Per pattern, followed by its Inst array, RepeatRecord array, the length
+// of each literal, the UINT32 code units of the literals and, if
+// kMemoize, a byte per instruction. Each part starts 8-byte aligned.
+struct PatternHeader {
+    UINT32 inst_count;
+    UINT32 repeat_count;
+    UINT32 literal_count;
+    UINT32 unit_count;
+    // Of the matcher and of the program.
+    UINT32 capture_count;
+    UINT32 program_capture_count;
+    int final;
+    UINT32 flags;
+    UINT32 prefilter;
+    UINT32 unused;
+    UINT64 max_length;
+};
+
+struct RepeatRecord {
+    int repeat_id;
+    UINT32 min;
+    UINT32 max;
+    UINT8 has_max;
+    UINT8 greedy;
+    UINT16 unused;
+};
+
+static_assert(sizeof(FileHeader) == 24, "FileHeader layout");
+static_assert(sizeof(PatternHeader) == 48, "PatternHeader layout");
+static_assert(sizeof(RepeatRecord) == 16, "RepeatRecord layout");
+
+enum PatternFlag : UINT32 {
+    kUtf8 = 1,
+    kDfa = 2,
+    kCaptureHistory = 4,
+    kBacktrackCaptures = 8,
+    kMemoize = 16,
+    kJit = 32,
+};
+
+enum PrefilterKind : UINT32 {
+    kAny,
+    kPrefix,
+    kFirstChar,
+    kRequired,
+};
+
+// The data of an empty vector may be null, so nothing is copied then.
+template <typename T>
+static void Append(RBytes * image, const T * data, size_t count) {
+    if (count == 0)
+        return;
+    image->append(reinterpret_cast<const char *>(data), sizeof(T) * count);
+    image->resize((image->size() + 7) / 8 * 8, '\0');
+}
+
+// Bounds-checked reads of aligned parts of an image.
+class ImageReader {
+public:
+    ImageReader(RByteView image, UINT64 pos)
+        : image_(image)
+        , pos_(pos) {
+    }
+
+    // Null if the image is too short.
+    template <typename T>
+    const T * Take(UINT64 count) {
+        if (pos_ > image_.size() || pos_ % 8 != 0 ||
+            count > (image_.size() - pos_) / sizeof(T))
+            return nullptr;
+        const T * data = reinterpret_cast<const T *>(image_.data() + pos_);
+        pos_ = (pos_ + sizeof(T) * count + 7) / 8 * 8;
+        return data;
+    }
+
+private:
+    RByteView image_;
+    UINT64 pos_;
+};
+
+// Every jump lands on an instruction, and every index is in range.
+static bool IsValidProgram(const Inst * insts,
+                           const PatternHeader & header) {
+    int size = static_cast<int>(header.inst_count);
+    auto target = [size](int pc) { return pc >= 0 && pc < size; };
+    for (int pc = 0; pc < size; ++pc)
+    {
+        const Inst & inst = insts[pc];
+        switch (inst.op)
+        {
+            case Inst::CHAR:
+            case Inst::JMP:
+                if (!target(inst.x))
+                    return false;
+                break;
+            case Inst::ASSERT:
+            case Inst::ATOMIC:
+                if (!target(inst.x) || pc + 1 >= size)
+                    return false;
+                break;
+            case Inst::BACKREF:
+                if (!target(inst.x) ||
+                    inst.arg >= header.program_capture_count)
+                    return false;
+                break;
+            case Inst::SPLIT:
+                if (!target(inst.x) || !target(inst.y))
+                    return false;
+                break;
+            case Inst::REPEAT:
+                if (!target(inst.x) || !target(inst.y) ||
+                    inst.arg >= header.repeat_count)
+                    return false;
+                break;
+            case Inst::SAVE:
+                if (inst.arg / 2 >= header.program_capture_count ||
+                    pc + 1 >= size)
+                    return false;
+                break;
+            case Inst::END:
+                if (pc + 1 >= size)
+                    return false;
+                break;
+            case Inst::MATCH:
+                break;
+            default:
+                return false;
+        }
+    }
+    return target(header.final) && insts[header.final].op == Inst::MATCH;
+}
+
+// Only what a DFA can simulate, as IsDfaCompatible allows when compiling.
+static bool IsDfaProgram(const Inst * insts, UINT32 inst_count) {
+    for (UINT32 pc = 0; pc < inst_count; ++pc)
+    {
+        switch (insts[pc].op)
+        {
+            case Inst::BACKREF:
+            case Inst::ASSERT:
+            case Inst::ATOMIC:
+            case Inst::END:
+            case Inst::REPEAT:
+                return false;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+RBytes ProgramFile::Write(const std::vector<EnfaMatcher> & matchers) {
+    FileHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byte_order = kByteOrder;
+    header.char_size = sizeof(RChar);
+    header.count = static_cast<UINT32>(matchers.size());
+
+    RBytes image;
+    Append(&image, &header, 1);
+    size_t offsets_pos = image.size();
+    std::vector<UINT64> offsets(matchers.size());
+    Append(&image, offsets.data(), offsets.size());
+
+    for (size_t i = 0; i < matchers.size(); ++i)
+    {
+        const EnfaMatcher & m = matchers[i];
+        const Program & program = *m.program_;
+        const Prefilter & prefilter = m.prefilter_;
+        offsets[i] = image.size();
+
+        std::vector<RString> literals;
+        PatternHeader p = {};
+        if (!prefilter.prefix_.empty())
+        {
+            p.prefilter = kPrefix;
+            literals = {prefilter.prefix_};
+        }
+        else if (!prefilter.first_chars_.empty())
+        {
+            p.prefilter = kFirstChar;
+            literals = {RString(prefilter.first_chars_.begin(),
+                                prefilter.first_chars_.end())};
+        }
+        else if (!prefilter.literals_.empty())
+        {
+            p.prefilter = kRequired;
+            literals = prefilter.literals_;
+        }
+        std::vector<UINT32> lengths, units;
+        for (const RString & literal : literals)
+        {
+            lengths.push_back(static_cast<UINT32>(literal.size()));
+            for (RChar c : literal)
+                units.push_back(CodeUnit(c));
+        }
+
+        std::vector<RepeatRecord> repeats;
+        for (UINT32 r = 0; r < program.RepeatCount(); ++r)
+        {
+            const RepeatTag & tag = program.Repeat(r);
+            // Bounds are parsed as UINT32.
+            repeats.push_back({tag.repeat_id,
+                               static_cast<UINT32>(tag.min),
+                               static_cast<UINT32>(tag.max),
+                               tag.has_max,
+                               tag.qualifier == RepeatTag::GREEDY,
+                               0});
+        }
+
+        p.inst_count = static_cast<UINT32>(program.Size());
+        p.repeat_count = static_cast<UINT32>(repeats.size());
+        p.literal_count = static_cast<UINT32>(lengths.size());
+        p.unit_count = static_cast<UINT32>(units.size());
+        p.capture_count = static_cast<UINT32>(m.capture_count_);
+        p.program_capture_count = static_cast<UINT32>(program.CaptureCount());
+        p.final = program.Final();
+        p.flags = (m.utf8_ ? kUtf8 : 0) | (m.dfa_ ? kDfa : 0) |
+            (m.capture_history_ ? kCaptureHistory : 0) |
+            (m.backtrack_captures_ ? kBacktrackCaptures : 0) |
+            (m.memoizable_ ? kMemoize : 0) | (m.dense_ ? kJit : 0);
+        p.max_length = prefilter.max_length_;
+
+        Append(&image, &p, 1);
+        // Copied field by field, so padding is zero and images of the same
+        // patterns are the same.
+        std::vector<Inst> insts(program.Size());
+        std::memset(insts.data(), 0, sizeof(Inst) * insts.size());
+        for (size_t pc = 0; pc < insts.size(); ++pc)
+        {
+            const Inst & inst = program[static_cast<int>(pc)];
+            insts[pc].op = inst.op;
+            insts[pc].flag = inst.flag;
+            insts[pc].arg = inst.arg;
+            insts[pc].x = inst.x;
+            insts[pc].y = inst.y;
+        }
+        Append(&image, insts.data(), insts.size());
+        Append(&image, repeats.data(), repeats.size());
+        Append(&image, lengths.data(), lengths.size());
+        Append(&image, units.data(), units.size());
+        if (m.memoizable_)
+        {
+            std::vector<UINT8> memoizable(m.memoizable_->begin(),
+                                          m.memoizable_->end());
+            Append(&image, memoizable.data(), memoizable.size());
+        }
+    }
+
+    if (!offsets.empty())
+    {
+        std::memcpy(&image[offsets_pos],
+                    offsets.data(),
+                    sizeof(UINT64) * offsets.size());
+    }
+    return image;
+}
+
+bool ProgramFile::Save(const std::string & path,
+                       const std::vector<EnfaMatcher> & matchers) {
+    RBytes image = Write(matchers);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(image.data(), static_cast<std::streamsize>(image.size()));
+    file.close();
+    return !file.fail();
+}
+
+ProgramFile::ProgramFile() {
+}
+
+bool ProgramFile::Open(const std::string & path) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(path))
+        return false;
+    return Parse(file->Bytes(), file);
+}
+
+bool ProgramFile::Load(RByteView image) {
+    return Parse(image, nullptr);
+}
+
+bool ProgramFile::Parse(RByteView image, std::shared_ptr<const void> storage) {
+    matchers_.clear();
+    if (reinterpret_cast<uintptr_t>(image.data()) % 8 != 0)
+        return false;
+
+    ImageReader reader(image, 0);
+    const FileHeader * header = reader.Take<FileHeader>(1);
+    if (!header || std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+        header->version != kVersion || header->byte_order != kByteOrder ||
+        header->char_size != sizeof(RChar))
+        return false;
+    const UINT64 * offsets = reader.Take<UINT64>(header->count);
+    if (!offsets)
+        return false;
+
+    std::vector<EnfaMatcher> matchers;
+    for (UINT32 i = 0; i < header->count; ++i)
+    {
+        ImageReader pattern(image, offsets[i]);
+        const PatternHeader * p = pattern.Take<PatternHeader>(1);
+        if (!p)
+            return false;
+        const Inst * insts = pattern.Take<Inst>(p->inst_count);
+        const RepeatRecord * repeats =
+            pattern.Take<RepeatRecord>(p->repeat_count);
+        const UINT32 * lengths = pattern.Take<UINT32>(p->literal_count);
+        const UINT32 * units = pattern.Take<UINT32>(p->unit_count);
+        const UINT8 * memoizable =
+            (p->flags & kMemoize) ? pattern.Take<UINT8>(p->inst_count)
+                                  : nullptr;
+        if (!insts || !repeats || !lengths || !units ||
+            ((p->flags & kMemoize) && !memoizable) ||
+            !IsValidProgram(insts, *p))
+            return false;
+        // The Pike VM keeps a slot pair per group of the matcher, which
+        // every SAVE must fit in.
+        if (p->capture_count < p->program_capture_count)
+            return false;
+        if ((p->flags & (kDfa | kJit)) && !IsDfaProgram(insts, p->inst_count))
+            return false;
+
+        std::vector<RString> literals;
+        UINT64 unit = 0;
+        for (UINT32 l = 0; l < p->literal_count; ++l)
+        {
+            if (lengths[l] > p->unit_count - unit)
+                return false;
+            literals.emplace_back(units + unit, units + unit + lengths[l]);
+            unit += lengths[l];
+        }
+        Prefilter prefilter;
+        switch (p->prefilter)
+        {
+            case kAny:
+                break;
+            case kPrefix:
+                if (literals.size() != 1 || literals[0].empty())
+                    return false;
+                prefilter = Prefilter::Prefix(literals[0]);
+                break;
+            case kFirstChar:
+                if (literals.size() != 1 || literals[0].empty() ||
+                    literals[0].size() > Prefilter::kMaxFirstChars)
+                    return false;
+                prefilter = Prefilter::FirstChar(
+                    std::vector<RChar>(literals[0].begin(), literals[0].end()));
+                break;
+            case kRequired:
+                if (literals.empty() ||
+                    literals.size() > Prefilter::kMaxLiterals)
+                    return false;
+                prefilter = Prefilter::Required(
+                    literals, static_cast<size_t>(p->max_length));
+                break;
+            default:
+                return false;
+        }
+
+        std::vector<RepeatTag> tags;
+        for (UINT32 r = 0; r < p->repeat_count; ++r)
+        {
+            tags.push_back({repeats[r].repeat_id,
+                            repeats[r].min,
+                            repeats[r].max,
+                            repeats[r].has_max != 0,
+                            repeats[r].greedy ? RepeatTag::GREEDY
+                                              : RepeatTag::RELUCTANT});
+        }
+        auto program = std::make_shared<const Program>(insts,
+                                                       p->inst_count,
+                                                       tags,
+                                                       p->program_capture_count,
+                                                       p->final,
+                                                       storage);
+
+        EnfaMatcher m;
+        m.program_ = program;
+        m.utf8_ = (p->flags & kUtf8) != 0;
+        m.capture_count_ = p->capture_count;
+        m.prefilter_ = prefilter;
+        if (p->flags & kDfa)
+        {
+            m.dfa_ = std::make_shared<DfaMatcher>(program, prefilter);
+            m.reverse_dfa_ =
+                std::make_shared<DfaMatcher>(Program::Reverse(*program));
+            m.pike_vm_ =
+                std::make_shared<PikeVmMatcher>(program, p->capture_count);
+            if (p->flags & kJit)
+                m.dense_ = EnfaMatcher::BuildJit(*program);
+        }
+        m.capture_history_ = (p->flags & kCaptureHistory) != 0;
+        m.backtrack_captures_ = (p->flags & kBacktrackCaptures) != 0;
+        if (memoizable)
+        {
+            m.memoizable_ = std::make_shared<std::vector<bool>>(
+                memoizable, memoizable + p->inst_count);
+        }
+        if (m.dfa_ || m.memoizable_)
+            m.scratch_pool_ = std::make_shared<MatchScratchPool>();
+        matchers.push_back(m);
+    }
+    matchers_ = std::move(matchers);
+    return true;
+}
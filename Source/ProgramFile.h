@@ -0,0 +1,51 @@
+#pragma once
+
+#include "EnfaMatcher.h"
+#include "RegexSyntax.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Compiled patterns saved to a file, to be loaded without compiling again.
+ *
+ * The file is a header, the offset of each pattern, then per pattern its
+ * instructions exactly as Program holds them in memory, followed by the
+ * little the matcher needs besides: repeat bounds, prefilter literals and
+ * memoizable instructions. Loading maps the file and runs the instructions
+ * where they lie; only the rest is decoded. A file only loads with the
+ * format version, byte order and wchar_t size it was written with.
+ */
+class ProgramFile {
+public:
+    static const UINT32 kVersion = 1;
+
+    // The file image of 'matchers', in order.
+    static RBytes Write(const std::vector<EnfaMatcher> & matchers);
+    // False if 'path' can't be written.
+    static bool Save(const std::string & path,
+                     const std::vector<EnfaMatcher> & matchers);
+
+    ProgramFile();
+
+    // Map 'path'. False if it can't be mapped or isn't a program file this
+    // build can load.
+    bool Open(const std::string & path);
+    // The same for an image in memory, aligned to 8 bytes, which must
+    // outlive every matcher loaded from it.
+    bool Load(RByteView image);
+
+    size_t Size() const {
+        return matchers_.size();
+    }
+    // Matchers keep the mapping alive, so they may outlive this.
+    const EnfaMatcher & Matcher(size_t index) const {
+        return matchers_[index];
+    }
+
+private:
+    bool Parse(RByteView image, std::shared_ptr<const void> storage);
+
+    std::vector<EnfaMatcher> matchers_;
+};
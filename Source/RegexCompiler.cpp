@@ -1,13 +1,15 @@
 #include "stdafx.h"
 
 #include "Postfix.h"
+#include "Prefilter.h"
 #include "RegexCompiler.h"
 #include "RegexSyntax.h"
 #include "util.h"
 
-EnfaState * PostfixToEnfa(std::vector<PostfixNode> & nl) {
+std::shared_ptr<EnfaGraph> PostfixToEnfa(std::vector<PostfixNode> & nl) {
     using StatePort = EnfaStateBuilder::StatePort;
 
+    EnfaStateBuilder builder;
     std::vector<StatePort> st;
 
 #define PUSH(x) st.emplace_back(x)
@@ -20,32 +22,31 @@ EnfaState * PostfixToEnfa(std::vector<PostfixNode> & nl) {
         switch (n.type)
         {
             case PostfixNode::NULL_INPUT:
-                // TODO: support null branch
-                RAssert(false);
+                PUSH(builder.Empty());
                 break;
             case PostfixNode::CHAR_INPUT:
-                PUSH(EnfaStateBuilder::Char(n.chr));
+                PUSH(builder.Char(n.chr));
                 break;
             case PostfixNode::BACKREF_INPUT:
-                PUSH(EnfaStateBuilder::BackReference(n.backref.capture_id));
+                PUSH(builder.BackReference(n.backref.capture_id));
                 break;
             case PostfixNode::REPEAT:
                 sp = POP();
-                PUSH(EnfaStateBuilder::Repeat(sp, n.repeat));
+                PUSH(builder.Repeat(sp, n.repeat));
                 break;
             case PostfixNode::CONCAT:
                 sp2 = POP();
                 sp1 = POP();
-                PUSH(EnfaStateBuilder::Concat(sp1, sp2));
+                PUSH(builder.Concat(sp1, sp2));
                 break;
             case PostfixNode::ALTER:
                 sp2 = POP();
                 sp1 = POP();
-                PUSH(EnfaStateBuilder::Alter(sp1, sp2));
+                PUSH(builder.Alter(sp1, sp2));
                 break;
             case PostfixNode::GROUP:
                 sp = POP();
-                sp = EnfaStateBuilder::Group(sp);
+                sp = builder.Group(sp);
                 if (n.group.type == Group::CAPTURE)
                 {
                     sp.in->Tags().SetCaptureTag({n.group.capture_id, true});
@@ -84,16 +85,457 @@ EnfaState * PostfixToEnfa(std::vector<PostfixNode> & nl) {
     StatePort sp;
     sp = POP();
     RAssert(st.empty());
-    sp.out->SetFinal();
 
 #undef POP
 #undef PUSH
 
-    return sp.in;
+    return builder.Build(sp);
+}
+
+// What every match of a sub-pattern starts with and contains.
+//
+// Literal sets are empty when unknown. Unless the sub-pattern is finite,
+// every match starts with one of 'starts', ends with one of 'ends' and
+// contains one of 'required'.
+struct LiteralInfo {
+    // Every match starts with 'prefix'.
+    RString prefix;
+    // Every match is exactly 'prefix'.
+    bool exact;
+    bool nullable;
+    // 'first' holds every possible first char of a non-empty match.
+    bool first_known;
+    std::set<RChar> first;
+    // Longest match, Prefilter::kUnbounded if there is no limit.
+    size_t max_length;
+    // 'all' is the set of all matches.
+    bool finite;
+    std::set<RString> all;
+    std::set<RString> starts;
+    std::set<RString> ends;
+    std::set<RString> required;
+};
+
+static LiteralInfo EmptyInfo() {
+    return LiteralInfo{L"", true, true, true, {}, 0, true, {L""}, {}, {}, {}};
+}
+
+static size_t AddLength(size_t a, size_t b) {
+    return (a == Prefilter::kUnbounded || b == Prefilter::kUnbounded)
+        ? Prefilter::kUnbounded
+        : a + b;
+}
+
+static size_t MinLength(const std::set<RString> & literals) {
+    size_t n = Prefilter::kUnbounded;
+    for (const RString & literal : literals)
+        n = std::min(n, literal.size());
+    return literals.empty() ? 0 : n;
+}
+
+// A set holding the empty string tells nothing.
+static std::set<RString> Known(const std::set<RString> & literals) {
+    return MinLength(literals) == 0 ? std::set<RString>() : literals;
+}
+
+static std::set<RString> Starts(const LiteralInfo & li) {
+    return li.finite ? Known(li.all) : li.starts;
+}
+
+static std::set<RString> Ends(const LiteralInfo & li) {
+    return li.finite ? Known(li.all) : li.ends;
+}
+
+static std::set<RString> Required(const LiteralInfo & li) {
+    return li.finite ? Known(li.all) : li.required;
+}
+
+// All concatenations of a string of 'a' with a string of 'b'; false if
+// there are too many.
+static bool Cross(const std::set<RString> & a,
+                  const std::set<RString> & b,
+                  std::set<RString> * product) {
+    product->clear();
+    if (a.size() * b.size() > Prefilter::kMaxLiterals)
+        return false;
+    for (const RString & s1 : a)
+    {
+        for (const RString & s2 : b)
+            product->insert(s1 + s2);
+    }
+    return true;
+}
+
+// Union of two known sets, unknown if either is or it gets too big.
+static std::set<RString> Union(const std::set<RString> & a,
+                               const std::set<RString> & b) {
+    std::set<RString> u = a;
+    u.insert(b.begin(), b.end());
+    if (a.empty() || b.empty() || u.size() > Prefilter::kMaxLiterals)
+        u.clear();
+    return u;
+}
+
+// The more selective literal set: longer literals, then fewer of them.
+static std::set<RString> Better(const std::set<RString> & a,
+                                const std::set<RString> & b) {
+    if (MinLength(a) != MinLength(b))
+        return MinLength(a) > MinLength(b) ? a : b;
+    return a.size() <= b.size() ? a : b;
+}
+
+static LiteralInfo ConcatInfo(const LiteralInfo & li1,
+                              const LiteralInfo & li2) {
+    LiteralInfo li = li1;
+    if (li1.exact)
+        li.prefix += li2.prefix;
+    li.exact = li1.exact && li2.exact;
+    li.nullable = li1.nullable && li2.nullable;
+    if (li1.nullable)
+    {
+        li.first_known = li1.first_known && li2.first_known;
+        li.first.insert(li2.first.begin(), li2.first.end());
+    }
+    li.max_length = AddLength(li1.max_length, li2.max_length);
+
+    li.finite = li1.finite && li2.finite && Cross(li1.all, li2.all, &li.all);
+    if (li.finite)
+        return li;
+    li.all.clear();
+
+    std::set<RString> product;
+    li.starts = li1.starts;
+    if (li1.finite)
+    {
+        li.starts = Known(li1.all);
+        if (Cross(li1.all, Starts(li2), &product) && !Known(product).empty())
+            li.starts = product;
+    }
+    li.ends = li2.ends;
+    if (li2.finite)
+    {
+        li.ends = Known(li2.all);
+        if (Cross(Ends(li1), li2.all, &product) && !Known(product).empty())
+            li.ends = product;
+    }
+    // A match may hold a literal that straddles both halves.
+    li.required = Better(Required(li1), Required(li2));
+    if (Cross(Ends(li1), Starts(li2), &product))
+        li.required = Better(li.required, Known(product));
+    return li;
+}
+
+static LiteralInfo AlterInfo(const LiteralInfo & li1,
+                             const LiteralInfo & li2) {
+    LiteralInfo li = li1;
+    li.prefix.clear();
+    for (size_t i = 0; i < li1.prefix.size() && i < li2.prefix.size() &&
+         li1.prefix[i] == li2.prefix[i];
+         ++i)
+    {
+        li.prefix += li1.prefix[i];
+    }
+    li.exact = li1.exact && li2.exact && li1.prefix == li2.prefix;
+    li.nullable = li1.nullable || li2.nullable;
+    li.first_known = li1.first_known && li2.first_known;
+    li.first.insert(li2.first.begin(), li2.first.end());
+    li.max_length = std::max(li1.max_length, li2.max_length);
+
+    li.finite = li1.finite && li2.finite;
+    li.all.insert(li2.all.begin(), li2.all.end());
+    if (li.finite && li.all.size() <= Prefilter::kMaxLiterals)
+        return li;
+    li.finite = false;
+    li.all.clear();
+    li.starts = Union(Starts(li1), Starts(li2));
+    li.ends = Union(Ends(li1), Ends(li2));
+    li.required = Union(Required(li1), Required(li2));
+    return li;
+}
+
+static LiteralInfo RepeatInfo(const LiteralInfo & unit,
+                              const Repeat & repeat) {
+    if (repeat.has_max && repeat.max == 0)
+        return EmptyInfo();
+
+    LiteralInfo li = unit;
+    if (repeat.min == 0)
+    {
+        li.prefix.clear();
+        li.exact = false;
+        li.nullable = true;
+        li.finite = false;
+        li.all.clear();
+        li.starts.clear();
+        li.ends.clear();
+        li.required.clear();
+    }
+    else
+    {
+        for (size_t i = 1; i < repeat.min; ++i)
+            li = ConcatInfo(li, unit);
+        // Every match starts, ends with and contains 'min' repetitions.
+        if (!repeat.has_max || repeat.max != repeat.min)
+        {
+            li.exact = false;
+            li.starts = Starts(li);
+            li.ends = Ends(li);
+            li.required = Required(li);
+            li.finite = false;
+            li.all.clear();
+        }
+    }
+    if (unit.max_length == 0)
+        li.max_length = 0;
+    else if (!repeat.has_max || unit.max_length == Prefilter::kUnbounded ||
+             repeat.max > Prefilter::kUnbounded / 2 / unit.max_length)
+        li.max_length = Prefilter::kUnbounded;
+    else
+        li.max_length = repeat.max * unit.max_length;
+    return li;
+}
+
+Prefilter PostfixToPrefilter(const std::vector<PostfixNode> & nl) {
+    std::vector<LiteralInfo> st;
+
+#define PUSH(x) st.emplace_back(x)
+#define POP() st.back(), st.pop_back()
+
+    for (const PostfixNode & n : nl)
+    {
+        LiteralInfo li, li1, li2;
+        switch (n.type)
+        {
+            case PostfixNode::NULL_INPUT:
+                PUSH(EmptyInfo());
+                break;
+            case PostfixNode::CHAR_INPUT:
+                PUSH((LiteralInfo{RString(1, n.chr),
+                                  true,
+                                  false,
+                                  true,
+                                  {n.chr},
+                                  1,
+                                  true,
+                                  {RString(1, n.chr)},
+                                  {},
+                                  {},
+                                  {}}));
+                break;
+            case PostfixNode::BACKREF_INPUT:
+                PUSH((LiteralInfo{L"",
+                                  false,
+                                  true,
+                                  false,
+                                  {},
+                                  Prefilter::kUnbounded,
+                                  false,
+                                  {},
+                                  {},
+                                  {},
+                                  {}}));
+                break;
+            case PostfixNode::REPEAT:
+                li = POP();
+                PUSH(RepeatInfo(li, n.repeat));
+                break;
+            case PostfixNode::CONCAT:
+                li2 = POP();
+                li1 = POP();
+                PUSH(ConcatInfo(li1, li2));
+                break;
+            case PostfixNode::ALTER:
+                li2 = POP();
+                li1 = POP();
+                PUSH(AlterInfo(li1, li2));
+                break;
+            case PostfixNode::GROUP:
+                // Look-around consumes nothing.
+                if (n.group.type == Group::LOOK_AHEAD ||
+                    n.group.type == Group::LOOK_BEHIND)
+                {
+                    st.back() = EmptyInfo();
+                }
+                break;
+            default:
+                RAssert(false);
+                break;
+        }
+    }
+
+#undef POP
+#undef PUSH
+
+    RAssert(st.size() == 1);
+    const LiteralInfo & li = st.back();
+    if (!li.prefix.empty())
+        return Prefilter::Prefix(li.prefix);
+    // A short literal set is no better than its first chars.
+    std::set<RString> required = Required(li);
+    bool use_first = !li.nullable && li.first_known &&
+        li.first.size() <= Prefilter::kMaxFirstChars;
+    if (!required.empty() && (!use_first || MinLength(required) > 1))
+    {
+        return Prefilter::Required(
+            std::vector<RString>(required.begin(), required.end()),
+            li.max_length);
+    }
+    if (use_first)
+    {
+        return Prefilter::FirstChar(
+            std::vector<RChar>(li.first.begin(), li.first.end()));
+    }
+    return Prefilter();
+}
+
+// A DFA can simulate the pattern if it has no back references, look-around,
+// atomic groups or repeats that need a counter.
+bool IsDfaCompatible(const std::vector<PostfixNode> & nl) {
+    for (const PostfixNode & n : nl)
+    {
+        if (n.type == PostfixNode::BACKREF_INPUT)
+            return false;
+        if (n.type == PostfixNode::GROUP && n.group.type != Group::CAPTURE &&
+            n.group.type != Group::NON_CAPTURE)
+            return false;
+        if (n.type == PostfixNode::REPEAT &&
+            (n.repeat.min > 1 || (n.repeat.has_max && n.repeat.max != 1)))
+            return false;
+    }
+    return true;
+}
+
+// Unrolled repeats repeat their groups, so count distinct ids.
+size_t CaptureCount(const std::vector<PostfixNode> & nl) {
+    size_t count = 0;
+    for (const PostfixNode & n : nl)
+    {
+        if (n.type == PostfixNode::GROUP && n.group.type == Group::CAPTURE)
+            count = std::max(count, n.group.capture_id + 1);
+    }
+    return count;
+}
+
+// Instructions on a loop whose body can match empty: going round depends
+// on where the iteration started, kept in Registers, not only on the input
+// position. Those are the ones on a cycle through a loop head.
+std::vector<bool> GuardedLoopInsts(const Program & prog) {
+    std::vector<bool> guarded(prog.Size(), false);
+    if (prog.LoopCount() == 0)
+        return guarded;
+    std::vector<std::vector<int>> in(prog.Size());
+    for (int pc = 0; pc < static_cast<int>(prog.Size()); ++pc)
+    {
+        for (int next : prog.Next(pc))
+            in[next].push_back(pc);
+    }
+    for (int head = 0; head < static_cast<int>(prog.Size()); ++head)
+    {
+        if (prog.Loop(head) < 0)
+            continue;
+        // Reachable from the head both ways.
+        std::vector<bool> from(prog.Size(), false), to(prog.Size(), false);
+        std::vector<int> v = {head};
+        while (!v.empty())
+        {
+            int pc = v.back();
+            v.pop_back();
+            if (from[pc])
+                continue;
+            from[pc] = true;
+            std::vector<int> next = prog.Next(pc);
+            v.insert(v.end(), next.begin(), next.end());
+        }
+        v = {head};
+        while (!v.empty())
+        {
+            int pc = v.back();
+            v.pop_back();
+            if (to[pc])
+                continue;
+            to[pc] = true;
+            v.insert(v.end(), in[pc].begin(), in[pc].end());
+        }
+        for (size_t pc = 0; pc < prog.Size(); ++pc)
+        {
+            if (from[pc] && to[pc])
+                guarded[pc] = true;
+        }
+    }
+    return guarded;
 }
 
-EnfaMatcher RegexCompiler::CompileToEnfa(RString regex) {
-    EnfaState * start;
+// Captures made inside a loop whose body can match empty. Backtracking
+// keeps those of an empty last iteration, as Perl does, which the Pike VM
+// doesn't.
+bool HasGuardedCapture(const Program & prog) {
+    std::vector<bool> guarded = GuardedLoopInsts(prog);
+    for (int pc = 0; pc < static_cast<int>(prog.Size()); ++pc)
+    {
+        if (guarded[pc] && prog[pc].op == Inst::SAVE)
+            return true;
+    }
+    return false;
+}
+
+// Instructions whose match outcome only depends on the input position.
+// Captures matter if a back reference is reachable, counters matter inside
+// counted repeats, and where an iteration started inside loops that can
+// match empty.
+std::vector<bool> MemoizableInsts(const Program & prog) {
+    std::vector<bool> memoizable = GuardedLoopInsts(prog);
+    memoizable.flip();
+
+    std::vector<std::vector<int>> in(prog.Size());
+    std::vector<int> v;
+    for (int pc = 0; pc < static_cast<int>(prog.Size()); ++pc)
+    {
+        for (int next : prog.Next(pc))
+            in[next].push_back(pc);
+        if (prog[pc].op == Inst::BACKREF)
+            v.push_back(pc);
+    }
+    while (!v.empty())
+    {
+        int pc = v.back();
+        v.pop_back();
+        if (memoizable[pc])
+        {
+            memoizable[pc] = false;
+            v.insert(v.end(), in[pc].begin(), in[pc].end());
+        }
+    }
+
+    for (int repeat = 0; repeat < static_cast<int>(prog.Size()); ++repeat)
+    {
+        if (prog[repeat].op != Inst::REPEAT)
+            continue;
+        // The repeat body: reachable from the loop edge without leaving
+        // through the REPEAT instruction.
+        std::set<int> body = {repeat};
+        v = {prog[repeat].x};
+        while (!v.empty())
+        {
+            int pc = v.back();
+            v.pop_back();
+            if (body.insert(pc).second)
+            {
+                std::vector<int> next = prog.Next(pc);
+                v.insert(v.end(), next.begin(), next.end());
+            }
+        }
+        for (int pc : body)
+            memoizable[pc] = false;
+    }
+
+    return memoizable;
+}
+
+EnfaMatcher RegexCompiler::CompileToEnfa(RString regex, MatchOptions options) {
+    std::shared_ptr<const Program> program;
+    size_t capture_count;
+    bool use_dfa;
+    Prefilter prefilter;
     {
 #ifdef DEBUG
         std::wcout << L"pattern: " << regex << std::endl;
@@ -105,19 +547,73 @@ EnfaMatcher RegexCompiler::CompileToEnfa(RString regex) {
         std::wcout << std::endl;
 #endif
 
+        // Before flipping, so look-behind sees the bytes in reverse too.
+        if (options.utf8)
+            nl = EncodeUtf8(nl);
+
         nl = FlipPostfix(nl);
 #ifdef DEBUG
         for (auto n : nl)
             std::wcout << n.DebugString() << " ";
         std::wcout << std::endl;
 #endif
-        start = PostfixToEnfa(nl);
+
+        nl = SimplifyPostfix(nl);
 #ifdef DEBUG
-        std::wcout << EnfaState::DebugString(start) << std::endl;
+        for (auto n : nl)
+            std::wcout << n.DebugString() << " ";
+        std::wcout << std::endl;
+#endif
+
+        nl = UnrollRepeats(nl);
+#ifdef DEBUG
+        for (auto n : nl)
+            std::wcout << n.DebugString() << " ";
+        std::wcout << std::endl;
+#endif
+        capture_count = CaptureCount(nl);
+        use_dfa = IsDfaCompatible(nl);
+        prefilter = PostfixToPrefilter(nl);
+        // The ENFA is only needed to lay out the program.
+        std::shared_ptr<EnfaGraph> graph = PostfixToEnfa(nl);
+        program = std::make_shared<Program>(*graph);
+#ifdef DEBUG
+        std::wcout << EnfaState::DebugString(graph->Start()) << std::endl;
+        std::wcout << program->DebugString() << std::endl;
 #endif
     }
 
     EnfaMatcher enfa;
-    enfa.start_ = start;
+    enfa.program_ = program;
+    enfa.utf8_ = options.utf8;
+    enfa.capture_count_ = capture_count;
+    enfa.prefilter_ = prefilter;
+    // The Pike VM can't run back references, look-around or atomic groups,
+    // nor keep capture history: those patterns are backtracked instead.
+    MatchOptions::Engine engine = options.engine;
+    if (engine == MatchOptions::PIKE_VM &&
+        (!use_dfa || options.capture_history))
+        engine = MatchOptions::BACKTRACK;
+    if (use_dfa && engine != MatchOptions::BACKTRACK)
+    {
+        enfa.dfa_ = std::make_shared<DfaMatcher>(program, prefilter);
+        enfa.reverse_dfa_ =
+            std::make_shared<DfaMatcher>(Program::Reverse(*program));
+        enfa.pike_vm_ = std::make_shared<PikeVmMatcher>(program, capture_count);
+        if (options.jit && options.utf8)
+            enfa.dense_ = EnfaMatcher::BuildJit(*program);
+    }
+    enfa.capture_history_ = options.capture_history;
+    enfa.backtrack_captures_ = capture_count > 1 &&
+        ((options.capture_history && engine == MatchOptions::AUTO) ||
+         (enfa.pike_vm_ && HasGuardedCapture(*program)));
+    // The DFA's matches are memoized when backtracked for their groups.
+    if (options.memoize || enfa.dfa_)
+    {
+        enfa.memoizable_ =
+            std::make_shared<std::vector<bool>>(MemoizableInsts(*program));
+    }
+    if (enfa.dfa_ || enfa.memoizable_)
+        enfa.scratch_pool_ = std::make_shared<MatchScratchPool>();
     return enfa;
 }
@@ -4,5 +4,6 @@
 
 class RegexCompiler {
 public:
-    static EnfaMatcher CompileToEnfa(RString regex);
+    static EnfaMatcher CompileToEnfa(RString regex,
+                                     MatchOptions options = MatchOptions());
 };
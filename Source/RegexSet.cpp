@@ -0,0 +1,120 @@
+#include "stdafx.h"
+
+#include "RegexCompiler.h"
+#include "RegexSet.h"
+#include "util.h"
+
+#include <mutex>
+
+// Scratch kept for reuse by calls that don't bring their own.
+class RegexSet::ScratchPool {
+public:
+    std::unique_ptr<Scratch> Take(const RegexSet & set) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty())
+            {
+                std::unique_ptr<Scratch> scratch = std::move(free_.back());
+                free_.pop_back();
+                return scratch;
+            }
+        }
+        return std::unique_ptr<Scratch>(new Scratch(set));
+    }
+    void Give(std::unique_ptr<Scratch> scratch) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(scratch));
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Scratch>> free_;
+};
+
+RegexSet::RegexSet(const std::vector<RString> & patterns,
+                   MatchOptions options)
+    : size_(patterns.size())
+    , utf8_(options.utf8)
+    , scratch_pool_(std::make_shared<ScratchPool>()) {
+    std::vector<std::shared_ptr<const Program>> programs;
+    for (size_t i = 0; i < patterns.size(); ++i)
+    {
+        EnfaMatcher enfa = RegexCompiler::CompileToEnfa(patterns[i], options);
+        if (enfa.dfa_)
+        {
+            joined_.push_back(i);
+            programs.push_back(enfa.program_);
+        }
+        else
+            others_.emplace_back(i, enfa);
+    }
+    if (programs.empty())
+        return;
+    std::vector<const Program *> union_of;
+    for (const auto & program : programs)
+        union_of.push_back(program.get());
+    auto program = std::make_shared<Program>(union_of);
+    dfa_ = std::make_shared<DfaMatcher>(program);
+    dense_ = DenseDfa::Build(*program, false, true, options.jit);
+}
+
+size_t RegexSet::Size() const {
+    return size_;
+}
+
+bool RegexSet::IsJitted() const {
+    return dense_ && dense_->IsJitted();
+}
+
+std::vector<size_t> RegexSet::Matches(RView text, Scratch * scratch) const {
+    if (scratch)
+        return MatchesText(text, scratch);
+    std::unique_ptr<Scratch> borrowed = scratch_pool_->Take(*this);
+    std::vector<size_t> matches = MatchesText(text, borrowed.get());
+    scratch_pool_->Give(std::move(borrowed));
+    return matches;
+}
+
+std::vector<size_t> RegexSet::Matches(RByteView text,
+                                      Scratch * scratch) const {
+    if (scratch)
+        return MatchesText(text, scratch);
+    std::unique_ptr<Scratch> borrowed = scratch_pool_->Take(*this);
+    std::vector<size_t> matches = MatchesText(text, borrowed.get());
+    scratch_pool_->Give(std::move(borrowed));
+    return matches;
+}
+
+template <typename CharT>
+std::vector<size_t> RegexSet::MatchesText(StringView<CharT> text,
+                                          Scratch * scratch) const {
+    RAssert(utf8_ == (sizeof(CharT) == 1));
+    RAssert(scratch->owner_ == dfa_.get());
+    std::vector<bool> matched(size_);
+    if (dfa_)
+    {
+        std::vector<bool> joined_matched(joined_.size());
+        if (dense_)
+            dense_->SearchAll(text, &joined_matched);
+        else
+            dfa_->SearchAll(text, &joined_matched, scratch->dfa_.get());
+        for (size_t i = 0; i < joined_.size(); ++i)
+            matched[joined_[i]] = joined_matched[i];
+    }
+    for (const auto & other : others_)
+        matched[other.first] = other.second.Search(text).Matched();
+
+    std::vector<size_t> matches;
+    for (size_t i = 0; i < size_; ++i)
+    {
+        if (matched[i])
+            matches.push_back(i);
+    }
+    return matches;
+}
+
+RegexSet::Scratch::Scratch(const RegexSet & set)
+    : owner_(set.dfa_.get()) {
+    if (set.dfa_)
+        dfa_.reset(new DfaMatcher::Scratch(*set.dfa_));
+}
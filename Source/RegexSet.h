@@ -0,0 +1,63 @@
+#pragma once
+
+#include "DenseDfa.h"
+#include "DfaMatcher.h"
+#include "EnfaMatcher.h"
+#include "RegexSyntax.h"
+
+/*
+ * Many patterns matched together, reporting which of them match somewhere
+ * in the text.
+ *
+ * Patterns the DFA can run are joined into one union Program, whose MATCH
+ * instructions tell the patterns apart, so a single pass over the text
+ * finds them all however many there are. The others are searched one at a
+ * time.
+ */
+
+class RegexSet {
+public:
+    class Scratch;
+
+    RegexSet(const std::vector<RString> & patterns,
+             MatchOptions options = MatchOptions());
+
+    size_t Size() const;
+    // The union's DFA runs as machine code, see MatchOptions::jit.
+    bool IsJitted() const;
+    // Indices of the patterns matching somewhere in 'text', in increasing
+    // order. Calls without a scratch borrow one, as EnfaMatcher does.
+    std::vector<size_t> Matches(RView text, Scratch * scratch = nullptr) const;
+    std::vector<size_t> Matches(RByteView text,
+                                Scratch * scratch = nullptr) const;
+
+private:
+    class ScratchPool;
+
+    template <typename CharT>
+    std::vector<size_t> MatchesText(StringView<CharT> text,
+                                    Scratch * scratch) const;
+
+    size_t size_;
+    bool utf8_;
+    // Runs the union of the patterns in 'joined_', if there are any.
+    std::shared_ptr<const DfaMatcher> dfa_;
+    // Set when the union's DFA is small enough to build in full.
+    std::shared_ptr<const DenseDfa> dense_;
+    std::vector<size_t> joined_;
+    // The patterns the DFA can't run, with their indices.
+    std::vector<std::pair<size_t, EnfaMatcher>> others_;
+    std::shared_ptr<ScratchPool> scratch_pool_;
+};
+
+// DFA states built while matching a RegexSet, for one thread at a time.
+class RegexSet::Scratch {
+public:
+    explicit Scratch(const RegexSet & set);
+
+private:
+    friend class RegexSet;
+
+    const DfaMatcher * owner_;
+    std::unique_ptr<DfaMatcher::Scratch> dfa_;
+};
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "IntType.h"
 #include "StringView.h"
 
 #include <string>
+#include <type_traits>
 
 /*
 # regex grammar
@@ -18,13 +20,24 @@ template <typename CharT>
 struct RegexType {
     typedef CharT Char;
     typedef std::basic_string<CharT> String;
-    typedef StringView<CharT> StringView;
+    typedef ::StringView<CharT> StringView;
 };
 
 typedef RegexType<wchar_t>::Char RChar;
 typedef RegexType<wchar_t>::String RString;
 typedef RegexType<wchar_t>::StringView RView;
 
+// Raw UTF-8 text, matched a byte at a time.
+typedef RegexType<char>::Char RByte;
+typedef RegexType<char>::String RBytes;
+typedef RegexType<char>::StringView RByteView;
+
+// Value of a code unit, as instructions store it.
+template <typename CharT>
+constexpr UINT32 CodeUnit(CharT c) {
+    return static_cast<typename std::make_unsigned<CharT>::type>(c);
+}
+
 struct Group {
     enum Type {
         CAPTURE,
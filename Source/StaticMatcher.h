@@ -0,0 +1,985 @@
+#pragma once
+
+#include "Input.h"
+#include "RegexSyntax.h"
+
+#include <cstring>
+#include <cwchar>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Patterns known at build time, parsed by the C++ compiler.
+ *
+ *   static constexpr RChar kLogPrefix[] = L"((?:INFO|WARN) (?:0|1)*: )";
+ *   typedef StaticMatcher<kLogPrefix> LogPrefix;
+ *
+ *   LogPrefix::Result m;
+ *   if (LogPrefix::Search(line, 0, &m)) ...
+ *
+ * The pattern must be a constexpr array with linkage. It is parsed by
+ * constexpr code taking the grammar of ParseToPostfix, and a pattern that
+ * doesn't parse fails the build. Each node becomes a template calling the
+ * rest of the pattern as its continuation, so the compiler inlines the
+ * transitions into one backtracking matcher. Nothing is compiled at run
+ * time and nothing is allocated: matches are leftmost-first, with the last
+ * capture of each group, as EnfaMatcher finds them.
+ *
+ * Repeats of a single char, or of a group of single-char alternatives, are
+ * loops. Other repeats recurse once per iteration and an empty iteration
+ * that reaches the minimum ends the repeat, so this is for short fixed
+ * patterns such as line prefixes, not for long runs of a group.
+ */
+
+// A node of a parsed pattern. Children and siblings are node indices, -1
+// for none.
+struct StaticNode {
+    enum Kind {
+        CHAR,
+        BACKREF,
+        // A non-capture group of one-char alternatives.
+        SET,
+        SEQUENCE,
+        ALTER,
+        GROUP,
+        REPEAT,
+    };
+
+    Kind kind;
+    // CHAR: the char. BACKREF: the group. GROUP: a Group::Type.
+    UINT32 value;
+    // GROUP: the capture id. REPEAT: the repeat id.
+    int id;
+    int first;
+    int last;
+    int next;
+    int prev;
+    // REPEAT only.
+    UINT32 min;
+    UINT32 max;
+    bool has_max;
+    bool greedy;
+};
+
+enum StaticError {
+    STATIC_OK,
+    STATIC_EXPECTED_GROUP,
+    STATIC_UNCLOSED_GROUP,
+    STATIC_BAD_NUMBER,
+    // Not \1 to \9, or to a group the pattern doesn't have.
+    STATIC_BAD_BACKREF,
+    STATIC_BAD_REPEAT,
+    STATIC_NESTED_REPEAT,
+};
+
+template <size_t Capacity>
+struct StaticAst {
+    StaticNode nodes[Capacity];
+    int size;
+    // The group of the whole pattern, capture 0.
+    int root;
+    int group_count;
+    int repeat_count;
+    StaticError error;
+    // Where parsing stopped.
+    size_t error_pos;
+};
+
+constexpr size_t StaticLength(const RChar * regex) {
+    size_t n = 0;
+    while (regex[n])
+        ++n;
+    return n;
+}
+
+// Recursive descent in the steps of PostfixParser, building a tree.
+template <size_t Capacity>
+class StaticParser {
+public:
+    explicit constexpr StaticParser(const RChar * regex)
+        : regex_(regex)
+        , pos_(0)
+        , ast_() {
+    }
+
+    constexpr StaticAst<Capacity> Parse() {
+        ast_.error = STATIC_OK;
+        ast_.root = group();
+        for (int i = 0; i < ast_.size; ++i)
+        {
+            if (ast_.nodes[i].kind == StaticNode::BACKREF &&
+                static_cast<int>(ast_.nodes[i].value) >= ast_.group_count)
+                Fail(STATIC_BAD_BACKREF);
+        }
+        if (ast_.error != STATIC_OK)
+            ast_.error_pos = pos_;
+        return ast_;
+    }
+
+private:
+    constexpr RChar Peek() const {
+        return regex_[pos_];
+    }
+    constexpr bool Match(RChar c) {
+        if (Peek() != c || c == 0)
+            return false;
+        ++pos_;
+        return true;
+    }
+    constexpr bool MatchTwo(RChar c1, RChar c2) {
+        if (Peek() != c1 || regex_[pos_ + 1] != c2)
+            return false;
+        pos_ += 2;
+        return true;
+    }
+    // Digits as LexMatcher::MatchUInt32 reads them.
+    constexpr bool MatchUInt32(UINT32 * value) {
+        size_t begin = pos_;
+        UINT64 n = 0;
+        while (Peek() >= '0' && Peek() <= '9')
+        {
+            n = n * 10 + static_cast<UINT64>(Peek() - '0');
+            if (n > 0x7FFFFFFF)
+                return Fail(STATIC_BAD_NUMBER), false;
+            ++pos_;
+        }
+        *value = static_cast<UINT32>(n);
+        return pos_ > begin;
+    }
+
+    constexpr int Fail(StaticError error) {
+        if (ast_.error == STATIC_OK)
+            ast_.error = error;
+        return -1;
+    }
+    constexpr int Add(StaticNode::Kind kind) {
+        StaticNode & n = ast_.nodes[ast_.size];
+        n.kind = kind;
+        n.first = n.last = n.next = n.prev = -1;
+        return ast_.size++;
+    }
+    constexpr void Append(int parent, int child) {
+        StaticNode & p = ast_.nodes[parent];
+        ast_.nodes[child].prev = p.last;
+        if (p.last >= 0)
+            ast_.nodes[p.last].next = child;
+        else
+            p.first = child;
+        p.last = child;
+    }
+
+    constexpr int repeat(int item) {
+        int r = -1;
+        if (Match('*'))
+        {
+            r = Add(StaticNode::REPEAT);
+            ast_.nodes[r].min = 0;
+            ast_.nodes[r].has_max = false;
+        }
+        else if (Match('{'))
+        {
+            r = Add(StaticNode::REPEAT);
+            UINT32 min = 0, max = 0;
+            MatchUInt32(&min);
+            ast_.nodes[r].min = min;
+            if (Match('}'))
+            {
+                ast_.nodes[r].max = min;
+                ast_.nodes[r].has_max = true;
+            }
+            else
+            {
+                if (!Match(','))
+                    return Fail(STATIC_BAD_REPEAT);
+                ast_.nodes[r].has_max = MatchUInt32(&max);
+                ast_.nodes[r].max = max;
+                if ((ast_.nodes[r].has_max && max < min) || !Match('}'))
+                    return Fail(STATIC_BAD_REPEAT);
+            }
+        }
+        if (r < 0)
+            return item;
+        ast_.nodes[r].id = ast_.repeat_count++;
+        ast_.nodes[r].greedy = !Match('?');
+        Append(r, item);
+        if (Peek() == '{' || Peek() == '*')
+            return Fail(STATIC_NESTED_REPEAT);
+        return r;
+    }
+    // Returns the item, or -1 at the end of the branch.
+    constexpr int item() {
+        int n = -1;
+        if (Match('\\'))
+        {
+            UINT32 group = 0;
+            // \1 to \9, the back references ParseToPostfix takes.
+            if (!MatchUInt32(&group) || group > 9)
+                return Fail(STATIC_BAD_BACKREF);
+            n = Add(StaticNode::BACKREF);
+            ast_.nodes[n].value = group;
+        }
+        else if (Peek() == '(')
+            n = group();
+        else if (Peek() != '|' && Peek() != ')' && Peek() != 0)
+        {
+            n = Add(StaticNode::CHAR);
+            ast_.nodes[n].value = CodeUnit(Peek());
+            ++pos_;
+        }
+        else
+            return -1;
+        if (ast_.error != STATIC_OK)
+            return -1;
+        return repeat(n);
+    }
+    constexpr int branch() {
+        int seq = Add(StaticNode::SEQUENCE);
+        for (int n = item(); n >= 0; n = item())
+            Append(seq, n);
+        return seq;
+    }
+    constexpr int alter() {
+        int alt = Add(StaticNode::ALTER);
+        Append(alt, branch());
+        while (ast_.error == STATIC_OK && Match('|'))
+            Append(alt, branch());
+        return alt;
+    }
+    constexpr int group() {
+        if (!Match('('))
+            return Fail(STATIC_EXPECTED_GROUP);
+        int g = Add(StaticNode::GROUP);
+        Group::Type type = Group::CAPTURE;
+        if (MatchTwo('?', ':'))
+            type = Group::NON_CAPTURE;
+        else if (MatchTwo('?', '='))
+            type = Group::LOOK_AHEAD;
+        else if (MatchTwo('?', '<'))
+            type = Group::LOOK_BEHIND;
+        else if (MatchTwo('?', '>'))
+            type = Group::ATOMIC;
+        else
+            ast_.nodes[g].id = ast_.group_count++;
+        ast_.nodes[g].value = type;
+
+        int alt = alter();
+        if (ast_.error != STATIC_OK)
+            return -1;
+        Append(g, alt);
+        if (!Match(')'))
+            return Fail(STATIC_UNCLOSED_GROUP);
+        if (type == Group::NON_CAPTURE && IsSet(alt))
+            ast_.nodes[g].kind = StaticNode::SET;
+        return g;
+    }
+
+    // Every branch is one char.
+    constexpr bool IsSet(int alt) const {
+        for (int b = ast_.nodes[alt].first; b >= 0; b = ast_.nodes[b].next)
+        {
+            int c = ast_.nodes[b].first;
+            if (c < 0 || c != ast_.nodes[b].last ||
+                ast_.nodes[c].kind != StaticNode::CHAR)
+                return false;
+        }
+        return true;
+    }
+
+    const RChar * regex_;
+    size_t pos_;
+    StaticAst<Capacity> ast_;
+};
+
+// The parsed pattern 'Regex', checked at compile time.
+template <const RChar * Regex>
+struct StaticPattern {
+    // No more than a group, an alternation and a branch per char.
+    static constexpr size_t kCapacity = 3 * StaticLength(Regex) + 4;
+    static constexpr StaticAst<kCapacity> kAst =
+        StaticParser<kCapacity>(Regex).Parse();
+    static_assert(kAst.error == STATIC_OK,
+                  "pattern doesn't parse, kAst.error_pos is where");
+
+    static constexpr const StaticNode & Node(int index) {
+        return kAst.nodes[index];
+    }
+    // The next node of the sequence 'index' is in, in match order.
+    static constexpr int Following(int index, bool forward) {
+        return forward ? kAst.nodes[index].next : kAst.nodes[index].prev;
+    }
+    // The first node of a sequence, in match order.
+    static constexpr int Leading(int seq, bool forward) {
+        return forward ? kAst.nodes[seq].first : kAst.nodes[seq].last;
+    }
+    static constexpr bool HasCapture(int index) {
+        const StaticNode & n = kAst.nodes[index];
+        if (n.kind == StaticNode::GROUP && n.value == Group::CAPTURE)
+            return true;
+        for (int c = n.first; c >= 0; c = kAst.nodes[c].next)
+        {
+            if (HasCapture(c))
+                return true;
+        }
+        return false;
+    }
+    // The char every match starts with, or -1.
+    static constexpr long long FirstChar() {
+        int alt = kAst.nodes[kAst.root].first;
+        if (kAst.nodes[alt].first != kAst.nodes[alt].last)
+            return -1;
+        int n = kAst.nodes[kAst.nodes[alt].first].first;
+        if (n < 0 || kAst.nodes[n].kind != StaticNode::CHAR)
+            return -1;
+        return kAst.nodes[n].value;
+    }
+};
+
+template <const RChar * Regex>
+constexpr StaticAst<StaticPattern<Regex>::kCapacity> StaticPattern<Regex>::kAst;
+
+// Chars of a pattern in the code units of CharT: themselves, or their UTF-8
+// bytes.
+template <typename CharT>
+struct StaticUnits {
+    static constexpr size_t Count(UINT32 c) {
+        return sizeof(CharT) > 1 ? 1
+                                 : (c < 0x80 ? 1
+                                             : (c < 0x800 ? 2
+                                                          : (c < 0x10000 ? 3
+                                                                         : 4)));
+    }
+    static constexpr UINT32 Unit(UINT32 c, size_t i) {
+        // The lead byte holds the top bits, each continuation byte 6 more.
+        return Count(c) == 1 ? c
+                             : (i == 0 ? LeadMark(Count(c)) |
+                                        (c >> (6 * (Count(c) - 1)))
+                                       : 0x80 | ((c >> (6 * (Count(c) - 1 - i))) &
+                                                 0x3F));
+    }
+    static constexpr UINT32 LeadMark(size_t count) {
+        return count == 2 ? 0xC0 : (count == 3 ? 0xE0 : 0xF0);
+    }
+};
+
+// The state of one match attempt, on the stack.
+template <typename CharT, size_t GroupCount, size_t RepeatCount>
+struct StaticState {
+    typedef CharT Char;
+    struct Ranges {
+        // kNoPos until the group captured.
+        size_t begin[GroupCount];
+        size_t end[GroupCount];
+    };
+
+    const CharT * text;
+    size_t size;
+    // Where the open capture of each group began.
+    size_t open[GroupCount];
+    Ranges last;
+    // Iterations of each repeat so far, and where the current one began.
+    size_t count[RepeatCount + 1];
+    size_t start[RepeatCount + 1];
+    // Where a look-around or atomic body ended.
+    size_t accept;
+};
+
+// Continuations ending a match, or the body of a look-around or atomic
+// group.
+struct StaticAccept {
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        s.accept = pos;
+        return true;
+    }
+};
+
+struct StaticAcceptEnd {
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        s.accept = pos;
+        return pos == s.size;
+    }
+};
+
+template <const RChar * Regex,
+          int Index,
+          bool Forward,
+          typename Next,
+          StaticNode::Kind Kind = StaticPattern<Regex>::Node(Index).kind>
+struct StaticNodeMatcher;
+
+// The nodes of a sequence from 'Index' on, then Next.
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticSequence {
+    typedef StaticPattern<Regex> P;
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        return StaticNodeMatcher<
+            Regex,
+            Index,
+            Forward,
+            StaticSequence<Regex, P::Following(Index, Forward), Forward, Next>>::
+            Run(s, pos);
+    }
+};
+
+template <const RChar * Regex, bool Forward, typename Next>
+struct StaticSequence<Regex, -1, Forward, Next> {
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        return Next::Run(s, pos);
+    }
+};
+
+// The branches of an alternation from 'Index' on, in order.
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticAlternation {
+    typedef StaticPattern<Regex> P;
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        return StaticSequence<Regex,
+                              P::Leading(Index, Forward),
+                              Forward,
+                              Next>::Run(s, pos) ||
+            StaticAlternation<Regex, P::Node(Index).next, Forward, Next>::Run(
+                   s, pos);
+    }
+};
+
+template <const RChar * Regex, bool Forward, typename Next>
+struct StaticAlternation<Regex, -1, Forward, Next> {
+    template <typename State>
+    static bool Run(State &, size_t) {
+        return false;
+    }
+};
+
+// One char, or the first of a set that matches, as a step over the text.
+template <const RChar * Regex, int Index, bool Forward, StaticNode::Kind Kind>
+struct StaticCharStep {
+    typedef StaticPattern<Regex> P;
+
+    // All chars are one code unit.
+    template <typename CharT>
+    static constexpr bool Narrow() {
+        return StaticUnits<CharT>::Count(P::Node(Index).value) == 1;
+    }
+
+    template <typename CharT>
+    static bool Step(const CharT * text, size_t size, size_t * pos) {
+        const UINT32 c = P::Node(Index).value;
+        const size_t count = StaticUnits<CharT>::Count(c);
+        if (Forward ? size - *pos < count : *pos < count)
+            return false;
+        size_t at = Forward ? *pos : *pos - count;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (CodeUnit(text[at + i]) != StaticUnits<CharT>::Unit(c, i))
+                return false;
+        }
+        *pos = Forward ? *pos + count : at;
+        return true;
+    }
+};
+
+// The branches of a set from 'Branch' on.
+template <const RChar * Regex, int Branch, bool Forward>
+struct StaticCharStep<Regex, Branch, Forward, StaticNode::SET> {
+    typedef StaticPattern<Regex> P;
+    typedef StaticCharStep<Regex, P::Node(Branch).first, Forward, StaticNode::CHAR>
+        First;
+    typedef StaticCharStep<Regex, P::Node(Branch).next, Forward, StaticNode::SET>
+        Rest;
+
+    template <typename CharT>
+    static constexpr bool Narrow() {
+        return First::template Narrow<CharT>() &&
+            Rest::template Narrow<CharT>();
+    }
+
+    template <typename CharT>
+    static bool Step(const CharT * text, size_t size, size_t * pos) {
+        return First::Step(text, size, pos) || Rest::Step(text, size, pos);
+    }
+};
+
+// Past the last branch of a set.
+template <const RChar * Regex, bool Forward>
+struct StaticCharStep<Regex, -1, Forward, StaticNode::SET> {
+    template <typename CharT>
+    static constexpr bool Narrow() {
+        return true;
+    }
+
+    template <typename CharT>
+    static bool Step(const CharT *, size_t, size_t *) {
+        return false;
+    }
+};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticNodeMatcher<Regex, Index, Forward, Next, StaticNode::CHAR> {
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        return StaticCharStep<Regex, Index, Forward, StaticNode::CHAR>::Step(
+                   s.text, s.size, &pos) &&
+            Next::Run(s, pos);
+    }
+};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticNodeMatcher<Regex, Index, Forward, Next, StaticNode::SET> {
+    typedef StaticPattern<Regex> P;
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        return StaticCharStep<Regex,
+                              P::Node(P::Node(Index).first).first,
+                              Forward,
+                              StaticNode::SET>::Step(s.text, s.size, &pos) &&
+            Next::Run(s, pos);
+    }
+};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticNodeMatcher<Regex, Index, Forward, Next, StaticNode::BACKREF> {
+    typedef StaticPattern<Regex> P;
+
+    // The last capture of the group, read in text order either way.
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        const UINT32 group = P::Node(Index).value;
+        size_t begin = s.last.begin[group];
+        if (begin == kNoPos)
+            return false;
+        size_t size = s.last.end[group] - begin;
+        if (Forward ? s.size - pos < size : pos < size)
+            return false;
+        size_t at = Forward ? pos : pos - size;
+        for (size_t i = 0; i < size; ++i)
+        {
+            if (s.text[at + i] != s.text[begin + i])
+                return false;
+        }
+        return Next::Run(s, Forward ? pos + size : at);
+    }
+
+private:
+    static constexpr size_t kNoPos = static_cast<size_t>(-1);
+};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticNodeMatcher<Regex, Index, Forward, Next, StaticNode::SEQUENCE>
+    : StaticSequence<Regex,
+                     StaticPattern<Regex>::Leading(Index, Forward),
+                     Forward,
+                     Next> {};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticNodeMatcher<Regex, Index, Forward, Next, StaticNode::ALTER>
+    : StaticAlternation<Regex,
+                        StaticPattern<Regex>::Node(Index).first,
+                        Forward,
+                        Next> {};
+
+// Ends a capture: the range runs from where the group opened to 'pos',
+// in text order.
+template <size_t Group, bool Forward, typename Next>
+struct StaticCloseCapture {
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        size_t begin = s.last.begin[Group], end = s.last.end[Group];
+        s.last.begin[Group] = Forward ? s.open[Group] : pos;
+        s.last.end[Group] = Forward ? pos : s.open[Group];
+        if (Next::Run(s, pos))
+            return true;
+        s.last.begin[Group] = begin;
+        s.last.end[Group] = end;
+        return false;
+    }
+};
+
+template <const RChar * Regex,
+          int Index,
+          bool Forward,
+          typename Next,
+          Group::Type Type = static_cast<Group::Type>(
+              StaticPattern<Regex>::Node(Index).value)>
+struct StaticGroupMatcher;
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticNodeMatcher<Regex, Index, Forward, Next, StaticNode::GROUP>
+    : StaticGroupMatcher<Regex, Index, Forward, Next> {};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticGroupMatcher<Regex, Index, Forward, Next, Group::CAPTURE> {
+    typedef StaticPattern<Regex> P;
+    static constexpr size_t kGroup = static_cast<size_t>(P::Node(Index).id);
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        size_t open = s.open[kGroup];
+        s.open[kGroup] = pos;
+        bool matched =
+            StaticNodeMatcher<Regex,
+                              P::Node(Index).first,
+                              Forward,
+                              StaticCloseCapture<kGroup, Forward, Next>>::
+                Run(s, pos);
+        s.open[kGroup] = open;
+        return matched;
+    }
+};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticGroupMatcher<Regex, Index, Forward, Next, Group::NON_CAPTURE>
+    : StaticNodeMatcher<Regex,
+                        StaticPattern<Regex>::Node(Index).first,
+                        Forward,
+                        Next> {};
+
+// Look-ahead runs its body forward from 'pos', look-behind backward.
+// Captures made inside look-around are dropped.
+template <const RChar * Regex, int Index, bool Ahead, typename Next>
+struct StaticLookAround {
+    typedef StaticPattern<Regex> P;
+    static constexpr int kBody = P::Node(Index).first;
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        typename State::Ranges last = s.last;
+        bool holds =
+            StaticNodeMatcher<Regex, kBody, Ahead, StaticAccept>::Run(s, pos);
+        if (P::HasCapture(kBody))
+            s.last = last;
+        return holds && Next::Run(s, pos);
+    }
+};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticGroupMatcher<Regex, Index, Forward, Next, Group::LOOK_AHEAD>
+    : StaticLookAround<Regex, Index, true, Next> {};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticGroupMatcher<Regex, Index, Forward, Next, Group::LOOK_BEHIND>
+    : StaticLookAround<Regex, Index, false, Next> {};
+
+// Only the first way the body matches is kept.
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticGroupMatcher<Regex, Index, Forward, Next, Group::ATOMIC> {
+    typedef StaticPattern<Regex> P;
+    static constexpr int kBody = P::Node(Index).first;
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        typename State::Ranges last = s.last;
+        if (!StaticNodeMatcher<Regex, kBody, Forward, StaticAccept>::Run(s,
+                                                                        pos))
+            return false;
+        if (Next::Run(s, s.accept))
+            return true;
+        if (P::HasCapture(kBody))
+            s.last = last;
+        return false;
+    }
+};
+
+// Iterations of a repeat over anything but single chars. The count and the
+// start of the current iteration live in the state, saved across nested
+// entries of the same repeat.
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticRepeatLoop {
+    typedef StaticPattern<Regex> P;
+    static constexpr int kId = P::Node(Index).id;
+
+    // After an iteration that ended at 'pos'.
+    struct Again {
+        template <typename State>
+        static bool Run(State & s, size_t pos) {
+            size_t count = s.count[kId];
+            // An empty iteration that reaches the minimum would loop forever.
+            // As in EnfaMatcher, it is kept and the repeat exits.
+            if (pos == s.start[kId] && count + 1 >= P::Node(Index).min)
+                return Next::Run(s, pos);
+            s.count[kId] = count + 1;
+            bool matched = StaticRepeatLoop::Run(s, pos);
+            s.count[kId] = count;
+            return matched;
+        }
+    };
+
+    template <typename State>
+    static bool Iterate(State & s, size_t pos) {
+        size_t start = s.start[kId];
+        s.start[kId] = pos;
+        bool matched =
+            StaticNodeMatcher<Regex, P::Node(Index).first, Forward, Again>::Run(
+                s, pos);
+        s.start[kId] = start;
+        return matched;
+    }
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        const StaticNode & n = P::Node(Index);
+        size_t count = s.count[kId];
+        bool iterate = !n.has_max || count < n.max;
+        bool exit = count >= n.min;
+        if (n.greedy)
+            return (iterate && Iterate(s, pos)) || (exit && Next::Run(s, pos));
+        return (exit && Next::Run(s, pos)) || (iterate && Iterate(s, pos));
+    }
+};
+
+template <const RChar * Regex, int Index, bool Forward, typename Next>
+struct StaticNodeMatcher<Regex, Index, Forward, Next, StaticNode::REPEAT> {
+    typedef StaticPattern<Regex> P;
+    static constexpr int kBody = P::Node(Index).first;
+    static constexpr StaticNode::Kind kBodyKind = P::Node(kBody).kind;
+    static constexpr int kId = P::Node(Index).id;
+    // The branches of a set, or the char.
+    static constexpr bool kSet = kBodyKind == StaticNode::SET;
+    typedef StaticCharStep<Regex,
+                           kSet ? P::Node(P::Node(kBody).first).first : kBody,
+                           Forward,
+                           kSet ? StaticNode::SET : StaticNode::CHAR>
+        Step;
+
+    template <typename State>
+    static bool Run(State & s, size_t pos) {
+        typedef typename State::Char CharT;
+        return Run(s,
+                   pos,
+                   std::integral_constant<
+                       bool,
+                       (kSet || kBodyKind == StaticNode::CHAR) &&
+                           Step::template Narrow<CharT>()>());
+    }
+
+private:
+    template <typename State>
+    static bool Run(State & s, size_t pos, std::false_type) {
+        size_t count = s.count[kId];
+        s.count[kId] = 0;
+        bool matched =
+            StaticRepeatLoop<Regex, Index, Forward, Next>::Run(s, pos);
+        s.count[kId] = count;
+        return matched;
+    }
+
+    // Each char is one code unit, so the loop counts them and backtracks by
+    // stepping back.
+    template <typename State>
+    static bool Run(State & s, size_t pos, std::true_type) {
+        const StaticNode & n = P::Node(Index);
+        const size_t max = n.has_max ? n.max : static_cast<size_t>(-1);
+        size_t count = 0, at = pos;
+        if (n.greedy)
+        {
+            while (count < max && Step::Step(s.text, s.size, &at))
+                ++count;
+            for (; count >= n.min; --count)
+            {
+                if (Next::Run(s, Forward ? pos + count : pos - count))
+                    return true;
+                if (count == 0)
+                    break;
+            }
+            return false;
+        }
+        for (; count < n.min; ++count)
+        {
+            if (!Step::Step(s.text, s.size, &at))
+                return false;
+        }
+        for (;; ++count)
+        {
+            if (Next::Run(s, at))
+                return true;
+            if (count == max || !Step::Step(s.text, s.size, &at))
+                return false;
+        }
+    }
+};
+
+// A match of a StaticMatcher: the last range each group captured.
+template <size_t GroupCount>
+class StaticMatchResult {
+public:
+    StaticMatchResult()
+        : matched_(false) {
+        for (size_t g = 0; g < GroupCount; ++g)
+            begin_[g] = end_[g] = static_cast<size_t>(-1);
+    }
+
+    bool Matched() const {
+        return matched_;
+    }
+    // False if 'group' took no part in the match.
+    bool Captured(size_t group) const {
+        return matched_ && begin_[group] != static_cast<size_t>(-1);
+    }
+    std::pair<size_t, size_t> GetLastRange(size_t group) const {
+        return {begin_[group], end_[group]};
+    }
+
+private:
+    template <const RChar * Regex>
+    friend class StaticMatcher;
+
+    bool matched_;
+    size_t begin_[GroupCount];
+    size_t end_[GroupCount];
+};
+
+template <const RChar * Regex>
+class StaticMatcher {
+    typedef StaticPattern<Regex> P;
+
+public:
+    static constexpr size_t kGroupCount = P::kAst.group_count;
+    typedef StaticMatchResult<kGroupCount> Result;
+
+    // The whole text matches.
+    static bool Match(RView text, Result * m = nullptr) {
+        return MatchText(text, m);
+    }
+    // Leftmost match starting at or after 'from'.
+    static bool Search(RView text, size_t from, Result * m = nullptr) {
+        return SearchText(text, from, m);
+    }
+
+    // The same over UTF-8 text.
+    static bool Match(RByteView text, Result * m = nullptr) {
+        return MatchText(text, m);
+    }
+    static bool Search(RByteView text, size_t from, Result * m = nullptr) {
+        return SearchText(text, from, m);
+    }
+
+    // Matches one after another, as EnfaMatcher's MatchAll finds them.
+    template <typename CharT>
+    class BasicIterator {
+    public:
+        explicit BasicIterator(StringView<CharT> text)
+            : text_(text)
+            , pos_(0)
+            , done_(false) {
+        }
+
+        bool HasNext() {
+            if (!next_.Matched() && !done_)
+            {
+                if (SearchText(text_, pos_, &next_))
+                {
+                    // Empty matches advance by one char.
+                    std::pair<size_t, size_t> range = next_.GetLastRange(0);
+                    done_ = (range.first == text_.size());
+                    pos_ = (range.first == range.second
+                                ? NextCharPos(text_, range.first)
+                                : range.second);
+                }
+                else
+                    done_ = true;
+            }
+            return next_.Matched();
+        }
+        Result Next() {
+            HasNext();
+            Result m = next_;
+            next_ = Result();
+            return m;
+        }
+
+    private:
+        StringView<CharT> text_;
+        size_t pos_;
+        bool done_;
+        Result next_;
+    };
+    typedef BasicIterator<RChar> Iterator;
+    typedef BasicIterator<RByte> ByteIterator;
+
+private:
+    template <typename CharT>
+    using State = StaticState<CharT,
+                              kGroupCount,
+                              static_cast<size_t>(P::kAst.repeat_count)>;
+
+    template <typename CharT>
+    static State<CharT> Start(StringView<CharT> text) {
+        State<CharT> s;
+        s.text = text.data();
+        s.size = text.size();
+        for (size_t g = 0; g < kGroupCount; ++g)
+            s.last.begin[g] = s.last.end[g] = static_cast<size_t>(-1);
+        return s;
+    }
+
+    template <typename CharT>
+    static void Finish(const State<CharT> & s, Result * m) {
+        if (!m)
+            return;
+        m->matched_ = true;
+        for (size_t g = 0; g < kGroupCount; ++g)
+        {
+            m->begin_[g] = s.last.begin[g];
+            m->end_[g] = s.last.end[g];
+        }
+    }
+
+    template <typename CharT>
+    static bool MatchText(StringView<CharT> text, Result * m) {
+        if (m)
+            *m = Result();
+        State<CharT> s = Start(text);
+        if (!StaticNodeMatcher<Regex, P::kAst.root, true, StaticAcceptEnd>::
+                Run(s, 0))
+            return false;
+        Finish(s, m);
+        return true;
+    }
+
+    // Where a match may start, at or after 'pos', or past the end.
+    static size_t NextCandidate(RView text, size_t pos) {
+        const RChar * c = std::wmemchr(text.data() + pos,
+                                       static_cast<RChar>(P::FirstChar()),
+                                       text.size() - pos);
+        return c ? static_cast<size_t>(c - text.data()) : text.size() + 1;
+    }
+    static size_t NextCandidate(RByteView text, size_t pos) {
+        const void * c = std::memchr(
+            text.data() + pos,
+            static_cast<int>(StaticUnits<RByte>::Unit(
+                static_cast<UINT32>(P::FirstChar()), 0)),
+            text.size() - pos);
+        return c ? static_cast<size_t>(static_cast<const RByte *>(c) -
+                                       text.data())
+                 : text.size() + 1;
+    }
+
+    template <typename CharT>
+    static bool SearchText(StringView<CharT> text, size_t from, Result * m) {
+        if (m)
+            *m = Result();
+        State<CharT> s = Start(text);
+        for (size_t pos = from; pos <= text.size(); ++pos)
+        {
+            if (P::FirstChar() >= 0)
+            {
+                pos = NextCandidate(text, pos);
+                if (pos > text.size())
+                    break;
+            }
+            if (StaticNodeMatcher<Regex, P::kAst.root, true, StaticAccept>::
+                    Run(s, pos))
+            {
+                Finish(s, m);
+                return true;
+            }
+        }
+        return false;
+    }
+};
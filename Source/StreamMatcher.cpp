@@ -0,0 +1,168 @@
+#include "stdafx.h"
+
+#include "StreamMatcher.h"
+#include "util.h"
+
+static const size_t kNoLimit = static_cast<size_t>(-1);
+static const size_t kUnknown = static_cast<size_t>(-2);
+
+// Longest text the instructions from 'pc' up to 'end' may consume, or
+// kNoLimit if they loop or read a back reference. 'width' caches results,
+// 'visiting' finds loops.
+static size_t MaxWidth(const Program & prog,
+                       int pc,
+                       int end,
+                       std::vector<size_t> * width,
+                       std::vector<bool> * visiting) {
+    if (pc == end)
+        return 0;
+    if ((*width)[pc] != kUnknown)
+        return (*width)[pc];
+    if ((*visiting)[pc] || prog[pc].op == Inst::BACKREF)
+        return kNoLimit;
+
+    size_t w = 0;
+    (*visiting)[pc] = true;
+    for (int next : prog.Next(pc))
+    {
+        size_t n = MaxWidth(prog, next, end, width, visiting);
+        if (n == kNoLimit)
+        {
+            w = kNoLimit;
+            break;
+        }
+        w = std::max(w, n + (prog[pc].op == Inst::CHAR ? 1 : 0));
+    }
+    (*visiting)[pc] = false;
+    (*width)[pc] = w;
+    return w;
+}
+
+// How far before a match start look-behind may read.
+static size_t LookBehindReach(const Program & prog) {
+    size_t reach = 0;
+    for (size_t pc = 0; pc < prog.Size(); ++pc)
+    {
+        const Inst & inst = prog[static_cast<int>(pc)];
+        if (inst.op != Inst::ASSERT || inst.flag)
+            continue;
+        std::vector<size_t> width(prog.Size(), kUnknown);
+        std::vector<bool> visiting(prog.Size());
+        size_t w = MaxWidth(
+            prog, static_cast<int>(pc) + 1, inst.x, &width, &visiting);
+        if (w == kNoLimit)
+            return kNoLimit;
+        reach = std::max(reach, w);
+    }
+    return reach;
+}
+
+template <typename CharT>
+BasicStreamMatcher<CharT>::BasicStreamMatcher(const EnfaMatcher & matcher)
+    : matcher_(&matcher)
+    , scratch_(new MatchScratch(matcher))
+    , reach_(LookBehindReach(*matcher.program_))
+    , offset_(0)
+    , start_(0)
+    , skip_continuation_(false)
+    , finished_(false) {
+}
+
+template <typename CharT>
+std::vector<BasicMatchResult<CharT>> BasicStreamMatcher<CharT>::Feed(
+    View chunk) {
+    RAssert(!finished_);
+    Trim();
+    kept_.append(chunk.begin(), chunk.end());
+    return Run(false);
+}
+
+template <typename CharT>
+std::vector<BasicMatchResult<CharT>> BasicStreamMatcher<CharT>::Finish() {
+    RAssert(!finished_);
+    finished_ = true;
+    Trim();
+    return Run(true);
+}
+
+template <typename CharT>
+size_t BasicStreamMatcher<CharT>::Offset() const {
+    return offset_;
+}
+
+template <typename CharT>
+size_t BasicStreamMatcher<CharT>::KeptSize() const {
+    return kept_.size();
+}
+
+// Try each start in turn, like EnfaMatcher::Search, until an attempt needs
+// text that hasn't arrived. Before the first attempt and after each match,
+// skip the starts the DFA rules out.
+template <typename CharT>
+std::vector<BasicMatchResult<CharT>> BasicStreamMatcher<CharT>::Run(
+    bool at_end) {
+    std::vector<BasicMatchResult<CharT>> matches;
+    View text(kept_);
+    bool skip = true;
+    while (start_ <= text.size())
+    {
+        // In UTF-8 text, a char is a whole byte sequence.
+        while (skip_continuation_ && start_ < text.size() &&
+               (CodeUnit(text[start_]) & 0xC0) == 0x80)
+        {
+            ++start_;
+        }
+        if (skip_continuation_ && start_ == text.size() && !at_end)
+            break;
+        skip_continuation_ = false;
+        if (skip)
+        {
+            skip = false;
+            start_ =
+                matcher_->NextAttempt(text, start_, at_end, scratch_.get());
+            if (start_ > text.size())
+                break;
+        }
+
+        bool hit_end = false;
+        BasicMatchResult<CharT> m =
+            matcher_->MatchAt(text, start_, &hit_end, scratch_.get());
+        if (hit_end && !at_end)
+            break;
+        if (!m.Matched())
+        {
+            ++start_;
+            continue;
+        }
+
+        // Empty matches advance by one char, so every start position is
+        // tried once, including the end of text.
+        auto range = m.GetCapture().Group(0).GetLastRange();
+        matches.push_back(m);
+        skip = true;
+        if (range.first == range.second)
+        {
+            start_ = range.first + 1;
+            skip_continuation_ = (sizeof(CharT) == 1);
+        }
+        else
+            start_ = range.second;
+    }
+    return matches;
+}
+
+// Drop the text no later attempt can read. Matches reported by the last
+// call point into the kept text, so this waits until the next one.
+template <typename CharT>
+void BasicStreamMatcher<CharT>::Trim() {
+    if (reach_ == kNoLimit)
+        return;
+    size_t keep_from = std::min(start_, kept_.size());
+    keep_from -= std::min(keep_from, reach_);
+    kept_.erase(0, keep_from);
+    offset_ += keep_from;
+    start_ -= keep_from;
+}
+
+template class BasicStreamMatcher<RChar>;
+template class BasicStreamMatcher<RByte>;
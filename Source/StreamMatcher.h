@@ -0,0 +1,54 @@
+#pragma once
+
+#include "EnfaMatcher.h"
+#include "RegexSyntax.h"
+
+/*
+ * Matches text that arrives in chunks, finding what MatchAll would find in
+ * the whole text.
+ *
+ * A match is reported once no more text can change it. Only the text from
+ * the pending match attempt on is kept, plus what look-behind may read
+ * before it, so memory stays bounded unless a look-behind is unbounded.
+ * Where the pattern has a DFA, it skips the starts that fail whatever text
+ * follows, and attempts are backtracked from the one it leaves pending.
+ */
+
+template <typename CharT>
+class BasicStreamMatcher {
+public:
+    typedef StringView<CharT> View;
+
+    // 'matcher' must outlive this.
+    explicit BasicStreamMatcher(const EnfaMatcher & matcher);
+
+    // Matches completed by 'chunk', in order. Positions are relative to
+    // Offset(), and the captured text stays valid until the next call.
+    std::vector<BasicMatchResult<CharT>> Feed(View chunk);
+    // Matches at the end of the stream.
+    std::vector<BasicMatchResult<CharT>> Finish();
+
+    // Stream position of the first kept code unit.
+    size_t Offset() const;
+    size_t KeptSize() const;
+
+private:
+    std::vector<BasicMatchResult<CharT>> Run(bool at_end);
+    void Trim();
+
+    const EnfaMatcher * matcher_;
+    std::unique_ptr<MatchScratch> scratch_;
+    // Code units look-behind may read before a match start, or kNoLimit.
+    size_t reach_;
+    typename RegexType<CharT>::String kept_;
+    size_t offset_;
+    // Next match attempt, relative to 'kept_'.
+    size_t start_;
+    // After an empty match in UTF-8 text, the attempt moves to the next
+    // char boundary.
+    bool skip_continuation_;
+    bool finished_;
+};
+
+typedef BasicStreamMatcher<RChar> StreamMatcher;
+typedef BasicStreamMatcher<RByte> ByteStreamMatcher;
@@ -0,0 +1,675 @@
+#include "stdafx.h"
+
+#include "FileSearch.h"
+#include "Input.h"
+#include "Lexer.h"
+#include "ParallelMatcher.h"
+#include "ProgramFile.h"
+#include "RegexCompiler.h"
+#include "RegexSet.h"
+#include "StaticMatcher.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*
+ * Load tests from Document/TODO.md, over synthetic corpora or files.
+ *
+ *   benchmark [--scale S] [--repeat N] [FILE PATTERN]...
+ *
+ * Each workload is timed per engine next to a plain scan of the same
+ * memory, so a regression shows as a drop against that baseline whatever
+ * the machine. --scale multiplies the corpus sizes (1 is the sizes in
+ * TODO.md), --repeat keeps the best of N runs. Given files, only they are
+ * searched, for PATTERN, which is wrapped in a group like the grep mode
+ * of the main program does.
+ *
+ * Columns: compile time, throughput, matches (or tokens) and their rate,
+ * how many times slower than the scan, and the peak memory of the process
+ * so far. The peak never goes down, so a row shows what it added over the
+ * rows above it.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Best time of 'repeat' runs.
+template <typename Run>
+static double BestTime(int repeat, Run run) {
+    double best = 0;
+    for (int i = 0; i < repeat; ++i)
+    {
+        Clock::time_point start = Clock::now();
+        run();
+        double t = Seconds(start);
+        if (i == 0 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+static size_t PeakMemory() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+static void ReportHeader() {
+    std::printf("%-16s %-10s %10s %10s %10s %12s %8s %8s\n",
+                "workload",
+                "engine",
+                "compile ms",
+                "MB/s",
+                "matches",
+                "matches/s",
+                "x scan",
+                "peak MB");
+}
+
+// 'scan' is the plain scan's time over the same bytes, 'compile' is
+// negative when nothing was compiled.
+static void Report(const std::string & workload,
+                   const char * engine,
+                   double compile,
+                   double run,
+                   double scan,
+                   size_t bytes,
+                   size_t matches) {
+    const double mb = 1024.0 * 1024.0;
+    char compile_ms[32] = "-";
+    if (compile >= 0)
+        std::snprintf(compile_ms, sizeof(compile_ms), "%.3f", compile * 1e3);
+    std::printf("%-16s %-10s %10s %10.1f %10zu %12.0f %7.1fx %8.1f\n",
+                workload.c_str(),
+                engine,
+                compile_ms,
+                bytes / mb / run,
+                matches,
+                matches / run,
+                run / scan,
+                PeakMemory() / mb);
+    std::fflush(stdout);
+}
+
+static size_t TotalSize(const std::vector<RByteView> & texts) {
+    size_t size = 0;
+    for (RByteView text : texts)
+        size += text.size();
+    return size;
+}
+
+// Written by scans, so the compiler can't drop them.
+static volatile UINT64 scan_sink;
+
+// Adds up every byte: the least any search over the text has to do.
+static double ScanRun(const std::string & workload,
+                      const std::vector<RByteView> & texts,
+                      int repeat) {
+    double scan = BestTime(repeat, [&] {
+        UINT64 sum = 0;
+        for (RByteView text : texts)
+        {
+            for (RByte c : text)
+                sum += static_cast<UINT8>(c);
+        }
+        scan_sink = sum;
+    });
+    Report(workload, "scan", -1, scan, scan, TotalSize(texts), 0);
+    return scan;
+}
+
+static const struct {
+    const char * name;
+    MatchOptions::Engine engine;
+    bool jit;
+} kEngines[] = {
+    {"auto", MatchOptions::AUTO, false},
+    {"auto jit", MatchOptions::AUTO, true},
+    {"backtrack", MatchOptions::BACKTRACK, false},
+    {"pikevm", MatchOptions::PIKE_VM, false},
+};
+
+// Finds every match of 'regex' in each text, per engine. With 'group' set,
+// the text of that group is collected from each match too.
+static void RegexRuns(const std::string & workload,
+                      const RString & regex,
+                      const std::vector<RByteView> & texts,
+                      size_t group,
+                      double scan,
+                      int repeat) {
+    for (const auto & e : kEngines)
+    {
+        MatchOptions options;
+        options.utf8 = true;
+        options.engine = e.engine;
+        options.jit = e.jit;
+        Clock::time_point start = Clock::now();
+        EnfaMatcher matcher = RegexCompiler::CompileToEnfa(regex, options);
+        double compile = Seconds(start);
+        // Nothing to compare where there is no JIT.
+        if (e.jit && !matcher.IsJitted())
+            continue;
+
+        MatchScratch scratch(matcher);
+        size_t matches = 0;
+        std::vector<RBytes> collected;
+        double run = BestTime(repeat, [&] {
+            matches = 0;
+            collected.clear();
+            for (RByteView text : texts)
+            {
+                ByteMatchIterator it(matcher, text, &scratch);
+                while (it.HasNext())
+                {
+                    ByteMatchResult m = it.Next();
+                    ++matches;
+                    if (group > 0)
+                    {
+                        RByteView g = m.GetCapture().Group(group).GetLast();
+                        collected.emplace_back(g.begin(), g.end());
+                    }
+                }
+            }
+        });
+        Report(workload, e.name, compile, run, scan, TotalSize(texts), matches);
+    }
+}
+
+// Finds every match of 'regex' in each text with ParallelMatchAll. Chunks
+// are cut for 'threads' threads whatever the machine has.
+static void ParallelRun(const std::string & workload,
+                        const RString & regex,
+                        const std::vector<RByteView> & texts,
+                        size_t threads,
+                        double scan,
+                        int repeat) {
+    MatchOptions options;
+    options.utf8 = true;
+    Clock::time_point start = Clock::now();
+    EnfaMatcher matcher = RegexCompiler::CompileToEnfa(regex, options);
+    double compile = Seconds(start);
+    size_t matches = 0;
+    double run = BestTime(repeat, [&] {
+        matches = 0;
+        for (RByteView text : texts)
+            matches += ParallelMatchAll(matcher, text, threads).size();
+    });
+    Report(workload, "parallel", compile, run, scan, TotalSize(texts), matches);
+}
+
+// Finds every match of the StaticMatcher<Regex> in each text, with nothing
+// compiled at run time.
+template <const RChar * Regex>
+static void StaticRun(const std::string & workload,
+                      const std::vector<RByteView> & texts,
+                      double scan,
+                      int repeat) {
+    size_t matches = 0;
+    double run = BestTime(repeat, [&] {
+        matches = 0;
+        for (RByteView text : texts)
+        {
+            typename StaticMatcher<Regex>::ByteIterator it(text);
+            for (; it.HasNext(); it.Next())
+                ++matches;
+        }
+    });
+    Report(workload, "static", -1, run, scan, TotalSize(texts), matches);
+}
+
+static constexpr RChar kBrPattern[] = L"(<br(?: )*(?:/|)>)";
+
+// Group of the one-char alternatives in 'chars', none of them '(', ')',
+// '|' or '\', which patterns can't spell.
+static RString AnyOf(const char * chars) {
+    RString alter = L"(?:";
+    for (const char * c = chars; *c; ++c)
+    {
+        if (c != chars)
+            alter += L'|';
+        alter += static_cast<RChar>(*c);
+    }
+    return alter + L")";
+}
+
+static const char * kDigits = "0123456789";
+static const char * kLetters =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+
+static const char * kWords[] = {
+    "lorem", "ipsum", "dolor", "sit",   "amet",  "regex", "engine", "match",
+    "state", "table", "page",  "the",   "of",    "and",   "to",     "a",
+    "in",    "is",    "for",   "first", "union", "token", "search", "text",
+};
+
+static RBytes Words(std::mt19937 * rng, size_t count) {
+    RBytes words;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i > 0)
+            words += ' ';
+        words += kWords[(*rng)() % (sizeof(kWords) / sizeof(kWords[0]))];
+    }
+    return words;
+}
+
+// [ints] Decimal numbers, one per line, 'size' bytes in all.
+static RBytes IntText(size_t size, std::mt19937 * rng) {
+    RBytes text;
+    text.reserve(size + 16);
+    while (text.size() < size)
+    {
+        text += std::to_string((*rng)());
+        text += '\n';
+    }
+    return text;
+}
+
+// Random chars of 'chars', 'size' bytes in all.
+static RBytes RandomText(size_t size, const char * chars, std::mt19937 * rng) {
+    size_t count = std::strlen(chars);
+    RBytes text(size, ' ');
+    for (char & c : text)
+        c = chars[(*rng)() % count];
+    return text;
+}
+
+// [web] A page with a title, paragraphs and line breaks of a few spellings.
+static RBytes HtmlPage(size_t size, std::mt19937 * rng) {
+    RBytes page = "<html><head><title>" + Words(rng, 2 + (*rng)() % 6) +
+        "</title></head>\n<body>\n";
+    while (page.size() < size)
+    {
+        page += "<p>" + Words(rng, 5 + (*rng)() % 20);
+        switch ((*rng)() % 4)
+        {
+            case 0:
+                page += "<br>";
+                break;
+            case 1:
+                page += "<br/>";
+                break;
+            case 2:
+                page += "<br />";
+                break;
+            default:
+                page += "</p>";
+                break;
+        }
+        page += '\n';
+    }
+    return page + "</body></html>\n";
+}
+
+// [lex] Functions of about 12 lines each, 'lines' lines in all.
+static RBytes CProgram(size_t lines, std::mt19937 * rng) {
+    RBytes program = "#include <stdio.h>\n\n";
+    for (size_t f = 0; f * 12 < lines; ++f)
+    {
+        std::string name = "f" + std::to_string(f);
+        std::string callee = "f" + std::to_string((*rng)() % (f + 1));
+        std::string n = std::to_string((*rng)() % 1000);
+        program += "// " + Words(rng, 6) + "\n";
+        program += "int " + name + "(int a, int b)\n{\n";
+        program += "    int x = a * " + n + " + b;\n";
+        program += "    char * s = \"" + Words(rng, 3) + ": %d\";\n";
+        program += "    if (x >= " + n + " && b != 0 || a < 0)\n    {\n";
+        program += "        x = x - " + callee + "(b, " + n + ");\n    }\n";
+        program += "    while (x < 100)\n        x += 7;\n";
+        program += "    printf(s, x);\n";
+        program += "    return x;\n}\n\n";
+    }
+    return program;
+}
+
+static std::vector<std::pair<RString, int>> CRules() {
+    RString letter = AnyOf(kLetters);
+    RString digit = AnyOf(kDigits);
+    return {
+        {L"(int|char|if|else|while|for|return)", 1},
+        {L"(" + letter + L"(?:" + letter + L"|" + digit + L")*)", 2},
+        {L"(" + digit + digit + L"*)", 3},
+        {L"(\"" + AnyOf(" #%.,:;<>abcdefghijklmnopqrstuvwxyz") + L"*\")", 4},
+        {L"(//" + AnyOf(" abcdefghijklmnopqrstuvwxyz") + L"*)", 5},
+        {L"(#include|<stdio.h>)", 6},
+        {L"(*|+|-|/|=|==|!=|<|<=|>|>=|&&|+=|,|;|{|})", 7},
+        {L"((?: |\n)(?: |\n)*)", 8},
+    };
+}
+
+// Tokens of 'text'. '(', ')' and '|' can't be spelled in patterns, so
+// where no rule matches, the char there counts as a token of its own.
+static size_t CountTokens(const Lexer & lexer, RByteView text) {
+    size_t tokens = 0;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        ByteTokenIterator it(lexer,
+                             RByteView(text.data() + pos, text.size() - pos));
+        while (it.HasNext())
+        {
+            it.Next();
+            ++tokens;
+        }
+        pos += it.Pos();
+        if (pos < text.size())
+        {
+            ++tokens;
+            ++pos;
+        }
+    }
+    return tokens;
+}
+
+static void LexRun(const std::string & workload,
+                   const std::vector<RByteView> & programs,
+                   double scan,
+                   int repeat) {
+    for (int jit = 0; jit < 2; ++jit)
+    {
+        MatchOptions options;
+        options.utf8 = true;
+        options.jit = (jit != 0);
+        Clock::time_point start = Clock::now();
+        Lexer lexer(CRules(), options);
+        double compile = Seconds(start);
+        // Nothing to compare where there is no JIT.
+        if (jit && !lexer.IsJitted())
+            break;
+
+        size_t tokens = 0;
+        double run = BestTime(repeat, [&] {
+            tokens = 0;
+            for (RByteView program : programs)
+                tokens += CountTokens(lexer, program);
+        });
+        Report(workload,
+               jit ? "lexer jit" : "lexer",
+               compile,
+               run,
+               scan,
+               TotalSize(programs),
+               tokens);
+    }
+}
+
+// Which of 'patterns' each text holds, with the union's DFA walked as a
+// table and then run as machine code.
+static void SetRun(const std::string & workload,
+                   const std::vector<RString> & patterns,
+                   const std::vector<RByteView> & texts,
+                   double scan,
+                   int repeat) {
+    for (int jit = 0; jit < 2; ++jit)
+    {
+        MatchOptions options;
+        options.utf8 = true;
+        options.jit = (jit != 0);
+        Clock::time_point start = Clock::now();
+        RegexSet set(patterns, options);
+        double compile = Seconds(start);
+        // Nothing to compare where there is no JIT.
+        if (jit && !set.IsJitted())
+            break;
+
+        RegexSet::Scratch scratch(set);
+        size_t matches = 0;
+        double run = BestTime(repeat, [&] {
+            matches = 0;
+            for (RByteView text : texts)
+                matches += set.Matches(text, &scratch).size();
+        });
+        Report(workload,
+               jit ? "set jit" : "set",
+               compile,
+               run,
+               scan,
+               TotalSize(texts),
+               matches);
+    }
+}
+
+// Compiles 'count' patterns, then opens them saved to a program file, and
+// searches 'text' with each set. The compile column is the time to get the
+// matchers ready.
+static void StartupRun(const std::string & workload,
+                       size_t count,
+                       const std::vector<RByteView> & texts,
+                       double scan,
+                       int repeat) {
+    const size_t word_count = sizeof(kWords) / sizeof(kWords[0]);
+    std::vector<RString> patterns;
+    for (size_t i = 0; i < count; ++i)
+    {
+        RBytes first = kWords[i % word_count];
+        RBytes second = kWords[i / word_count % word_count];
+        patterns.push_back(L"(" + RString(first.begin(), first.end()) +
+                           L" (?: )*" + RString(second.begin(), second.end()) +
+                           L")");
+    }
+
+    MatchOptions options;
+    options.utf8 = true;
+    std::vector<EnfaMatcher> compiled;
+    double compile = BestTime(repeat, [&] {
+        compiled.clear();
+        for (const RString & pattern : patterns)
+            compiled.push_back(RegexCompiler::CompileToEnfa(pattern, options));
+    });
+    const char * path = "benchmark_programs.tmp";
+    if (!ProgramFile::Save(path, compiled))
+    {
+        std::fprintf(stderr, "%s: can't write it\n", path);
+        return;
+    }
+    ProgramFile file;
+    double load = BestTime(repeat, [&] { file.Open(path); });
+    std::remove(path);
+
+    for (int loaded = 0; loaded < 2; ++loaded)
+    {
+        size_t matches = 0;
+        double run = BestTime(repeat, [&] {
+            matches = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const EnfaMatcher & matcher =
+                    loaded ? file.Matcher(i) : compiled[i];
+                for (RByteView text : texts)
+                {
+                    ByteMatchIterator it(matcher, text);
+                    for (; it.HasNext(); it.Next())
+                        ++matches;
+                }
+            }
+        });
+        Report(workload,
+               loaded ? "loaded" : "compiled",
+               loaded ? load : compile,
+               run,
+               scan,
+               TotalSize(texts) * count,
+               matches);
+    }
+}
+
+static std::vector<RByteView> Views(const std::vector<RBytes> & texts) {
+    return std::vector<RByteView>(texts.begin(), texts.end());
+}
+
+static void RunSynthetic(double scale, int repeat) {
+    const size_t mb = 1024 * 1024;
+    std::mt19937 rng(20180401);
+
+    {
+        RBytes ints = IntText(static_cast<size_t>(100 * mb * scale), &rng);
+        std::vector<RByteView> texts = {ints};
+        double scan = ScanRun("ints", texts, repeat);
+        RegexRuns("ints literal", L"(31337)", texts, 0, scan, repeat);
+        RString odd = AnyOf("13579");
+        RegexRuns("ints odd tail",
+                  L"(" + odd + odd + odd + L"\n)",
+                  texts,
+                  0,
+                  scan,
+                  repeat);
+        // Candidates everywhere and no match: each chunk of a parallel
+        // search must stop at its end.
+        RString no_match = L"(" + odd + odd + odd + L"x)";
+        RegexRuns("ints no match", no_match, texts, 0, scan, repeat);
+        ParallelRun("ints no match", no_match, texts, 4, scan, repeat);
+    }
+
+    {
+        // Match prefixes start everywhere, so AUTO has to find where the
+        // match it found the end of starts.
+        RBytes letters =
+            RandomText(static_cast<size_t>(20 * mb * scale), "abcdh", &rng);
+        std::vector<RByteView> texts = {letters};
+        double scan = ScanRun("letters", texts, repeat);
+        RegexRuns("letters partial", L"(ab(?:c|d)*h)", texts, 0, scan, repeat);
+    }
+
+    {
+        std::vector<RBytes> pages;
+        for (size_t i = 0; i < 1000; ++i)
+            pages.push_back(
+                HtmlPage(static_cast<size_t>(100 * 1024 * scale), &rng));
+        std::vector<RByteView> texts = Views(pages);
+        double scan = ScanRun("web", texts, repeat);
+        RegexRuns("web br count", kBrPattern, texts, 0, scan, repeat);
+        StaticRun<kBrPattern>("web br count", texts, scan, repeat);
+        RegexRuns("web title",
+                  L"(<title>(" + AnyOf(" abcdefghijklmnopqrstuvwxyz") +
+                      L"*)</title>)",
+                  texts,
+                  1,
+                  scan,
+                  repeat);
+        // Markup a filter looks for, which these pages never hold.
+        SetRun("web filter",
+               {L"(<script)",
+                L"(<iframe)",
+                L"(javascript:)",
+                L"(onerror=)",
+                L"(onload=)",
+                L"(<object)",
+                L"(<embed)",
+                L"(data:text/html)"},
+               texts,
+               scan,
+               repeat);
+    }
+
+    {
+        std::vector<RBytes> one = {
+            CProgram(static_cast<size_t>(10000 * scale), &rng)};
+        std::vector<RByteView> texts = Views(one);
+        LexRun("lex 10k lines", texts, ScanRun("lex 10k", texts, 1), repeat);
+
+        std::vector<RBytes> many;
+        for (size_t i = 0; i < 100; ++i)
+            many.push_back(CProgram(static_cast<size_t>(1000 * scale), &rng));
+        texts = Views(many);
+        LexRun("lex 100 x 1k", texts, ScanRun("lex 100", texts, 1), repeat);
+    }
+    {
+        std::vector<RBytes> words = {
+            Words(&rng, static_cast<size_t>(10000 * scale))};
+        std::vector<RByteView> texts = Views(words);
+        size_t count = std::max<size_t>(1, static_cast<size_t>(2000 * scale));
+        double scan = ScanRun("startup", texts, repeat);
+        StartupRun("startup 2k", count, texts, scan * count, repeat);
+    }
+}
+
+// Returns false if some file couldn't be searched.
+static bool RunFiles(const std::vector<std::pair<std::string, RString>> & runs,
+                     int repeat) {
+    bool ok = true;
+    for (const auto & run : runs)
+    {
+        MappedFile file;
+        if (!file.Open(run.first))
+        {
+            std::fprintf(stderr, "%s: can't map it\n", run.first.c_str());
+            ok = false;
+            continue;
+        }
+        Input input = Input::Detect(file.Bytes());
+        if (!input.IsByteText() || !input.IsValid())
+        {
+            std::fprintf(stderr,
+                         "%s: isn't ASCII or UTF-8 text\n",
+                         run.first.c_str());
+            ok = false;
+            continue;
+        }
+        std::vector<RByteView> texts = {input.Bytes()};
+        double scan = ScanRun(run.first, texts, repeat);
+        RegexRuns(run.first, L"(" + run.second + L")", texts, 0, scan, repeat);
+    }
+    return ok;
+}
+
+int main(int argc, char * argv[]) {
+    double scale = 1;
+    int repeat = 1;
+    std::vector<std::pair<std::string, RString>> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+            scale = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = std::max(1, std::atoi(argv[++i]));
+        else if (argv[i][0] != '-' && i + 1 < argc)
+        {
+            RString buffer;
+            RView pattern = Input(argv[i + 1], Input::UTF8).WideText(&buffer);
+            files.emplace_back(argv[i],
+                               RString(pattern.begin(), pattern.end()));
+            ++i;
+        }
+        else
+        {
+            std::fprintf(stderr,
+                         "usage: benchmark [--scale S] [--repeat N] "
+                         "[FILE PATTERN]...\n");
+            return 2;
+        }
+    }
+
+    ReportHeader();
+    if (files.empty())
+    {
+        RunSynthetic(scale, repeat);
+        return 0;
+    }
+    return RunFiles(files, repeat) ? 0 : 2;
+}
@@ -1,12 +1,64 @@
 ﻿#include "stdafx.h"
 
+#include "FileSearch.h"
+#include "Input.h"
 #include "Postfix.h"
 #include "RegexCompiler.h"
 
+#include <clocale>
+
+#ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#endif
+
+// grep-like mode: re PATTERN FILE...
+// Prints "path:line:offset:match" per match, offsets in bytes. Returns 0 if
+// anything matched, 1 if nothing did, 2 if the pattern is malformed or a
+// file couldn't be searched.
+static int SearchFiles(int argc, char * argv[]) {
+    RString buffer;
+    RView pattern = Input(argv[1], Input::UTF8).WideText(&buffer);
+    // Group 0 is the whole pattern.
+    RString regex = L"(" + RString(pattern.begin(), pattern.end()) + L")";
+    size_t error = FindSyntaxError(regex);
+    if (error != RString::npos)
+    {
+        // Less the '(' added in front.
+        std::cerr << argv[1] << ": malformed pattern at char "
+                  << std::min(error - 1, pattern.size()) << std::endl;
+        return 2;
+    }
+    MatchOptions options;
+    options.utf8 = true;
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
+
+    bool matched = false;
+    bool failed = false;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string path = argv[i];
+        bool ok = SearchFile(path, enfa, [&](const FileMatch & m) {
+            std::cout << path << ':' << m.line << ':' << m.offset << ':'
+                      << m.text << '\n';
+            matched = true;
+        });
+        if (!ok)
+        {
+            std::cerr << path
+                      << ": can't map it, or it isn't ASCII or UTF-8 text"
+                      << std::endl;
+            failed = true;
+        }
+    }
+    std::cout.flush();
+    return failed ? 2 : (matched ? 0 : 1);
+}
 
 int main(int argc, char * argv[]) {
+    if (argc >= 3)
+        return SearchFiles(argc, argv);
+
     // std::string regex = "(ab*|c)";
     // std::string regex = "((a)*)";
     // std::string regex = "((a*)*)";
@@ -24,8 +76,12 @@ int main(int argc, char * argv[]) {
     // std::string regex = "((?>a*)ab)";
 
     // Fix console output.
+#ifdef _WIN32
     //_setmode(_fileno(stdin), _O_U16TEXT);
     _setmode(_fileno(stdout), _O_U16TEXT);
+#else
+    std::setlocale(LC_ALL, "");
+#endif
 
     //RString regex = L"(yes(?<(?=yes)y(?<y)(?=es)e(?=s)s(?<s)))";
      //RString regex = L"((ab{1,2}){1,3})";
@@ -1,8 +1,22 @@
 #include "stdafx.h"
 
+#include "FileSearch.h"
+#include "Input.h"
+#include "Lexer.h"
+#include "ParallelMatcher.h"
+#include "Postfix.h"
+#include "ProgramFile.h"
 #include "RegexCompiler.h"
+#include "RegexSet.h"
+#include "StaticMatcher.h"
+#include "StreamMatcher.h"
 
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <numeric>
+#include <thread>
 
 static int error_count = 0;
 
@@ -80,8 +94,11 @@ RString MatchAllInfoString(const std::vector<RString> & matches) {
     return s;
 }
 
-void TrueFalse(RString regex, RString input, bool match) {
-    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex);
+void TrueFalse(RString regex,
+               RString input,
+               bool match,
+               MatchOptions options = MatchOptions()) {
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
     MatchResult m = enfa.Match(input);
     if (m.Matched() != match)
     {
@@ -94,8 +111,9 @@ void TrueFalse(RString regex, RString input, bool match) {
 
 void AllMatches(RString regex,
                 RString input,
-                std::vector<RString> expect_matches) {
-    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex);
+                std::vector<RString> expect_matches,
+                MatchOptions options = MatchOptions()) {
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
     std::vector<MatchResult> actual_matches = enfa.MatchAll(input);
     RString actual = MatchAllInfoString(actual_matches);
     RString expected = MatchAllInfoString(expect_matches);
@@ -112,8 +130,9 @@ void AllMatches(RString regex,
 void TrueFalseCapture(RString regex,
                       RString input,
                       bool match,
-                      std::map<size_t, std::vector<RString>> captured) {
-    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex);
+                      std::map<size_t, std::vector<RString>> captured,
+                      MatchOptions options = MatchOptions()) {
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
     MatchResult m = enfa.Match(input);
     if (m.Matched() != match)
     {
@@ -138,6 +157,435 @@ void TrueFalseCapture(RString regex,
     }
 }
 
+void AllMatchesUtf8(RString regex,
+                    RBytes input,
+                    std::vector<RBytes> expect_matches,
+                    MatchOptions options = MatchOptions()) {
+    options.utf8 = true;
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
+    std::vector<RBytes> actual_matches;
+    for (const ByteMatchResult & m : enfa.MatchAll(input))
+    {
+        RByteView text = m.GetCapture().Group(0).GetLast();
+        actual_matches.emplace_back(text.begin(), text.end());
+    }
+    if (actual_matches != expect_matches)
+    {
+        std::wcout << L"[ERROR] Incorrect matches for regex '" << regex
+                   << L"' and UTF-8 text of " << input.size() << L" bytes"
+                   << std::endl;
+        ++error_count;
+    }
+}
+
+// Decodes 'input' forward and backward.
+void InputChars(Input input, bool valid, std::vector<UINT32> expect_chars) {
+    std::vector<UINT32> forward, backward;
+    RByteView bytes = input.Bytes();
+    bool utf16 = !input.IsByteText();
+    bool big_endian = (input.GetEncoding() == Input::UTF16BE);
+    if (utf16)
+    {
+        UTF16Encoding chars(bytes, big_endian);
+        while (chars.HasNext())
+            forward.push_back(chars.Next());
+        while (chars.HasPrev())
+            backward.insert(backward.begin(), chars.Prev());
+    }
+    else
+    {
+        UTF8Encoding chars(bytes);
+        while (chars.HasNext())
+            forward.push_back(chars.Next());
+        while (chars.HasPrev())
+            backward.insert(backward.begin(), chars.Prev());
+    }
+    if (input.IsValid() != valid || forward != expect_chars ||
+        backward != expect_chars)
+    {
+        std::wcout << L"[ERROR] Incorrect decoding of " << bytes.size()
+                   << L" bytes" << std::endl;
+        ++error_count;
+    }
+}
+
+// Searches a file holding 'content', expecting "line:offset:match" lines.
+void FileMatches(RString regex,
+                 RBytes content,
+                 std::vector<RBytes> expect_matches) {
+    const char * path = "unittest_search.tmp";
+    std::ofstream(path, std::ios::binary) << content;
+    MatchOptions options;
+    options.utf8 = true;
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
+    std::vector<RBytes> actual_matches;
+    bool ok = SearchFile(path, enfa, [&](const FileMatch & m) {
+        actual_matches.push_back(std::to_string(m.line) + ":" +
+                                 std::to_string(m.offset) + ":" +
+                                 RBytes(m.text.begin(), m.text.end()));
+    });
+    std::remove(path);
+    if (!ok || actual_matches != expect_matches)
+    {
+        std::wcout << L"[ERROR] Incorrect file matches for regex '" << regex
+                   << L"'" << std::endl;
+        ++error_count;
+    }
+}
+
+// Feeds 'input' in chunks of every size up to 3, expecting what MatchAll
+// finds, and at most 'max_kept' chars kept between chunks.
+void StreamMatches(RString regex,
+                   RString input,
+                   size_t max_kept,
+                   MatchOptions options = MatchOptions()) {
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
+    RString expected;
+    for (const MatchResult & m : enfa.MatchAll(input))
+    {
+        size_t begin = m.GetCapture().Group(0).GetLastRange().first;
+        expected += std::to_wstring(begin);
+        expected += L"\n" + CaptureInfoString(m.GetCapture());
+    }
+    for (size_t chunk = 1; chunk <= 3; ++chunk)
+    {
+        StreamMatcher stream(enfa);
+        RString actual;
+        size_t kept = 0;
+        for (size_t i = 0; i < input.size() + chunk; i += chunk)
+        {
+            std::vector<MatchResult> matches = i < input.size()
+                ? stream.Feed(RView(input.data() + i,
+                                    std::min(chunk, input.size() - i)))
+                : stream.Finish();
+            for (const MatchResult & m : matches)
+            {
+                size_t begin = m.GetCapture().Group(0).GetLastRange().first;
+                actual += std::to_wstring(stream.Offset() + begin);
+                actual += L"\n" + CaptureInfoString(m.GetCapture());
+            }
+            kept = std::max(kept, stream.KeptSize());
+        }
+        if (actual != expected || kept > max_kept)
+        {
+            std::wcout << L"[ERROR] Incorrect stream matches for regex '"
+                       << regex << L"' and text '" << input
+                       << L"' in chunks of " << chunk << L":" << std::endl
+                       << L"Expect:" << std::endl
+                       << expected << L"Actual:" << std::endl
+                       << actual << L"Kept: " << kept << std::endl;
+            ++error_count;
+        }
+    }
+}
+
+// Expects ParallelMatchAll to find what MatchAll does.
+template <typename CharT>
+void ParallelMatches(RString regex,
+                     StringView<CharT> input,
+                     MatchOptions options = MatchOptions()) {
+    options.utf8 = (sizeof(CharT) == 1);
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex, options);
+    std::vector<std::pair<size_t, size_t>> expected, actual;
+    for (const auto & m : enfa.MatchAll(input))
+        expected.push_back(m.GetCapture().Group(0).GetLastRange());
+    for (const auto & m : ParallelMatchAll(enfa, input, 4))
+        actual.push_back(m.GetCapture().Group(0).GetLastRange());
+    if (actual != expected)
+    {
+        std::wcout << L"[ERROR] Incorrect parallel matches for regex '"
+                   << regex << L"': " << actual.size() << L" matches, "
+                   << expected.size() << L" expected" << std::endl;
+        ++error_count;
+    }
+}
+
+// Expects threads sharing one matcher, half of them with a scratch of
+// their own, to find what MatchAll does on one thread.
+void SharedMatches(RString regex, RString input) {
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(regex);
+    std::vector<std::pair<size_t, size_t>> expected;
+    for (const MatchResult & m : enfa.MatchAll(input))
+        expected.push_back(m.GetCapture().Group(0).GetLastRange());
+    std::atomic<int> failures(0);
+    auto work = [&](bool own_scratch) {
+        MatchScratch scratch(enfa);
+        for (int round = 0; round < 20; ++round)
+        {
+            std::vector<std::pair<size_t, size_t>> actual;
+            for (const MatchResult & m :
+                 enfa.MatchAll(input, own_scratch ? &scratch : nullptr))
+            {
+                actual.push_back(m.GetCapture().Group(0).GetLastRange());
+            }
+            if (actual != expected)
+                ++failures;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i)
+        threads.emplace_back(work, i % 2 == 0);
+    for (std::thread & t : threads)
+        t.join();
+    if (failures > 0)
+    {
+        std::wcout << L"[ERROR] Incorrect matches of shared matcher for "
+                   << L"regex '" << regex << L"'" << std::endl;
+        ++error_count;
+    }
+}
+
+// Expects each pattern loaded from a program file, in memory and saved to
+// disk, to find what it does when compiled, with the same captures.
+void SavedMatches(std::vector<RString> regexes,
+                  RString input,
+                  MatchOptions options = MatchOptions()) {
+    std::vector<EnfaMatcher> compiled;
+    for (const RString & regex : regexes)
+        compiled.push_back(RegexCompiler::CompileToEnfa(regex, options));
+    RBytes image = ProgramFile::Write(compiled);
+    // Copied to keep it 8-byte aligned.
+    std::vector<UINT64> aligned((image.size() + 7) / 8);
+    std::memcpy(aligned.data(), image.data(), image.size());
+    ProgramFile loaded, opened;
+    const char * path = "unittest_program.tmp";
+    bool ok = loaded.Load(RByteView(
+                  reinterpret_cast<const char *>(aligned.data()),
+                  image.size())) &&
+        ProgramFile::Save(path, compiled) && opened.Open(path);
+    std::remove(path);
+    for (size_t i = 0; ok && i < compiled.size(); ++i)
+    {
+        ok = loaded.Size() == compiled.size() &&
+            opened.Size() == compiled.size();
+        for (const ProgramFile * file : {&loaded, &opened})
+        {
+            if (!ok)
+                break;
+            std::vector<MatchResult> expected = compiled[i].MatchAll(input);
+            std::vector<MatchResult> actual = file->Matcher(i).MatchAll(input);
+            ok = actual.size() == expected.size();
+            for (size_t m = 0; ok && m < actual.size(); ++m)
+            {
+                ok = CaptureInfoString(actual[m].GetCapture()) ==
+                    CaptureInfoString(expected[m].GetCapture());
+            }
+        }
+    }
+    if (!ok)
+    {
+        std::wcout << L"[ERROR] Incorrect matches of loaded program for "
+                   << L"regex '" << regexes.front() << L"'" << std::endl;
+        ++error_count;
+    }
+}
+
+// Expects the patterns of a RegexSet matching 'input' to be 'expected',
+// the ones that find a match on their own.
+void SetMatches(std::vector<RString> patterns,
+                RString input,
+                std::vector<size_t> expected) {
+    RegexSet set(patterns);
+    std::vector<size_t> separate;
+    for (size_t i = 0; i < patterns.size(); ++i)
+    {
+        if (RegexCompiler::CompileToEnfa(patterns[i]).Search(input).Matched())
+            separate.push_back(i);
+    }
+    std::vector<size_t> actual = set.Matches(input);
+    if (actual != expected || separate != expected)
+    {
+        std::wcout << L"[ERROR] Incorrect set matches in '" << input
+                   << L"': " << actual.size() << L" patterns, "
+                   << expected.size() << L" expected" << std::endl;
+        ++error_count;
+    }
+}
+
+// Expects the tokens of 'input' to be 'expected', written as "[id text]"
+// each, then "!pos" if tokenizing stops early.
+void LexTokens(std::vector<std::pair<RString, int>> rules,
+               RString input,
+               RString expected) {
+    Lexer lexer(rules);
+    std::vector<Token> tokens;
+    bool ok = lexer.Tokenize(input, &tokens);
+    RString actual;
+    size_t end = 0;
+    for (const Token & t : tokens)
+    {
+        actual += L"[" + std::to_wstring(t.id) + L" " +
+            input.substr(t.offset, t.length) + L"]";
+        end = t.offset + t.length;
+    }
+    if (!ok)
+        actual += L"!" + std::to_wstring(end);
+    if (actual != expected)
+    {
+        std::wcout << L"[ERROR] Incorrect tokens of '" << input << L"'"
+                   << std::endl
+                   << L"  expect: " << expected << std::endl
+                   << L"  actual: " << actual << std::endl;
+        ++error_count;
+    }
+}
+
+// Last range of each group that captured, as "id:begin-end ".
+template <typename Capture>
+std::string LastRangesString(const Capture & c) {
+    std::string s;
+    for (auto g = c.GroupBegin(); g != c.GroupEnd(); ++g)
+    {
+        if (g->second.captured().empty())
+            continue;
+        std::pair<size_t, size_t> range = g->second.GetLastRange();
+        s += std::to_string(g->first) + ":" + std::to_string(range.first) +
+            "-" + std::to_string(range.second) + " ";
+    }
+    return s;
+}
+
+template <typename Result>
+std::string StaticRangesString(const Result & m, size_t group_count) {
+    std::string s;
+    for (size_t g = 0; g < group_count; ++g)
+    {
+        if (!m.Captured(g))
+            continue;
+        std::pair<size_t, size_t> range = m.GetLastRange(g);
+        s += std::to_string(g) + ":" + std::to_string(range.first) + "-" +
+            std::to_string(range.second) + " ";
+    }
+    return s;
+}
+
+// Expects StaticMatcher<Regex> to find the matches and captures EnfaMatcher
+// finds, over 'input' and its UTF-8 bytes, and to agree on whole matches.
+template <const RChar * Regex>
+void StaticMatches(RString input) {
+    typedef StaticMatcher<Regex> Static;
+    EnfaMatcher enfa = RegexCompiler::CompileToEnfa(Regex);
+    std::string expected, actual;
+    for (const MatchResult & m : enfa.MatchAll(input))
+        expected += LastRangesString(m.GetCapture()) + "| ";
+    typename Static::Iterator it(input);
+    while (it.HasNext())
+        actual += StaticRangesString(it.Next(), Static::kGroupCount) + "| ";
+    bool ok = (actual == expected) &&
+        (Static::Match(input) == enfa.Match(input).Matched());
+
+    MatchOptions options;
+    options.utf8 = true;
+    EnfaMatcher utf8 = RegexCompiler::CompileToEnfa(Regex, options);
+    RBytes bytes;
+    for (RChar c : input)
+    {
+        for (size_t i = 0; i < StaticUnits<RByte>::Count(CodeUnit(c)); ++i)
+        {
+            bytes +=
+                static_cast<RByte>(StaticUnits<RByte>::Unit(CodeUnit(c), i));
+        }
+    }
+    expected.clear(), actual.clear();
+    for (const ByteMatchResult & m : utf8.MatchAll(bytes))
+        expected += LastRangesString(m.GetCapture()) + "| ";
+    typename Static::ByteIterator byte_it(bytes);
+    while (byte_it.HasNext())
+    {
+        actual +=
+            StaticRangesString(byte_it.Next(), Static::kGroupCount) + "| ";
+    }
+    ok = ok && (actual == expected);
+    if (!ok)
+    {
+        std::wcout << L"[ERROR] Incorrect matches of static matcher for "
+                   << L"regex '" << Regex << L"' and text '" << input << L"'"
+                   << std::endl;
+        ++error_count;
+    }
+}
+
+// Expects a Lexer, a RegexSet and each pattern compiled to machine code,
+// also when loaded from a program file, to find what the table-driven ones
+// do in the UTF-8 'input'. Rule ids are their indices.
+void JitMatches(std::vector<RString> patterns, RBytes input) {
+    MatchOptions options, jit;
+    options.utf8 = jit.utf8 = true;
+    jit.jit = true;
+    std::vector<std::pair<RString, int>> rules;
+    for (size_t i = 0; i < patterns.size(); ++i)
+        rules.emplace_back(patterns[i], static_cast<int>(i));
+    Lexer lexer(rules, options), jit_lexer(rules, jit);
+    RegexSet set(patterns, options), jit_set(patterns, jit);
+    std::vector<Token> tokens, jit_tokens;
+    bool ok = lexer.Tokenize(input, &tokens) ==
+        jit_lexer.Tokenize(input, &jit_tokens);
+    ok = ok && tokens.size() == jit_tokens.size();
+    for (size_t i = 0; ok && i < tokens.size(); ++i)
+    {
+        ok = tokens[i].id == jit_tokens[i].id &&
+            tokens[i].offset == jit_tokens[i].offset &&
+            tokens[i].length == jit_tokens[i].length;
+    }
+    ok = ok && set.Matches(input) == jit_set.Matches(input);
+#if defined(__x86_64__) || defined(_M_X64)
+    ok = ok && jit_lexer.IsJitted() && jit_set.IsJitted();
+#endif
+    std::vector<EnfaMatcher> matchers, jit_matchers;
+    for (const RString & pattern : patterns)
+    {
+        matchers.push_back(RegexCompiler::CompileToEnfa(pattern, options));
+        jit_matchers.push_back(RegexCompiler::CompileToEnfa(pattern, jit));
+    }
+    RBytes image = ProgramFile::Write(jit_matchers);
+    // Copied to keep it 8-byte aligned.
+    std::vector<UINT64> aligned((image.size() + 7) / 8);
+    std::memcpy(aligned.data(), image.data(), image.size());
+    ProgramFile loaded;
+    ok = ok &&
+        loaded.Load(RByteView(reinterpret_cast<const char *>(aligned.data()),
+                              image.size()));
+    for (size_t i = 0; ok && i < patterns.size(); ++i)
+    {
+        std::vector<ByteMatchResult> expected = matchers[i].MatchAll(input);
+        const EnfaMatcher * jitted[] = {&jit_matchers[i], &loaded.Matcher(i)};
+        for (const EnfaMatcher * m : jitted)
+        {
+            std::vector<ByteMatchResult> actual = m->MatchAll(input);
+            ok = ok && actual.size() == expected.size();
+            for (size_t k = 0; ok && k < actual.size(); ++k)
+            {
+                ok = LastRangesString(actual[k].GetCapture()) ==
+                    LastRangesString(expected[k].GetCapture());
+            }
+#if defined(__x86_64__) || defined(_M_X64)
+            ok = ok && m->IsJitted();
+#endif
+        }
+    }
+    if (!ok)
+    {
+        std::wcout << L"[ERROR] Incorrect matches of jitted DFA for regex '"
+                   << patterns.front() << L"'" << std::endl;
+        ++error_count;
+    }
+}
+
+// Patterns of the static matcher tests, which need linkage.
+static constexpr RChar kStaticLogPrefix[] = L"((?:INFO|WARN) (?:0|1)*: )";
+static constexpr RChar kStaticAlter[] = L"((a)|(ab)c|)";
+static constexpr RChar kStaticLazy[] = L"(a(b*?)(b{1,2})c)";
+static constexpr RChar kStaticGroupRepeat[] = L"((ab|a)*(b)\\2?)";
+static constexpr RChar kStaticBackref[] = L"((a*)x\\1)";
+static constexpr RChar kStaticCounted[] = L"((?:ab){2,3}(c){0,})";
+static constexpr RChar kStaticEmptyBody[] = L"((a|)*b)";
+static constexpr RChar kStaticEmptyMin[] = L"((a|){2,}b|(|a){3}c)";
+static constexpr RChar kStaticEmptyFirst[] = L"((?:|cb)*c)";
+static constexpr RChar kStaticEmptyGreedy[] = L"((?:|a)*)";
+static constexpr RChar kStaticEmptyNested[] = L"((|(cb|))*cc*)";
+static constexpr RChar kStaticLookAround[] = L"((?<a)b(?=c)|(?<ab)(?>a*)x)";
+static constexpr RChar kStaticWide[] = L"(\u00e9*\u4e2d(x|\u00e9))";
+
 // evil case: "(a\0)" ["a", "aa", "aaa", ...]
 void RUN_HARDCORE_TEST() {
     // backtracking
@@ -197,6 +645,27 @@ void RUN_ALL_TEST() {
     AllMatches(L"(a*?)", L"aaa", {L"", L"", L"", L""});
     AllMatches(L"(a{1,2})", L"aa", {L"aa"});
     AllMatches(L"(a{1,2}?)", L"aa", {L"a", L"a"});
+    // syntax: where a malformed pattern first breaks
+    {
+        std::vector<std::pair<RString, size_t>> cases = {
+            {L"(a", 2},
+            {L"(a))", 3},
+            {L"(a**)", 3},
+            {L"(a{3,1})", 6},
+            {L"(\\x)", 2},
+            {L"(\\1)", 2},
+            {L"((a)\\1)", RString::npos},
+            {L"(\\2(a)(b))", RString::npos}};
+        for (const auto & c : cases)
+        {
+            if (FindSyntaxError(c.first) != c.second)
+            {
+                std::wcout << L"[ERROR] Wrong syntax error position for '"
+                           << c.first << L"'" << std::endl;
+                ++error_count;
+            }
+        }
+    }
 
     // group: capture
     TrueFalseCapture(L"(a)", L"a", true, {{0, {L"a"}}});
@@ -229,6 +698,535 @@ void RUN_ALL_TEST() {
     TrueFalse(L"((?>a*)ab)", L"aab", false);
     TrueFalse(L"((?>a|ab)b)", L"ab", true);
     TrueFalse(L"((?>a|ab)b)", L"abb", false);
+
+    // dfa: leftmost-first priority
+    AllMatches(L"(a|ab)", L"abab", {L"a", L"a"});
+    AllMatches(L"(ab|a)", L"abab", {L"ab", L"ab"});
+    AllMatches(L"(a*?b)", L"aabab", {L"aab", L"ab"});
+    // dfa: empty loop
+    TrueFalse(L"((?:a*)*b)", L"aab", true);
+    TrueFalse(L"((?:a*)*b)", L"aac", false);
+    // dfa: non-ascii
+    TrueFalse(L"(\u00e9*x)", L"\u00e9\u00e9x", true);
+    TrueFalse(L"(\u00e9*x)", L"\u00e8x", false);
+
+    // search: leftmost start first, then priority
+    AllMatches(L"(b|ab)", L"ab", {L"ab"});
+    AllMatches(L"(a*?b|c)", L"caab", {L"c", L"aab"});
+    AllMatches(L"(a(b)|c)", L"xacab", {L"c", L"ab"});
+    // search: the start is found reading back from the end
+    AllMatches(L"((?:ab)*c)", L"xababcabc", {L"ababc", L"abc"});
+    AllMatches(L"(a*(b)|b)", L"xaabb", {L"aab", L"b"});
+    // search: groups of a match are backtracked, memoized
+    AllMatches(L"((?:a|a)*b|(a))",
+               RString(40, L'a'),
+               std::vector<RString>(40, L"a"));
+    // search: look-behind sees text before the search position
+    AllMatches(L"((?<a)b)", L"abbab", {L"b", L"b"});
+
+    MatchOptions pike_vm;
+    pike_vm.engine = MatchOptions::PIKE_VM;
+    // pike vm: priority and captures
+    TrueFalseCapture(
+        L"((a|aa)a*)", L"aaa", true, {{0, {L"aaa"}}, {1, {L"a"}}}, pike_vm);
+    TrueFalseCapture(L"(a(b(c)))",
+                     L"abc",
+                     true,
+                     {{0, {L"abc"}}, {1, {L"bc"}}, {2, {L"c"}}},
+                     pike_vm);
+    TrueFalseCapture(
+        L"((a*)ab)", L"aab", true, {{0, {L"aab"}}, {1, {L"a"}}}, pike_vm);
+    AllMatches(L"((a)|b)", L"ab", {L"a", L"b"}, pike_vm);
+    AllMatches(L"(a*?)", L"aaa", {L"", L"", L"", L""}, pike_vm);
+    // pike vm: last capture of a repeated group
+    TrueFalseCapture(
+        L"((a|b)*)", L"ab", true, {{0, {L"ab"}}, {1, {L"b"}}}, pike_vm);
+    // pike vm: no exponential blowup
+    TrueFalseCapture(L"((a|a)*(a*)*)",
+                     RString(40, L'a'),
+                     true,
+                     {{0, {RString(40, L'a')}}, {1, {L"a"}}, {2, {L""}}},
+                     pike_vm);
+    // pike vm: back references, look-around and history are backtracked
+    TrueFalseCapture(L"((a*)b\\1)",
+                     L"aabaa",
+                     true,
+                     {{0, {L"aabaa"}}, {1, {L"aa"}}},
+                     pike_vm);
+    AllMatches(L"(a(?=b))", L"abaab", {L"a", L"a"}, pike_vm);
+    TrueFalse(L"((?>a*)a)", L"aa", false, pike_vm);
+    MatchOptions pike_vm_history = pike_vm;
+    pike_vm_history.capture_history = true;
+    TrueFalseCapture(L"((a|b)*)",
+                     L"ab",
+                     true,
+                     {{0, {L"ab"}}, {1, {L"a", L"b"}}},
+                     pike_vm_history);
+
+    MatchOptions memoize;
+    memoize.engine = MatchOptions::BACKTRACK;
+    memoize.memoize = true;
+    // memoized backtracking: same priority and captures
+    TrueFalseCapture(
+        L"((a|aa)a*)", L"aaa", true, {{0, {L"aaa"}}, {1, {L"a"}}}, memoize);
+    AllMatches(L"(a{1,2}?)", L"aa", {L"a", L"a"}, memoize);
+    TrueFalse(L"((a)(?:b)(c)\\2)", L"abcc", true, memoize);
+    TrueFalse(L"((?>a*)ab)", L"aab", false, memoize);
+    // memoized backtracking: no exponential blowup
+    TrueFalse(L"((a|a)*b)", RString(40, L'a'), false, memoize);
+    AllMatches(L"((?:a|a)*(?=b))", RString(40, L'a'), {}, memoize);
+    // memoized backtracking: look-around that matched is tried again
+    TrueFalse(L"((?:(?=a*b)a)*b)", L"aab", true, memoize);
+    AllMatches(L"((?:a|b)*c(?=d))", L"abcdxacdbc", {L"abc", L"ac"}, memoize);
+    // memoized backtracking: one memo for every start position, so a long
+    // search stays linear
+    AllMatches(L"((?:a|b)*c(?=d))",
+               RString(100000, L'a') + L"cd" + RString(100000, L'b') + L"c",
+               {RString(100000, L'a') + L"c"},
+               memoize);
+
+    // prefilter: literal prefix
+    AllMatches(L"(ab(c*))", L"xxabccxabxa", {L"abcc", L"ab"});
+    AllMatches(L"(a{2}b)", L"aabaaab", {L"aab", L"aab"});
+    // prefilter: first char set
+    AllMatches(L"((?:x|yz)(?:x|yz)*)", L"aaxayzb", {L"x", L"yz"});
+    // prefilter: backtracking
+    AllMatches(L"(ab(?=c))", L"abcabdab", {L"ab"});
+    AllMatches(L"((?<c)ab)", L"abcab", {L"ab"});
+    // prefilter: literal alternation
+    AllMatches(L"(foo|bar|baz)", L"xbazfoxfoobarba", {L"baz", L"foo", L"bar"});
+    AllMatches(L"((?:foo|bar)(?:x|y))", L"foobarxfooy", {L"barx", L"fooy"});
+    // prefilter: required inner literal
+    AllMatches(L"((?:a|b)*cd)", L"abcdxbbcdcd", {L"abcd", L"bbcd", L"cd"});
+    AllMatches(L"((?:x|y)cd(?:x|y))", L"cdxcdxycdycd", {L"xcdx", L"ycdy"});
+    AllMatches(L"((?:x|y)cd(?=x))", L"ycdyxcdx", {L"xcd"});
+    TrueFalse(L"((a)*(?:bcd|bce))", L"aabce", true, memoize);
+
+    // counted repeat: unrolled
+    TrueFalse(L"((?:a{1,3}b){3}a{1,3})", L"abaabaaabaa", true);
+    TrueFalse(L"((?:a{1,3}b){3}a{1,3})", L"abaaaabab", false);
+    TrueFalse(L"((?:a{1,3}b){3}a{1,3})", L"ababab", false, pike_vm);
+    TrueFalseCapture(
+        L"((a|b){2,3}?c)", L"abac", true, {{0, {L"abac"}}, {1, {L"a"}}});
+    AllMatches(L"((?=a)a{2})", L"aaaaa", {L"aa", L"aa"});
+    // counted repeat: counters
+    TrueFalse(L"(a{0}b)", L"ab", false);
+    TrueFalse(L"(a{0}b)", L"b", true);
+    RString a20b = RString(20, L'a') + L"b";
+    TrueFalse(L"((?:a{20}b){2})", a20b + a20b, true);
+    TrueFalse(L"((?:a{20}b){2})", a20b + a20b.substr(1), false);
+    AllMatches(L"(a{17,}?)",
+               RString(36, L'a'),
+               {RString(17, L'a'), RString(17, L'a')});
+
+    MatchOptions backtrack;
+    backtrack.engine = MatchOptions::BACKTRACK;
+    MatchOptions history;
+    history.capture_history = true;
+    // capture: last capture of each group by default
+    TrueFalseCapture(
+        L"((a|b)*)", L"ab", true, {{0, {L"ab"}}, {1, {L"b"}}}, backtrack);
+    TrueFalseCapture(L"((?=(a))a)", L"a", true, {{0, {L"a"}}}, backtrack);
+    // capture: full history on request
+    TrueFalseCapture(L"((a|b){2,3}?c)",
+                     L"abac",
+                     true,
+                     {{0, {L"abac"}}, {1, {L"a", L"b", L"a"}}},
+                     history);
+    TrueFalseCapture(L"((?>(a)*)b)",
+                     L"aab",
+                     true,
+                     {{0, {L"aab"}}, {1, {L"a", L"a"}}},
+                     history);
+    // capture: back reference to the last closed capture
+    TrueFalse(L"((?:(a|b)\\1)*)", L"aabb", true, backtrack);
+    TrueFalse(L"((?:(a|b)\\1)*)", L"abab", false, backtrack);
+    // capture: back reference to a group that never captured fails
+    TrueFalse(L"((?:(a)|b)\\1)", L"aa", true);
+    TrueFalse(L"((?:(a)|b)\\1)", L"b", false);
+
+    // utf-8: chars match their byte sequences
+    AllMatchesUtf8(
+        L"(\u00e9*x)", "ax\xc3\xa9\xc3\xa9x", {"x", "\xc3\xa9\xc3\xa9x"});
+    AllMatchesUtf8(L"(\u4e2d|\u00e9)",
+                   "a\xe4\xb8\xad\xc3\xa9",
+                   {"\xe4\xb8\xad", "\xc3\xa9"});
+    AllMatchesUtf8(L"((?<\u00e9)x)", "ax\xc3\xa9x", {"x"}, backtrack);
+    AllMatchesUtf8(
+        L"((\u00e9)\\1)", "\xc3\xa9\xc3\xa9", {"\xc3\xa9\xc3\xa9"}, backtrack);
+    // utf-8: empty matches only at char boundaries
+    AllMatchesUtf8(L"(a*)", "\xc3\xa9", {"", ""});
+
+    // input: decoding and validation
+    InputChars(Input::Detect("\xef\xbb\xbf" "a\xc3\xa9\xe4\xb8\xad"
+                             "\xf0\x9f\x98\x80"),
+               true,
+               {'a', 0xe9, 0x4e2d, 0x1f600});
+    InputChars(
+        Input::Detect(RByteView("\xff\xfe" "a\0" "\x3d\xd8\x00\xde", 8)),
+        true,
+        {'a', 0x1f600});
+    InputChars(Input::Detect(RByteView("\xfe\xff" "\0a" "\xd8\x3d", 6)),
+               false,
+               {'a', 0xd83d});
+    InputChars(Input("\xc0\xaf", Input::UTF8), false, {0x2f});
+    InputChars(Input("\xed\xa0\x80", Input::UTF8), false, {0xd800});
+    // input: the ascii fast path stops at the first non-ascii byte
+    InputChars(Input("0123456789abcdefghijklmnopqrstu\xc3\xa9", Input::UTF8),
+               true,
+               {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b',
+                'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
+                'o', 'p', 'q', 'r', 's', 't', 'u', 0xe9});
+    {
+        RString buffer;
+        Input input(RByteView("a\0\xe9\0", 4), Input::UTF16LE);
+        RView wide = input.WideText(&buffer);
+        if (RString(wide.begin(), wide.end()) != L"a\u00e9")
+        {
+            std::wcout << L"[ERROR] Incorrect wide text of UTF-16 input"
+                       << std::endl;
+            ++error_count;
+        }
+    }
+    {
+        RByteView text = Input::Detect("\xef\xbb\xbf\xc3\xa9x").Bytes();
+        AllMatchesUtf8(
+            L"(\u00e9x)", RBytes(text.begin(), text.end()), {"\xc3\xa9x"});
+    }
+
+    // file search: offsets count the byte-order mark, lines start at 1
+    FileMatches(L"(bb*|x)",
+                "\xef\xbb\xbf" "ab\r\nx\n\nabbb",
+                {"1:4:b", "2:7:x", "4:11:bbb"});
+    FileMatches(L"(a\nb)", "a\nb\na\nb", {"1:0:a\nb", "3:4:a\nb"});
+    FileMatches(L"(x)", "", {});
+
+    // parallel: matches straddling chunk boundaries
+    {
+        RString text;
+        for (size_t i = 0; text.size() < 300000; i = i * 7 + 1)
+            text += L"xa" + RString(i % 100000, 'b');
+        ParallelMatches<RChar>(L"(ab*)", text);
+        ParallelMatches<RChar>(L"(b*)", text);
+        ParallelMatches<RChar>(L"((?<a)bb)", text);
+        ParallelMatches<RChar>(L"((?:bbb)*x)", text);
+        ParallelMatches<RChar>(L"(ab*y)", text);
+        RBytes bytes;
+        for (size_t i = 0; i < 100000; ++i)
+            bytes += (i % 1000 == 0 ? "x" : "\xc3\xa9");
+        ParallelMatches<RByte>(L"(\u00e9\u00e9|x*)", bytes);
+    }
+    // parallel: a chunk only looks for matches starting in it
+    for (const MatchOptions & options : {MatchOptions(), backtrack, pike_vm})
+    {
+        EnfaMatcher enfa = RegexCompiler::CompileToEnfa(L"((a)b*)", options);
+        RString text = L"xxabbbxab";
+        std::string ranges =
+            LastRangesString(enfa.Search(text, 0, nullptr, 3).GetCapture());
+        if (enfa.Search(text, 0, nullptr, 2).Matched() ||
+            ranges != "0:2-6 1:2-3 " ||
+            enfa.Search(text, 3, nullptr, 7).Matched())
+        {
+            std::wcout << L"[ERROR] Search found a match starting past its "
+                       << L"bound" << std::endl;
+            ++error_count;
+        }
+    }
+
+    // shared matcher: threads match at once, with or without scratch
+    {
+        RString text;
+        for (size_t i = 0; text.size() < 20000; i = i * 7 + 1)
+            text += L"ab" + RString(i % 50, 'c') + L"x";
+        SharedMatches(L"(a(b|c)*x)", text);
+        SharedMatches(L"((?:cc)*x|b)", text);
+        SharedMatches(L"((a)\\1*b)", text);
+    }
+
+    // set: which patterns match, in one pass
+    SetMatches({L"(ab)", L"(b*c)", L"(x)", L"((?:ab)*)"}, L"abc", {0, 1, 3});
+    SetMatches({L"(ab)", L"(x|c)", L"(ca)"}, L"", {});
+    SetMatches({L"((a)\\1)", L"(b)", L"((?=a)ab)", L"(c)"}, L"aab", {0, 1, 2});
+    SetMatches({L"((a)\\1)", L"((?<b)a)"}, L"aba", {1});
+    {
+        std::vector<RString> patterns;
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < 500; ++i)
+        {
+            patterns.push_back(L"(x" + std::to_wstring(i) + L"y)");
+            if (i % 7 == 3)
+                expected.push_back(i);
+        }
+        RString text;
+        for (size_t i : expected)
+            text += L"x" + std::to_wstring(i) + L"y x1";
+        SetMatches(patterns, text, expected);
+    }
+    {
+        MatchOptions options;
+        options.utf8 = true;
+        RegexSet set({L"(\u00e9)", L"(a\u00e9*b)", L"(\u00e8)"}, options);
+        std::vector<size_t> expected = {0, 1};
+        if (set.Matches(RBytes("x\xc3\xa9" "ab")) != expected)
+        {
+            std::wcout << L"[ERROR] Incorrect set matches of UTF-8 text"
+                       << std::endl;
+            ++error_count;
+        }
+    }
+
+    // lexer: longest match, earlier rule on ties
+    {
+        std::vector<std::pair<RString, int>> rules = {
+            {L"(if)", 1},
+            {L"((?:i|f|x)(?:i|f|x|0|1)*)", 2},
+            {L"((?:0|1)(?:0|1)*)", 3},
+            {L"(=|==|<|<=)", 4},
+            {L"( (?: )*)", 5},
+        };
+        LexTokens(rules, L"if", L"[1 if]");
+        LexTokens(rules, L"iff", L"[2 iff]");
+        LexTokens(rules, L"if x==10", L"[1 if][5  ][2 x][4 ==][3 10]");
+        LexTokens(rules, L"x<=1 <x", L"[2 x][4 <=][3 1][5  ][4 <][2 x]");
+        LexTokens(rules, L"x = y", L"[2 x][5  ][4 =][5  ]!4");
+        LexTokens(rules, L"", L"");
+        // Empty matches don't make tokens.
+        LexTokens({{L"(a*)", 1}, {L"(b)", 2}}, L"aabxa", L"[1 aa][2 b]!3");
+        // Too many states to build in full: the lazy DFA runs.
+        RString tail;
+        for (int i = 0; i < 11; ++i)
+            tail += L"(?:a|b)";
+        LexTokens({{L"((?:a|b)*a" + tail + L")", 1}, {L"(b)", 2}},
+                  L"babbbbbbbbbbbb",
+                  L"[1 babbbbbbbbbbb][2 b]");
+    }
+
+    // jit: the dense DFA as machine code
+    JitMatches({L"(if)",
+                L"((?:i|f|x)(?:i|f|x|0|1)*)",
+                L"((?:0|1)(?:0|1)*)",
+                L"(=|==|<|<=)",
+                L"( (?: )*)"},
+               "if x==10 iff x<=1 <x");
+    JitMatches({L"(a*)", L"(b)"}, "aabxa");
+    JitMatches({L"(\u00e9(?:x|\u4e2d)*)", L"(x)", L"(\u00e8)"},
+               "\xc3\xa9x\xe4\xb8\xadxx\xc3\xa9\xc3\xa8");
+    JitMatches({L"(ab)", L"(x|c)", L"(ca)"}, "");
+    // Runs long enough for the code to take over from the table.
+    JitMatches({L"((?:a|b)*c)", L"(b(b)*)", L"( *)"},
+               RBytes(40, 'a') + "c " + RBytes(30, 'b') + "x" +
+                   RBytes(20, ' ') + RBytes(50, 'b') + "c" + RBytes(17, 'b'));
+    {
+        // Too many ways out of a state to test each: it looks them up.
+        std::vector<RString> patterns;
+        RBytes text;
+        for (char c = 'a'; c <= 'p'; ++c)
+        {
+            patterns.push_back(RString(L"(") + RChar(c) + RChar(c + 1) + L")");
+            // Every third pattern matches.
+            text += RBytes(1, c) + (c % 3 == 0 ? RBytes(1, c + 1) : "x");
+        }
+        JitMatches(patterns, text);
+        JitMatches(patterns, text.substr(0, text.size() / 2));
+    }
+    {
+        // Bytes at both ends of the range, and every one in between.
+        RBytes all;
+        for (int c = 1; c < 256; ++c)
+            all += static_cast<RByte>(c);
+        JitMatches({L"(\u007f\u0001)", L"(a(?:b|\u007f)*)"},
+                   all + "ab\x7f\x7f\x01");
+    }
+
+    // simplify: factored alternations keep their order and captures
+    AllMatches(L"(abc|abd|ab|b)", L"abdabcabb", {L"abd", L"abc", L"ab", L"b"});
+    AllMatches(L"(ab|abc|xc|c)", L"abcxcc", {L"ab", L"c", L"xc", L"c"});
+    TrueFalseCapture(
+        L"((ab)c|a(b)d)", L"abd", true, {{0, {L"abd"}}, {2, {L"b"}}});
+    TrueFalseCapture(L"((?:a{1})*(b|b|c))", L"aac", true,
+                     {{0, {L"aac"}}, {1, {L"c"}}});
+    // simplify: empty branches
+    AllMatches(L"(a|)", L"ab", {L"a", L"", L""});
+    AllMatches(L"(|a)", L"ab", {L"", L"", L""});
+    AllMatches(L"(a||b)", L"ab", {L"a", L"", L""});
+    TrueFalse(L"((?:)b)", L"b", true);
+    TrueFalseCapture(
+        L"(a()b)", L"ab", true, {{0, {L"ab"}}, {1, {L""}}});
+    TrueFalse(L"(a(?<)b)", L"ab", true);
+    // loops whose body can match empty stop going around without consuming
+    for (const MatchOptions & options : {MatchOptions(), backtrack, pike_vm})
+    {
+        AllMatches(L"((?:c|)*)", L"ccxcc", {L"cc", L"", L"cc", L""}, options);
+        AllMatches(
+            L"((?:c*a{0,0})*)", L"ccxcc", {L"cc", L"", L"cc", L""}, options);
+        AllMatches(L"((?:a*b*)*c)", L"abbac", {L"abbac"}, options);
+        AllMatches(L"((?:(c)|){3}x)", L"cx", {L"cx"}, options);
+        AllMatches(L"((?:c|){40,}x)", L"ccx", {L"ccx"}, options);
+        TrueFalseCapture(L"((?:(c)|)*x)",
+                         L"ccx",
+                         true,
+                         {{0, {L"ccx"}}, {1, {L"c"}}},
+                         options);
+    }
+    // ... and every engine keeps the groups of an empty last iteration
+    for (MatchOptions::Engine engine :
+         {MatchOptions::AUTO, MatchOptions::BACKTRACK, MatchOptions::PIKE_VM})
+    {
+        for (bool memo : {false, true})
+        {
+            MatchOptions options;
+            options.engine = engine;
+            options.memoize = memo;
+            TrueFalseCapture(
+                L"((a|)*b)", L"aab", true, {{0, {L"aab"}}, {1, {L""}}}, options);
+            TrueFalseCapture(
+                L"((?:(c|))*)", L"c", true, {{0, {L"c"}}, {1, {L""}}}, options);
+            for (const std::pair<RString, RString> & p :
+                 {std::make_pair(RString(L"((a|)*b)"), RString(L"aab")),
+                  std::make_pair(RString(L"((?:(c|))*)"), RString(L"c"))})
+            {
+                const RString & regex = p.first;
+                const RString & text = p.second;
+                std::string expected, actual;
+                for (const auto & m :
+                     RegexCompiler::CompileToEnfa(regex, backtrack)
+                         .MatchAll(text))
+                    expected += LastRangesString(m.GetCapture()) + "| ";
+                for (const auto & m :
+                     RegexCompiler::CompileToEnfa(regex, options).MatchAll(text))
+                    actual += LastRangesString(m.GetCapture()) + "| ";
+                if (actual != expected)
+                {
+                    std::wcout << L"[ERROR] Engines disagree on the groups of '"
+                               << regex << L"'" << std::endl;
+                    std::cout << "  expect: " << expected << std::endl
+                              << "  actual: " << actual << std::endl;
+                    ++error_count;
+                }
+            }
+        }
+    }
+    TrueFalse(L"((a){0,0}\\1)", L"", false);
+
+    // program file: loaded patterns match as compiled ones do
+    SavedMatches({L"(abc*|d)", L"(a*(?:bx|c)d)", L"((?:ab)*cx(?:ab)*)"},
+                 L"abccxdabcxab");
+    SavedMatches({L"((a){2,3}(b)\\2)", L"((?<=a)b(?=c))", L"((?>a*)b)"},
+                 L"aaabaabc");
+    SavedMatches({L"((a|b)*c)"}, L"ababcac", backtrack);
+    SavedMatches({L"((a|aa)a*)", L"(a{1,2}?)"}, L"aaa", memoize);
+    {
+        MatchOptions history;
+        history.capture_history = true;
+        SavedMatches({L"((a)*(b)*c)"}, L"aabbcac", history);
+        history.engine = MatchOptions::BACKTRACK;
+        SavedMatches({L"((a)*(b)*c)"}, L"aabbcac", history);
+    }
+    SavedMatches({}, L"");
+    // program file: images this build can't load are rejected
+    {
+        std::vector<EnfaMatcher> compiled = {
+            RegexCompiler::CompileToEnfa(L"(ab*)")};
+        RBytes image = ProgramFile::Write(compiled);
+        RBytes bad_dfa = ProgramFile::Write(
+            {RegexCompiler::CompileToEnfa(L"((a)\\1)")});
+        std::vector<UINT64> aligned(
+            (std::max(image.size(), bad_dfa.size()) + 7) / 8 + 1);
+        char * bytes = reinterpret_cast<char *>(aligned.data());
+        auto loads = [&](const RBytes & candidate, size_t skew) {
+            std::memcpy(bytes + skew, candidate.data(), candidate.size());
+            ProgramFile file;
+            return file.Load(RByteView(bytes + skew, candidate.size()));
+        };
+        RBytes bad_magic = image, bad_version = image, bad_op = image;
+        bad_magic[0] = 'X';
+        ++bad_version[8];
+        // The first instruction, after both headers and the offset.
+        bad_op[24 + 8 + 48] = '\x7f';
+        // Fewer groups for the matcher than the program saves.
+        RBytes bad_captures = image;
+        bad_captures.replace(24 + 8 + 16, 4, 4, '\0');
+        // A DFA for a back reference: the kDfa flag set.
+        UINT32 flags = 0;
+        std::memcpy(&flags, &bad_dfa[24 + 8 + 28], sizeof(flags));
+        flags |= 2;
+        std::memcpy(&bad_dfa[24 + 8 + 28], &flags, sizeof(flags));
+        if (!loads(image, 0) || loads(image, 1) || loads(bad_magic, 0) ||
+            loads(bad_version, 0) || loads(bad_op, 0) ||
+            loads(bad_captures, 0) || loads(bad_dfa, 0) ||
+            loads(image.substr(0, image.size() - 8), 0) ||
+            ProgramFile().Open("unittest_missing.tmp"))
+        {
+            std::wcout << L"[ERROR] Program file accepted a bad image"
+                       << std::endl;
+            ++error_count;
+        }
+    }
+
+    // stream: matches spanning chunks, as MatchAll finds them
+    StreamMatches(L"(ab*)", L"abbbxabab", 6);
+    StreamMatches(L"((a)|(ab)c)", L"abcabxa", 5);
+    StreamMatches(L"(a*)", L"baab", 5);
+    StreamMatches(L"((?=ab)a)", L"aabab", 5);
+    StreamMatches(L"((?>a*)b)", L"aabaab", 5);
+    StreamMatches(L"((a)\\1)", L"aaxaa", 5, backtrack);
+    // stream: starts the DFA skips, past states that threads started
+    // earlier share with the start state
+    StreamMatches(L"((?:ab)*c)", L"aaabaxacabcababcx", 7);
+    // stream: only what look-behind may read is kept before an attempt
+    StreamMatches(L"((?<ab)c)", L"xabcabcxxxxxxxxxxxxxxxabc", 5);
+    StreamMatches(L"(xy)", RString(100, 'x') + L"y", 5);
+    {
+        MatchOptions options;
+        options.utf8 = true;
+        EnfaMatcher enfa =
+            RegexCompiler::CompileToEnfa(L"(\u00e9x|a*)", options);
+        ByteStreamMatcher stream(enfa);
+        std::vector<RBytes> actual;
+        for (RByte c : RBytes("\xc3\xa9x\xc3\xa9"))
+        {
+            for (const ByteMatchResult & m : stream.Feed(RByteView(&c, 1)))
+            {
+                RByteView text = m.GetCapture().Group(0).GetLast();
+                actual.emplace_back(text.begin(), text.end());
+            }
+        }
+        for (const ByteMatchResult & m : stream.Finish())
+        {
+            RByteView text = m.GetCapture().Group(0).GetLast();
+            actual.emplace_back(text.begin(), text.end());
+        }
+        if (actual != std::vector<RBytes>({"\xc3\xa9x", "", ""}))
+        {
+            std::wcout << L"[ERROR] Incorrect matches of UTF-8 stream"
+                       << std::endl;
+            ++error_count;
+        }
+    }
+    // static: patterns compiled by the C++ compiler, as EnfaMatcher matches
+    StaticMatches<kStaticLogPrefix>(L"INFO 0110: x WARN : WARNx: ERR 1: ");
+    StaticMatches<kStaticAlter>(L"abcabxa");
+    StaticMatches<kStaticLazy>(L"abbbcabcabbbbc");
+    StaticMatches<kStaticGroupRepeat>(L"aabbababbxb");
+    StaticMatches<kStaticBackref>(L"aaxaaxaxaaax");
+    StaticMatches<kStaticCounted>(L"ababcababababccab");
+    StaticMatches<kStaticEmptyBody>(L"aabxb");
+    StaticMatches<kStaticEmptyMin>(L"bababaabcaacc");
+    // an empty iteration ends the repeat even when the body can consume
+    AllMatches(L"((?:|cb)*c)", L"cbc", {L"c", L"c"});
+    AllMatches(L"((|(cb|))*cc*)", L"babcbcc", {L"c", L"cc"});
+    StaticMatches<kStaticEmptyFirst>(L"cbc");
+    StaticMatches<kStaticEmptyGreedy>(L"aab");
+    StaticMatches<kStaticEmptyNested>(L"babcbcc");
+    StaticMatches<kStaticLookAround>(L"abcbcaaxabaxx");
+    StaticMatches<kStaticWide>(L"\u00e9\u00e9\u4e2dx\u4e2d\u00e9a\u4e2d");
+    if (!StaticMatcher<kStaticLogPrefix>::Match(L"WARN 01: ") ||
+        StaticMatcher<kStaticLogPrefix>::Match(L"WARN 01: x"))
+    {
+        std::wcout << L"[ERROR] Static matcher must match the whole text"
+                   << std::endl;
+        ++error_count;
+    }
 }
 
 //#include <codecvt>
@@ -267,5 +1265,5 @@ int main(int argc, char * argv[]) {
     {
         std::wcout << "All unittest passed." << std::endl;
     }
-    return 0;
+    return error_count == 0 ? 0 : 1;
 }